@@ -0,0 +1,524 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+#include <glib/gstdio.h>
+#include "books-archive.h"
+
+G_DEFINE_TYPE(BooksArchive, books_archive, G_TYPE_OBJECT)
+
+#define BOOKS_ARCHIVE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_ARCHIVE, BooksArchivePrivate))
+
+#define EOCD_SIGNATURE              0x06054b50
+#define EOCD_SIZE                   22
+#define EOCD_MAX_COMMENT_SIZE       65535
+#define ZIP64_LOCATOR_SIGNATURE     0x07064b50
+#define ZIP64_LOCATOR_SIZE          20
+#define ZIP64_EOCD_SIGNATURE        0x06064b50
+#define ZIP64_EOCD_SIZE             56
+#define ZIP64_EXTRA_FIELD_ID        0x0001
+#define CENTRAL_HEADER_SIGNATURE    0x02014b50
+#define CENTRAL_HEADER_SIZE         46
+#define LOCAL_HEADER_SIGNATURE      0x04034b50
+#define LOCAL_HEADER_SIZE           30
+
+#define METHOD_STORED               0
+#define METHOD_DEFLATED             8
+#define FLAG_ENCRYPTED              0x0001
+
+typedef struct {
+    guint64 offset;
+    guint64 compressed_size;
+    guint64 size;
+    guint32 crc;
+    guint16 method;
+    guint16 flags;
+} Entry;
+
+/*
+ * Entries are read with pread into buffers of their own rather than from a
+ * mapping, so that a book rewritten or truncated while it is open leads to
+ * read errors instead of SIGBUS.
+ */
+struct _BooksArchivePrivate {
+    gint         fd;
+    guint64      size;
+    gchar       *filename;
+    gchar       *fingerprint;
+    GHashTable  *entries;
+};
+
+static gboolean  read_central_directory (BooksArchivePrivate *priv, GError **error);
+static void      compute_fingerprint    (BooksArchivePrivate *priv, const guint8 *directory, guint64 directory_size);
+
+GQuark
+books_archive_error_quark (void)
+{
+    return g_quark_from_static_string ("books-archive-error-quark");
+}
+
+static guint16
+read_le16 (const guint8 *p)
+{
+    return (guint16) (p[0] | (p[1] << 8));
+}
+
+static guint32
+read_le32 (const guint8 *p)
+{
+    return (guint32) p[0] | ((guint32) p[1] << 8) | ((guint32) p[2] << 16) | ((guint32) p[3] << 24);
+}
+
+static guint64
+read_le64 (const guint8 *p)
+{
+    return (guint64) read_le32 (p) | ((guint64) read_le32 (p + 4) << 32);
+}
+
+/* Reads exactly @length bytes at @offset, which is safe from any thread */
+static gboolean
+read_at (BooksArchivePrivate *priv,
+         guint64 offset,
+         guint8 *buffer,
+         guint64 length)
+{
+    if (offset > priv->size || length > priv->size - offset)
+        return FALSE;
+
+    while (length > 0) {
+        gssize n_read;
+
+        n_read = pread (priv->fd, buffer, (gsize) MIN (length, G_MAXSSIZE), (off_t) offset);
+
+        if (n_read < 0 && errno == EINTR)
+            continue;
+
+        if (n_read <= 0)
+            return FALSE;
+
+        buffer += n_read;
+        offset += (guint64) n_read;
+        length -= (guint64) n_read;
+    }
+
+    return TRUE;
+}
+
+BooksArchive *
+books_archive_new (void)
+{
+    return BOOKS_ARCHIVE (g_object_new (BOOKS_TYPE_ARCHIVE, NULL));
+}
+
+gboolean
+books_archive_open (BooksArchive *archive,
+                    const gchar *filename,
+                    GError **error)
+{
+    BooksArchivePrivate *priv;
+    GStatBuf buf;
+
+    g_return_val_if_fail (BOOKS_IS_ARCHIVE (archive) && filename != NULL, FALSE);
+
+    priv = archive->priv;
+
+    if (priv->fd >= 0) {
+        close (priv->fd);
+        priv->fd = -1;
+        priv->size = 0;
+        g_hash_table_remove_all (priv->entries);
+        g_free (priv->fingerprint);
+        priv->fingerprint = NULL;
+    }
+
+    g_free (priv->filename);
+    priv->filename = g_strdup (filename);
+    priv->fd = g_open (filename, O_RDONLY, 0);
+
+    if (priv->fd < 0 || fstat (priv->fd, &buf) != 0) {
+        gint saved_errno = errno;
+
+        g_set_error (error, G_FILE_ERROR, g_file_error_from_errno (saved_errno),
+                     "Could not open `%s': %s", filename, g_strerror (saved_errno));
+
+        if (priv->fd >= 0) {
+            close (priv->fd);
+            priv->fd = -1;
+        }
+
+        return FALSE;
+    }
+
+    priv->size = (guint64) buf.st_size;
+
+    return read_central_directory (priv, error);
+}
+
+/*
+ * Identifies the archive contents without reading them: file size and
+ * modification time plus a checksum of the central directory, which covers
+ * the names, sizes and CRCs of all entries.
+ */
+const gchar *
+books_archive_get_fingerprint (BooksArchive *archive)
+{
+    g_return_val_if_fail (BOOKS_IS_ARCHIVE (archive), NULL);
+    return archive->priv->fingerprint;
+}
+
+gboolean
+books_archive_has_entry (BooksArchive *archive,
+                         const gchar *name)
+{
+    g_return_val_if_fail (BOOKS_IS_ARCHIVE (archive), FALSE);
+    return g_hash_table_contains (archive->priv->entries, name);
+}
+
+/*
+ * Reads and inflates a single entry into a buffer of its own. The archive
+ * is never modified after opening, so this can be called from any thread.
+ */
+GBytes *
+books_archive_read_entry (BooksArchive *archive,
+                          const gchar *name,
+                          GError **error)
+{
+    BooksArchivePrivate *priv;
+    Entry *entry;
+    guint8 header[LOCAL_HEADER_SIZE];
+    guint8 *compressed;
+    guint64 data_offset;
+    guint8 *content;
+    z_stream stream;
+    gint result;
+
+    g_return_val_if_fail (BOOKS_IS_ARCHIVE (archive) && name != NULL, NULL);
+
+    priv = archive->priv;
+    entry = g_hash_table_lookup (priv->entries, name);
+
+    if (entry == NULL) {
+        g_set_error (error, BOOKS_ARCHIVE_ERROR, BOOKS_ARCHIVE_ERROR_ENTRY_NOT_FOUND,
+                     "`%s' does not contain `%s'", priv->filename, name);
+        return NULL;
+    }
+
+    if (entry->flags & FLAG_ENCRYPTED ||
+        (entry->method != METHOD_STORED && entry->method != METHOD_DEFLATED) ||
+        entry->size > G_MAXUINT || entry->compressed_size > G_MAXUINT) {
+        g_set_error (error, BOOKS_ARCHIVE_ERROR, BOOKS_ARCHIVE_ERROR_UNSUPPORTED,
+                     "`%s' in `%s' is stored in an unsupported way", name, priv->filename);
+        return NULL;
+    }
+
+    if (!read_at (priv, entry->offset, header, LOCAL_HEADER_SIZE) ||
+        read_le32 (header) != LOCAL_HEADER_SIGNATURE)
+        goto read_entry_corrupted;
+
+    data_offset = entry->offset + LOCAL_HEADER_SIZE +
+                  read_le16 (header + 26) + read_le16 (header + 28);
+
+    if ((entry->method == METHOD_STORED && entry->compressed_size != entry->size) ||
+        data_offset > priv->size || entry->compressed_size > priv->size - data_offset)
+        goto read_entry_corrupted;
+
+    compressed = g_malloc (entry->compressed_size);
+
+    if (!read_at (priv, data_offset, compressed, entry->compressed_size)) {
+        g_free (compressed);
+        goto read_entry_corrupted;
+    }
+
+    if (entry->method == METHOD_STORED)
+        return g_bytes_new_take (compressed, entry->size);
+
+    /* inflate rejects a NULL output buffer, which g_malloc returns for empty files */
+    if (entry->size == 0) {
+        g_free (compressed);
+        return g_bytes_new (NULL, 0);
+    }
+
+    content = g_malloc (entry->size);
+    memset (&stream, 0, sizeof (stream));
+
+    /* Negative window bits select a raw deflate stream without zlib header */
+    if (inflateInit2 (&stream, -MAX_WBITS) != Z_OK) {
+        g_free (compressed);
+        g_free (content);
+        goto read_entry_corrupted;
+    }
+
+    stream.next_in = (Bytef *) compressed;
+    stream.avail_in = (uInt) entry->compressed_size;
+    stream.next_out = content;
+    stream.avail_out = (uInt) entry->size;
+
+    result = inflate (&stream, Z_FINISH);
+    inflateEnd (&stream);
+    g_free (compressed);
+
+    if (result != Z_STREAM_END || stream.total_out != entry->size ||
+        crc32 (0, content, (uInt) entry->size) != entry->crc) {
+        g_free (content);
+        goto read_entry_corrupted;
+    }
+
+    return g_bytes_new_take (content, entry->size);
+
+read_entry_corrupted:
+    g_set_error (error, BOOKS_ARCHIVE_ERROR, BOOKS_ARCHIVE_ERROR_CORRUPTED,
+                 "`%s' in `%s' is corrupted", name, priv->filename);
+    return NULL;
+}
+
+/* @tail holds the last @tail_size bytes of the archive */
+static const guint8 *
+find_end_of_central_directory (const guint8 *tail,
+                               guint64 tail_size)
+{
+    const guint8 *p;
+    const guint8 *stop;
+
+    if (tail_size < EOCD_SIZE)
+        return NULL;
+
+    /* The record is at the very end unless the archive carries a comment */
+    p = tail + tail_size - EOCD_SIZE;
+    stop = tail_size > EOCD_SIZE + EOCD_MAX_COMMENT_SIZE ? p - EOCD_MAX_COMMENT_SIZE : tail;
+
+    for (; p >= stop; p--) {
+        if (read_le32 (p) == EOCD_SIGNATURE)
+            return p;
+    }
+
+    return NULL;
+}
+
+static void
+read_zip64_extra_field (Entry *entry,
+                        const guint8 *extra,
+                        guint16 extra_length,
+                        gboolean need_size,
+                        gboolean need_compressed_size,
+                        gboolean need_offset)
+{
+    const guint8 *end;
+
+    end = extra + extra_length;
+
+    while (extra + 4 <= end) {
+        guint16 id;
+        guint16 length;
+        const guint8 *field;
+
+        id = read_le16 (extra);
+        length = read_le16 (extra + 2);
+        field = extra + 4;
+
+        if (field + length > end)
+            return;
+
+        if (id == ZIP64_EXTRA_FIELD_ID) {
+            const guint8 *field_end = field + length;
+
+            /* Only the values that overflowed are present, in this order */
+            if (need_size && field + 8 <= field_end) {
+                entry->size = read_le64 (field);
+                field += 8;
+            }
+
+            if (need_compressed_size && field + 8 <= field_end) {
+                entry->compressed_size = read_le64 (field);
+                field += 8;
+            }
+
+            if (need_offset && field + 8 <= field_end)
+                entry->offset = read_le64 (field);
+
+            return;
+        }
+
+        extra = field + length;
+    }
+}
+
+static gboolean
+read_central_directory (BooksArchivePrivate *priv,
+                        GError **error)
+{
+    guint8 zip64_eocd[ZIP64_EOCD_SIZE];
+    guint8 *tail;
+    guint8 *directory = NULL;
+    const guint8 *eocd;
+    const guint8 *p;
+    const guint8 *end;
+    guint64 tail_size;
+    guint64 n_entries;
+    guint64 directory_size;
+    guint64 directory_offset;
+    guint64 i;
+
+    /* Room for the longest comment and a zip64 locator in front of the record */
+    tail_size = MIN (priv->size, EOCD_SIZE + EOCD_MAX_COMMENT_SIZE + ZIP64_LOCATOR_SIZE);
+    tail = g_malloc (tail_size);
+
+    if (!read_at (priv, priv->size - tail_size, tail, tail_size))
+        goto read_central_directory_invalid;
+
+    eocd = find_end_of_central_directory (tail, tail_size);
+
+    if (eocd == NULL)
+        goto read_central_directory_invalid;
+
+    n_entries = read_le16 (eocd + 10);
+    directory_size = read_le32 (eocd + 12);
+    directory_offset = read_le32 (eocd + 16);
+
+    if (n_entries == 0xffff || directory_size == 0xffffffff || directory_offset == 0xffffffff) {
+        const guint8 *locator;
+        guint64 zip64_offset;
+
+        locator = eocd - ZIP64_LOCATOR_SIZE;
+
+        if (locator < tail || read_le32 (locator) != ZIP64_LOCATOR_SIGNATURE)
+            goto read_central_directory_invalid;
+
+        zip64_offset = read_le64 (locator + 8);
+
+        if (!read_at (priv, zip64_offset, zip64_eocd, ZIP64_EOCD_SIZE) ||
+            read_le32 (zip64_eocd) != ZIP64_EOCD_SIGNATURE)
+            goto read_central_directory_invalid;
+
+        n_entries = read_le64 (zip64_eocd + 32);
+        directory_size = read_le64 (zip64_eocd + 40);
+        directory_offset = read_le64 (zip64_eocd + 48);
+    }
+
+    if (directory_offset + directory_size > priv->size)
+        goto read_central_directory_invalid;
+
+    directory = g_malloc (directory_size);
+
+    if (!read_at (priv, directory_offset, directory, directory_size))
+        goto read_central_directory_invalid;
+
+    p = directory;
+    end = p + directory_size;
+
+    for (i = 0; i < n_entries; i++) {
+        Entry *entry;
+        guint16 name_length;
+        guint16 extra_length;
+        guint16 comment_length;
+        gchar *name;
+
+        if (p + CENTRAL_HEADER_SIZE > end || read_le32 (p) != CENTRAL_HEADER_SIGNATURE)
+            goto read_central_directory_invalid;
+
+        name_length = read_le16 (p + 28);
+        extra_length = read_le16 (p + 30);
+        comment_length = read_le16 (p + 32);
+
+        if (p + CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length > end)
+            goto read_central_directory_invalid;
+
+        name = g_strndup ((const gchar *) p + CENTRAL_HEADER_SIZE, name_length);
+
+        /* Directories carry no data and are never requested */
+        if (name_length == 0 || name[name_length - 1] == '/') {
+            g_free (name);
+            p += CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+            continue;
+        }
+
+        entry = g_new0 (Entry, 1);
+        entry->flags = read_le16 (p + 8);
+        entry->method = read_le16 (p + 10);
+        entry->crc = read_le32 (p + 16);
+        entry->compressed_size = read_le32 (p + 20);
+        entry->size = read_le32 (p + 24);
+        entry->offset = read_le32 (p + 42);
+
+        if (entry->size == 0xffffffff || entry->compressed_size == 0xffffffff || entry->offset == 0xffffffff)
+            read_zip64_extra_field (entry, p + CENTRAL_HEADER_SIZE + name_length, extra_length,
+                                    entry->size == 0xffffffff,
+                                    entry->compressed_size == 0xffffffff,
+                                    entry->offset == 0xffffffff);
+
+        g_hash_table_insert (priv->entries, name, entry);
+        p += CENTRAL_HEADER_SIZE + name_length + extra_length + comment_length;
+    }
+
+    compute_fingerprint (priv, directory, directory_size);
+    g_free (directory);
+    g_free (tail);
+    return TRUE;
+
+read_central_directory_invalid:
+    g_free (directory);
+    g_free (tail);
+    g_set_error (error, BOOKS_ARCHIVE_ERROR, BOOKS_ARCHIVE_ERROR_INVALID_FORMAT,
+                 "`%s' is not a valid EPUB archive", priv->filename);
+    return FALSE;
+}
+
+static void
+compute_fingerprint (BooksArchivePrivate *priv,
+                     const guint8 *directory,
+                     guint64 directory_size)
+{
+    GChecksum *checksum;
+    GStatBuf buf;
+    gint64 mtime = 0;
+
+    if (g_stat (priv->filename, &buf) == 0)
+        mtime = (gint64) buf.st_mtime;
+
+    checksum = g_checksum_new (G_CHECKSUM_SHA1);
+    g_checksum_update (checksum, directory, (gssize) directory_size);
+
+    priv->fingerprint = g_strdup_printf ("%" G_GINT64_MODIFIER "x-%" G_GINT64_MODIFIER "x-%s",
+                                         (gint64) priv->size, mtime,
+                                         g_checksum_get_string (checksum));
+    g_checksum_free (checksum);
+}
+
+static void
+books_archive_finalize (GObject *object)
+{
+    BooksArchivePrivate *priv;
+
+    priv = BOOKS_ARCHIVE_GET_PRIVATE (object);
+
+    g_hash_table_destroy (priv->entries);
+    g_free (priv->filename);
+    g_free (priv->fingerprint);
+
+    if (priv->fd >= 0)
+        close (priv->fd);
+
+    G_OBJECT_CLASS (books_archive_parent_class)->finalize (object);
+}
+
+static void
+books_archive_class_init (BooksArchiveClass *klass)
+{
+    GObjectClass *gobject_class = G_OBJECT_CLASS (klass);
+    gobject_class->finalize = books_archive_finalize;
+
+    g_type_class_add_private (klass, sizeof(BooksArchivePrivate));
+}
+
+static void
+books_archive_init (BooksArchive *self)
+{
+    BooksArchivePrivate *priv;
+
+    self->priv = priv = BOOKS_ARCHIVE_GET_PRIVATE (self);
+    priv->fd = -1;
+    priv->size = 0;
+    priv->filename = NULL;
+    priv->fingerprint = NULL;
+    priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+}
@@ -0,0 +1,53 @@
+#ifndef BOOKS_ARCHIVE_H
+#define BOOKS_ARCHIVE_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_ARCHIVE             (books_archive_get_type())
+#define BOOKS_ARCHIVE(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_ARCHIVE, BooksArchive))
+#define BOOKS_IS_ARCHIVE(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_ARCHIVE))
+#define BOOKS_ARCHIVE_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_ARCHIVE, BooksArchiveClass))
+#define BOOKS_IS_ARCHIVE_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_ARCHIVE))
+#define BOOKS_ARCHIVE_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_ARCHIVE, BooksArchiveClass))
+
+#define BOOKS_ARCHIVE_ERROR books_archive_error_quark()
+
+typedef enum {
+    BOOKS_ARCHIVE_ERROR_INVALID_FORMAT,
+    BOOKS_ARCHIVE_ERROR_UNSUPPORTED,
+    BOOKS_ARCHIVE_ERROR_ENTRY_NOT_FOUND,
+    BOOKS_ARCHIVE_ERROR_CORRUPTED
+} BooksArchiveError;
+
+typedef struct _BooksArchive           BooksArchive;
+typedef struct _BooksArchiveClass      BooksArchiveClass;
+typedef struct _BooksArchivePrivate    BooksArchivePrivate;
+
+struct _BooksArchive {
+    GObject parent_instance;
+
+    BooksArchivePrivate *priv;
+};
+
+struct _BooksArchiveClass {
+    GObjectClass parent_class;
+};
+
+BooksArchive  * books_archive_new             (void);
+gboolean        books_archive_open            (BooksArchive  *archive,
+                                               const gchar   *filename,
+                                               GError       **error);
+const gchar   * books_archive_get_fingerprint (BooksArchive  *archive);
+gboolean        books_archive_has_entry       (BooksArchive  *archive,
+                                               const gchar   *name);
+GBytes        * books_archive_read_entry      (BooksArchive  *archive,
+                                               const gchar   *name,
+                                               GError       **error);
+GType           books_archive_get_type        (void);
+GQuark          books_archive_error_quark     (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,290 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "books-cache.h"
+
+
+G_DEFINE_TYPE(BooksCache, books_cache, G_TYPE_OBJECT)
+
+#define BOOKS_CACHE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_CACHE, BooksCachePrivate))
+
+#define DEFAULT_BUDGET  (64 * 1024 * 1024)
+
+enum {
+    PROP_0,
+    PROP_BUDGET
+};
+
+typedef struct {
+    gchar  *key;
+    GBytes *data;
+    GList   link;
+} CacheEntry;
+
+/*
+ * Inflated archive entries, keyed by book fingerprint and entry name. The
+ * URI handler looks entries up from worker threads, hence the lock.
+ */
+struct _BooksCachePrivate {
+    GMutex      lock;
+    GHashTable *entries;
+    GQueue      lru;
+    guint64     size;
+    guint64     budget;
+};
+
+static void evict (BooksCachePrivate *priv);
+
+
+BooksCache *
+books_cache_get_default (void)
+{
+    static gsize cache = 0;
+
+    if (g_once_init_enter (&cache))
+        g_once_init_leave (&cache, (gsize) g_object_new (BOOKS_TYPE_CACHE, NULL));
+
+    return BOOKS_CACHE (cache);
+}
+
+GBytes *
+books_cache_lookup (BooksCache *cache,
+                    const gchar *key)
+{
+    BooksCachePrivate *priv;
+    CacheEntry *entry;
+    GBytes *data = NULL;
+
+    g_return_val_if_fail (BOOKS_IS_CACHE (cache), NULL);
+
+    priv = cache->priv;
+    g_mutex_lock (&priv->lock);
+    entry = g_hash_table_lookup (priv->entries, key);
+
+    if (entry != NULL) {
+        g_queue_unlink (&priv->lru, &entry->link);
+        g_queue_push_head_link (&priv->lru, &entry->link);
+        data = g_bytes_ref (entry->data);
+    }
+
+    g_mutex_unlock (&priv->lock);
+    return data;
+}
+
+void
+books_cache_insert (BooksCache *cache,
+                    const gchar *key,
+                    GBytes *data)
+{
+    BooksCachePrivate *priv;
+    CacheEntry *entry;
+    gsize size;
+
+    g_return_if_fail (BOOKS_IS_CACHE (cache));
+
+    priv = cache->priv;
+    size = g_bytes_get_size (data);
+    g_mutex_lock (&priv->lock);
+
+    /* A single huge image must not flush everything else */
+    if (size > priv->budget / 4 || g_hash_table_contains (priv->entries, key)) {
+        g_mutex_unlock (&priv->lock);
+        return;
+    }
+
+    entry = g_new0 (CacheEntry, 1);
+    entry->key = g_strdup (key);
+    entry->data = g_bytes_ref (data);
+    entry->link.data = entry;
+
+    g_hash_table_insert (priv->entries, entry->key, entry);
+    g_queue_push_head_link (&priv->lru, &entry->link);
+    priv->size += size;
+
+    evict (priv);
+    g_mutex_unlock (&priv->lock);
+}
+
+static void
+remove_directory (GFile *directory,
+                  GCancellable *cancellable)
+{
+    GFileEnumerator *enumerator;
+    GFileInfo *info;
+
+    enumerator = g_file_enumerate_children (directory,
+                                            G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                            G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                            G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                            cancellable, NULL);
+
+    if (enumerator == NULL)
+        return;
+
+    while ((info = g_file_enumerator_next_file (enumerator, cancellable, NULL)) != NULL) {
+        GFile *child;
+
+        child = g_file_get_child (directory, g_file_info_get_name (info));
+
+        if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY)
+            remove_directory (child, cancellable);
+        else
+            g_file_delete (child, cancellable, NULL);
+
+        g_object_unref (child);
+        g_object_unref (info);
+    }
+
+    g_object_unref (enumerator);
+    g_file_delete (directory, cancellable, NULL);
+}
+
+static void
+remove_legacy_files_in_thread (GTask *task,
+                               gpointer source_object,
+                               gpointer task_data,
+                               GCancellable *cancellable)
+{
+    gchar *path;
+    GFile *directory;
+
+    path = g_build_filename (g_get_user_cache_dir (), "books", NULL);
+    directory = g_file_new_for_path (path);
+
+    if (g_file_query_exists (directory, cancellable))
+        remove_directory (directory, cancellable);
+
+    g_object_unref (directory);
+    g_free (path);
+    g_task_return_boolean (task, TRUE);
+}
+
+/*
+ * Books used to be extracted to ~/.cache/books and were never cleaned up.
+ * Nothing reads these files anymore, so remove them in the background.
+ */
+void
+books_cache_remove_legacy_files (BooksCache *cache)
+{
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_CACHE (cache));
+
+    task = g_task_new (cache, NULL, NULL, NULL);
+    g_task_set_priority (task, G_PRIORITY_LOW);
+    g_task_run_in_thread (task, remove_legacy_files_in_thread);
+    g_object_unref (task);
+}
+
+static void
+evict (BooksCachePrivate *priv)
+{
+    while (priv->size > priv->budget && priv->lru.tail != NULL) {
+        CacheEntry *entry;
+
+        entry = priv->lru.tail->data;
+        g_queue_unlink (&priv->lru, &entry->link);
+        priv->size -= g_bytes_get_size (entry->data);
+        g_hash_table_remove (priv->entries, entry->key);
+    }
+}
+
+static void
+free_entry (CacheEntry *entry)
+{
+    g_bytes_unref (entry->data);
+    g_free (entry->key);
+    g_free (entry);
+}
+
+static void
+books_cache_finalize (GObject *object)
+{
+    BooksCachePrivate *priv;
+
+    priv = BOOKS_CACHE_GET_PRIVATE (object);
+    g_hash_table_destroy (priv->entries);
+    g_mutex_clear (&priv->lock);
+
+    G_OBJECT_CLASS (books_cache_parent_class)->finalize (object);
+}
+
+static void
+books_cache_set_property (GObject *object,
+                          guint property_id,
+                          const GValue *value,
+                          GParamSpec *pspec)
+{
+    BooksCachePrivate *priv;
+
+    priv = BOOKS_CACHE_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BUDGET:
+            g_mutex_lock (&priv->lock);
+            priv->budget = g_value_get_uint64 (value);
+            evict (priv);
+            g_mutex_unlock (&priv->lock);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+books_cache_get_property (GObject *object,
+                          guint property_id,
+                          GValue *value,
+                          GParamSpec *pspec)
+{
+    BooksCachePrivate *priv;
+
+    priv = BOOKS_CACHE_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BUDGET:
+            g_value_set_uint64 (value, priv->budget);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+books_cache_class_init (BooksCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->set_property = books_cache_set_property;
+    object_class->get_property = books_cache_get_property;
+    object_class->finalize = books_cache_finalize;
+
+    g_object_class_install_property (object_class,
+                                     PROP_BUDGET,
+                                     g_param_spec_uint64 ("budget",
+                                                          "Cache budget in bytes",
+                                                          "Cache budget in bytes",
+                                                          0, G_MAXUINT64, DEFAULT_BUDGET,
+                                                          G_PARAM_READWRITE));
+
+    g_type_class_add_private (klass, sizeof(BooksCachePrivate));
+}
+
+static void
+books_cache_init (BooksCache *cache)
+{
+    BooksCachePrivate *priv;
+
+    cache->priv = priv = BOOKS_CACHE_GET_PRIVATE (cache);
+
+    g_mutex_init (&priv->lock);
+    g_queue_init (&priv->lru);
+    priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+    priv->size = 0;
+    priv->budget = DEFAULT_BUDGET;
+}
@@ -0,0 +1,41 @@
+#ifndef BOOKS_CACHE_H
+#define BOOKS_CACHE_H
+
+#include <gio/gio.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_CACHE             (books_cache_get_type())
+#define BOOKS_CACHE(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_CACHE, BooksCache))
+#define BOOKS_IS_CACHE(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_CACHE))
+#define BOOKS_CACHE_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_CACHE, BooksCacheClass))
+#define BOOKS_IS_CACHE_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_CACHE))
+#define BOOKS_CACHE_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_CACHE, BooksCacheClass))
+
+
+typedef struct _BooksCache           BooksCache;
+typedef struct _BooksCacheClass      BooksCacheClass;
+typedef struct _BooksCachePrivate    BooksCachePrivate;
+
+struct _BooksCache {
+    GObject parent;
+
+    BooksCachePrivate *priv;
+};
+
+struct _BooksCacheClass {
+    GObjectClass parent_class;
+};
+
+BooksCache    * books_cache_get_default         (void);
+GBytes        * books_cache_lookup              (BooksCache    *cache,
+                                                 const gchar   *key);
+void            books_cache_insert              (BooksCache    *cache,
+                                                 const gchar   *key,
+                                                 GBytes        *data);
+void            books_cache_remove_legacy_files (BooksCache    *cache);
+GType           books_cache_get_type            (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,1349 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sqlite3.h>
+#include <glib/gi18n.h>
+
+#include "books-collection-model.h"
+#include "books-collection.h"
+
+
+static void books_collection_model_tree_model_init (GtkTreeModelIface *iface);
+static void books_collection_model_tree_sortable_init (GtkTreeSortableIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (BooksCollectionModel, books_collection_model, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_MODEL, books_collection_model_tree_model_init)
+                         G_IMPLEMENT_INTERFACE (GTK_TYPE_TREE_SORTABLE, books_collection_model_tree_sortable_init))
+
+#define BOOKS_COLLECTION_MODEL_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_COLLECTION_MODEL, BooksCollectionModelPrivate))
+
+/* Rows kept in memory and rows read from meta.db at once */
+#define CACHE_SIZE      2048
+#define PAGE_SIZE       64
+
+/* Rows shown or hidden by a filter change above which views are reset */
+#define RESET_THRESHOLD 256
+
+enum {
+    BEGIN_RESET,
+    END_RESET,
+    LAST_SIGNAL
+};
+
+static guint signals[LAST_SIGNAL] = { 0 };
+
+typedef struct {
+    gint64   id;
+    gchar   *author;
+    gchar   *title;
+    gchar   *markup;
+    gchar   *path;
+    GList    link;
+} Row;
+
+/* What is kept of every book, shown or not */
+typedef struct {
+    gint64           id;
+    gchar           *key;
+    GdkPixbuf       *cover;
+    GSequenceIter   *order_iter;
+    GSequenceIter   *view_iter;
+    gint             position;
+    gboolean         match;
+} Node;
+
+/*
+ * A list of all books that only holds their row ids and search keys.
+ * Everything else is read page by page from meta.db through a read-only
+ * connection of its own when a view asks for it, and the most recently used
+ * rows are cached.
+ *
+ * All books are kept in sort order, and those that match the filter are
+ * kept in the same order a second time; these are the rows the model shows.
+ * Changing the filter only adds and removes rows of the second list, so
+ * nothing has to be sorted again.
+ */
+struct _BooksCollectionModelPrivate {
+    sqlite3         *db;
+    sqlite3_stmt    *page_stmt;
+    GdkPixbuf       *placeholder;
+    gint             stamp;
+
+    /* Ids in ascending order, which is the order books have been added in */
+    GArray          *ids;
+    GHashTable      *nodes;
+    GSequence       *order;
+    GSequence       *view;
+    gint             sort_column;
+    GtkSortType      sort_order;
+
+    GHashTable      *rows;
+    GQueue           lru;
+
+    gchar           *filter_key;
+    GCancellable    *filter_cancellable;
+
+    /* Search keys copied for the filter thread */
+    GBytes          *packed_keys;
+    GArray          *packed_offsets;
+    GArray          *packed_ids;
+};
+
+
+BooksCollectionModel *
+books_collection_model_new (const gchar *filename,
+                            GdkPixbuf *placeholder)
+{
+    BooksCollectionModel *model;
+    BooksCollectionModelPrivate *priv;
+    const gchar *sql = "SELECT id, author, title, path FROM books WHERE id BETWEEN ? AND ?";
+
+    g_return_val_if_fail (filename != NULL, NULL);
+
+    model = BOOKS_COLLECTION_MODEL (g_object_new (BOOKS_TYPE_COLLECTION_MODEL, NULL));
+    priv = model->priv;
+    priv->placeholder = g_object_ref (placeholder);
+
+    if (sqlite3_open_v2 (filename, &priv->db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK ||
+        sqlite3_prepare_v2 (priv->db, sql, -1, &priv->page_stmt, NULL) != SQLITE_OK)
+        g_warning (_("Could not open database: %s\n"), sqlite3_errmsg (priv->db));
+
+    sqlite3_busy_timeout (priv->db, 100);
+    return model;
+}
+
+/*
+ * Decomposes @text so that accents become marks of their own, drops those
+ * and folds the case of the rest.
+ */
+static gchar *
+normalize (const gchar *text)
+{
+    GString *stripped;
+    gchar *decomposed;
+    gchar *folded;
+    const gchar *p;
+
+    decomposed = g_utf8_normalize (text, -1, G_NORMALIZE_NFKD);
+
+    if (decomposed == NULL)
+        return g_strdup ("");
+
+    stripped = g_string_sized_new (strlen (decomposed));
+
+    for (p = decomposed; *p != '\0'; p = g_utf8_next_char (p)) {
+        gunichar c;
+
+        c = g_utf8_get_char (p);
+
+        if (g_unichar_type (c) != G_UNICODE_NON_SPACING_MARK)
+            g_string_append_unichar (stripped, c);
+    }
+
+    folded = g_utf8_casefold (stripped->str, stripped->len);
+    g_string_free (stripped, TRUE);
+    g_free (decomposed);
+    return folded;
+}
+
+/*
+ * Returns the key a book is found and sorted by. This is safe to call from
+ * any thread, so that keys can be computed where the rows are read.
+ */
+gchar *
+books_collection_model_get_search_key (const gchar *author,
+                                       const gchar *title)
+{
+    gchar *text;
+    gchar *key;
+    gsize length;
+
+    /* The term cannot span author and title, the filter entry has one line only */
+    text = g_strconcat (author != NULL ? author : "", "\n", title != NULL ? title : "", NULL);
+    length = author != NULL ? strlen (author) : 0;
+
+    /* The newline after the author must be the only one, or sorting by title breaks */
+    g_strdelimit (text, "\n", ' ');
+    text[length] = '\n';
+
+    key = normalize (text);
+    g_free (text);
+    return key;
+}
+
+static void
+clear_entry (BooksCollectionModelEntry *entry)
+{
+    g_free (entry->key);
+}
+
+/* Returns an array for books_collection_model_add that frees its keys */
+GArray *
+books_collection_model_entries_new (void)
+{
+    GArray *entries;
+
+    entries = g_array_new (FALSE, FALSE, sizeof (BooksCollectionModelEntry));
+    g_array_set_clear_func (entries, (GDestroyNotify) clear_entry);
+    return entries;
+}
+
+static gboolean
+matches_filter (BooksCollectionModelPrivate *priv,
+                const gchar *key)
+{
+    return priv->filter_key == NULL || strstr (key, priv->filter_key) != NULL;
+}
+
+/* If @id is not in @ids, @index is set to the position it belongs at */
+static gboolean
+find_id (GArray *ids,
+         gint64 id,
+         guint *index)
+{
+    guint low = 0;
+    guint high = ids->len;
+
+    while (low < high) {
+        guint middle;
+        gint64 middle_id;
+
+        middle = low + (high - low) / 2;
+        middle_id = g_array_index (ids, gint64, middle);
+
+        if (middle_id == id) {
+            *index = middle;
+            return TRUE;
+        }
+
+        if (middle_id < id)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+
+    *index = low;
+    return FALSE;
+}
+
+/* Keys of invalid text are empty and have no title part */
+static const gchar *
+get_title_key (const gchar *key)
+{
+    const gchar *title;
+
+    title = strchr (key, '\n');
+    return title != NULL ? title + 1 : key;
+}
+
+/*
+ * Keys start with the author followed by a newline, which sorts before any
+ * printable character, so comparing whole keys sorts by author and then by
+ * title. Ties are broken by id, which is also the default order.
+ */
+static gint
+compare_nodes (Node *a,
+               Node *b,
+               BooksCollectionModelPrivate *priv)
+{
+    gint result = 0;
+
+    if (priv->sort_column == BOOKS_COLLECTION_AUTHOR_COLUMN)
+        result = strcmp (a->key, b->key);
+    else if (priv->sort_column == BOOKS_COLLECTION_TITLE_COLUMN)
+        result = strcmp (get_title_key (a->key), get_title_key (b->key));
+
+    if (result == 0)
+        result = a->id < b->id ? -1 : (a->id > b->id ? 1 : 0);
+
+    return priv->sort_order == GTK_SORT_DESCENDING ? -result : result;
+}
+
+static void
+set_iter (BooksCollectionModelPrivate *priv,
+          GtkTreeIter *iter,
+          Node *node)
+{
+    iter->stamp = priv->stamp;
+    iter->user_data = node->view_iter;
+}
+
+static Node *
+get_node (GtkTreeIter *iter)
+{
+    return g_sequence_get (iter->user_data);
+}
+
+static GtkTreePath *
+get_node_path (Node *node)
+{
+    return gtk_tree_path_new_from_indices (g_sequence_iter_get_position (node->view_iter), -1);
+}
+
+static void
+free_node (Node *node)
+{
+    g_free (node->key);
+
+    if (node->cover != NULL)
+        g_object_unref (node->cover);
+
+    g_free (node);
+}
+
+static void
+free_row (Row *row)
+{
+    g_free (row->author);
+    g_free (row->title);
+    g_free (row->markup);
+    g_free (row->path);
+    g_free (row);
+}
+
+static void
+forget_row (BooksCollectionModelPrivate *priv,
+            gint64 id)
+{
+    Row *row;
+
+    row = g_hash_table_lookup (priv->rows, &id);
+
+    if (row != NULL) {
+        g_queue_unlink (&priv->lru, &row->link);
+        g_hash_table_remove (priv->rows, &id);
+    }
+}
+
+static gchar *
+dup_column (sqlite3_stmt *stmt,
+            gint column)
+{
+    const gchar *text;
+
+    text = (const gchar *) sqlite3_column_text (stmt, column);
+    return g_strdup (text != NULL ? text : "");
+}
+
+/*
+ * Reads the page of rows around @index of the ids and drops the least
+ * recently used. Pages follow the ids rather than the sort order, so a
+ * sorted view may read more pages while scrolling.
+ */
+static void
+read_page (BooksCollectionModelPrivate *priv,
+           guint index)
+{
+    guint first;
+    guint last;
+
+    if (priv->page_stmt == NULL)
+        return;
+
+    first = index - index % PAGE_SIZE;
+    last = MIN (first + PAGE_SIZE, priv->ids->len) - 1;
+
+    sqlite3_bind_int64 (priv->page_stmt, 1, g_array_index (priv->ids, gint64, first));
+    sqlite3_bind_int64 (priv->page_stmt, 2, g_array_index (priv->ids, gint64, last));
+
+    while (sqlite3_step (priv->page_stmt) == SQLITE_ROW) {
+        Row *row;
+        gint64 id;
+
+        id = sqlite3_column_int64 (priv->page_stmt, 0);
+
+        if (g_hash_table_contains (priv->rows, &id))
+            continue;
+
+        row = g_new0 (Row, 1);
+        row->id = id;
+        row->author = dup_column (priv->page_stmt, 1);
+        row->title = dup_column (priv->page_stmt, 2);
+        row->path = dup_column (priv->page_stmt, 3);
+        row->markup = g_markup_printf_escaped ("%s &#8212; <i>%s</i>", row->author, row->title);
+        row->link.data = row;
+
+        g_hash_table_insert (priv->rows, &row->id, row);
+        g_queue_push_head_link (&priv->lru, &row->link);
+    }
+
+    sqlite3_reset (priv->page_stmt);
+
+    while (g_hash_table_size (priv->rows) > CACHE_SIZE) {
+        Row *row;
+
+        row = priv->lru.tail->data;
+        g_queue_unlink (&priv->lru, &row->link);
+        g_hash_table_remove (priv->rows, &row->id);
+    }
+}
+
+static Row *
+get_row (BooksCollectionModelPrivate *priv,
+         gint64 id)
+{
+    Row *row;
+    guint index;
+
+    row = g_hash_table_lookup (priv->rows, &id);
+
+    if (row == NULL) {
+        if (find_id (priv->ids, id, &index))
+            read_page (priv, index);
+
+        row = g_hash_table_lookup (priv->rows, &id);
+    }
+    else {
+        g_queue_unlink (&priv->lru, &row->link);
+        g_queue_push_head_link (&priv->lru, &row->link);
+    }
+
+    return row;
+}
+
+static void
+drop_packed_keys (BooksCollectionModelPrivate *priv)
+{
+    if (priv->packed_keys == NULL)
+        return;
+
+    g_bytes_unref (priv->packed_keys);
+    g_array_unref (priv->packed_offsets);
+    g_array_unref (priv->packed_ids);
+    priv->packed_keys = NULL;
+    priv->packed_offsets = NULL;
+    priv->packed_ids = NULL;
+}
+
+static void
+show_node (BooksCollectionModel *model,
+           Node *node)
+{
+    BooksCollectionModelPrivate *priv;
+    GtkTreePath *path;
+    GtkTreeIter iter;
+
+    priv = model->priv;
+    node->view_iter = g_sequence_insert_sorted (priv->view, node, (GCompareDataFunc) compare_nodes, priv);
+    priv->stamp++;
+
+    set_iter (priv, &iter, node);
+    path = get_node_path (node);
+    gtk_tree_model_row_inserted (GTK_TREE_MODEL (model), path, &iter);
+    gtk_tree_path_free (path);
+}
+
+static void
+hide_node (BooksCollectionModel *model,
+           Node *node)
+{
+    GtkTreePath *path;
+
+    path = get_node_path (node);
+    g_sequence_remove (node->view_iter);
+    node->view_iter = NULL;
+    model->priv->stamp++;
+
+    gtk_tree_model_row_deleted (GTK_TREE_MODEL (model), path);
+    gtk_tree_path_free (path);
+}
+
+/*
+ * Shows the rows whose match is set and hides the others. Views handle
+ * each inserted or deleted row in linear time, so for many changes the
+ * shown rows are rebuilt in one pass between begin-reset and end-reset,
+ * during which views must be detached from the model.
+ */
+static void
+update_view (BooksCollectionModel *model)
+{
+    BooksCollectionModelPrivate *priv;
+    GSequenceIter *iter;
+    guint n_changes = 0;
+
+    priv = model->priv;
+
+    for (iter = g_sequence_get_begin_iter (priv->order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter)) {
+        Node *node;
+
+        node = g_sequence_get (iter);
+
+        if (node->match != (node->view_iter != NULL))
+            n_changes++;
+    }
+
+    if (n_changes <= RESET_THRESHOLD) {
+        for (iter = g_sequence_get_begin_iter (priv->order);
+             !g_sequence_iter_is_end (iter);
+             iter = g_sequence_iter_next (iter)) {
+            Node *node;
+
+            node = g_sequence_get (iter);
+
+            if (node->match && node->view_iter == NULL)
+                show_node (model, node);
+            else if (!node->match && node->view_iter != NULL)
+                hide_node (model, node);
+        }
+
+        return;
+    }
+
+    g_signal_emit (model, signals[BEGIN_RESET], 0);
+
+    g_sequence_remove_range (g_sequence_get_begin_iter (priv->view),
+                             g_sequence_get_end_iter (priv->view));
+
+    /* All books are in sort order already */
+    for (iter = g_sequence_get_begin_iter (priv->order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter)) {
+        Node *node;
+
+        node = g_sequence_get (iter);
+        node->view_iter = node->match ? g_sequence_append (priv->view, node) : NULL;
+    }
+
+    priv->stamp++;
+    g_signal_emit (model, signals[END_RESET], 0);
+}
+
+/*
+ * Adds those books of @entries that are not shown yet. Their rows must
+ * already be committed to meta.db. Large chunks, like those read on
+ * startup, are shown through a reset instead of a signal per row.
+ */
+void
+books_collection_model_add (BooksCollectionModel *model,
+                            GArray *entries)
+{
+    BooksCollectionModelPrivate *priv;
+    guint i;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model) && entries != NULL);
+
+    priv = model->priv;
+
+    for (i = 0; i < entries->len; i++) {
+        BooksCollectionModelEntry *entry;
+        Node *node;
+        guint index;
+
+        entry = &g_array_index (entries, BooksCollectionModelEntry, i);
+        index = priv->ids->len;
+
+        /* Ids usually grow, so they are appended */
+        if (index > 0 && entry->id <= g_array_index (priv->ids, gint64, index - 1)) {
+            if (find_id (priv->ids, entry->id, &index))
+                continue;
+        }
+
+        /* Ids of removed books may be reused and still be cached */
+        forget_row (priv, entry->id);
+        drop_packed_keys (priv);
+        g_array_insert_val (priv->ids, index, entry->id);
+
+        node = g_new0 (Node, 1);
+        node->id = entry->id;
+        node->key = g_strdup (entry->key);
+        node->order_iter = g_sequence_insert_sorted (priv->order, node, (GCompareDataFunc) compare_nodes, priv);
+        node->match = matches_filter (priv, node->key);
+        g_hash_table_insert (priv->nodes, &node->id, node);
+    }
+
+    update_view (model);
+}
+
+static void
+remove_node (BooksCollectionModel *model,
+             Node *node)
+{
+    BooksCollectionModelPrivate *priv;
+    guint index;
+
+    priv = model->priv;
+
+    if (node->view_iter != NULL)
+        hide_node (model, node);
+
+    if (find_id (priv->ids, node->id, &index))
+        g_array_remove_index (priv->ids, index);
+
+    forget_row (priv, node->id);
+    drop_packed_keys (priv);
+    g_sequence_remove (node->order_iter);
+    g_hash_table_remove (priv->nodes, &node->id);
+}
+
+void
+books_collection_model_remove (BooksCollectionModel *model,
+                               GtkTreeIter *iter)
+{
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model) && iter->stamp == model->priv->stamp);
+    remove_node (model, get_node (iter));
+}
+
+/* Rows that have already been removed are skipped */
+void
+books_collection_model_remove_ids (BooksCollectionModel *model,
+                                   GArray *ids)
+{
+    guint i;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model) && ids != NULL);
+
+    for (i = 0; i < ids->len; i++) {
+        Node *node;
+
+        node = g_hash_table_lookup (model->priv->nodes, &g_array_index (ids, gint64, i));
+
+        if (node != NULL)
+            remove_node (model, node);
+    }
+}
+
+/*
+ * Call this once changes of the books with @ids have been committed. Search
+ * keys are not updated, renaming a file leaves author and title alone.
+ */
+void
+books_collection_model_reload_ids (BooksCollectionModel *model,
+                                   GArray *ids)
+{
+    BooksCollectionModelPrivate *priv;
+    guint i;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model) && ids != NULL);
+
+    priv = model->priv;
+
+    for (i = 0; i < ids->len; i++) {
+        GtkTreePath *path;
+        GtkTreeIter iter;
+        Node *node;
+
+        node = g_hash_table_lookup (priv->nodes, &g_array_index (ids, gint64, i));
+
+        if (node == NULL)
+            continue;
+
+        forget_row (priv, node->id);
+
+        if (node->view_iter == NULL)
+            continue;
+
+        set_iter (priv, &iter, node);
+        path = get_node_path (node);
+        gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, &iter);
+        gtk_tree_path_free (path);
+    }
+}
+
+/* Shows @pixbuf for the row at @iter, or the placeholder if it is NULL */
+void
+books_collection_model_set_cover (BooksCollectionModel *model,
+                                  GtkTreeIter *iter,
+                                  GdkPixbuf *pixbuf)
+{
+    GtkTreePath *path;
+    Node *node;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model) && iter->stamp == model->priv->stamp);
+
+    node = get_node (iter);
+
+    if (node->cover == NULL && pixbuf == NULL)
+        return;
+
+    if (node->cover != NULL)
+        g_object_unref (node->cover);
+
+    node->cover = pixbuf != NULL ? g_object_ref (pixbuf) : NULL;
+
+    path = get_node_path (node);
+    gtk_tree_model_row_changed (GTK_TREE_MODEL (model), path, iter);
+    gtk_tree_path_free (path);
+}
+
+typedef struct {
+    GBytes  *keys;
+    GArray  *offsets;
+    GArray  *ids;
+    GArray  *previous;
+    gchar   *key;
+} FilterJob;
+
+static void
+filter_job_free (FilterJob *job)
+{
+    g_bytes_unref (job->keys);
+    g_array_unref (job->offsets);
+    g_array_unref (job->ids);
+
+    if (job->previous != NULL)
+        g_array_unref (job->previous);
+
+    g_free (job->key);
+    g_free (job);
+}
+
+/*
+ * Copies all search keys into one buffer, each followed by a nul byte, for
+ * the filter thread. The copy is kept until rows are added or removed.
+ */
+static void
+pack_keys (BooksCollectionModelPrivate *priv)
+{
+    GByteArray *data;
+    gsize offset;
+    guint i;
+
+    if (priv->packed_keys != NULL)
+        return;
+
+    data = g_byte_array_new ();
+    priv->packed_offsets = g_array_sized_new (FALSE, FALSE, sizeof (gsize), priv->ids->len + 1);
+    priv->packed_ids = g_array_sized_new (FALSE, FALSE, sizeof (gint64), priv->ids->len);
+    g_array_append_vals (priv->packed_ids, priv->ids->data, priv->ids->len);
+
+    for (i = 0; i < priv->ids->len; i++) {
+        Node *node;
+
+        node = g_hash_table_lookup (priv->nodes, &g_array_index (priv->ids, gint64, i));
+        offset = data->len;
+        g_array_append_val (priv->packed_offsets, offset);
+        g_byte_array_append (data, (const guint8 *) node->key, strlen (node->key) + 1);
+    }
+
+    offset = data->len;
+    g_array_append_val (priv->packed_offsets, offset);
+    priv->packed_keys = g_byte_array_free_to_bytes (data);
+}
+
+/* Returns the row whose key contains @offset */
+static guint
+find_row_at (GArray *offsets,
+             gsize offset)
+{
+    guint low = 0;
+    guint high = offsets->len - 1;
+
+    while (high - low > 1) {
+        guint middle;
+
+        middle = low + (high - low) / 2;
+
+        if (g_array_index (offsets, gsize, middle) <= offset)
+            low = middle;
+        else
+            high = middle;
+    }
+
+    return low;
+}
+
+static const gchar *
+find_key (const gchar *data,
+          gsize size,
+          const gchar *key,
+          gsize key_length)
+{
+#ifdef HAVE_MEMMEM
+    return memmem (data, size, key, key_length);
+#else
+    const gchar *end;
+
+    /* Without memmem, search each nul-terminated key on its own */
+    for (end = data + size; data < end; data += strlen (data) + 1) {
+        const gchar *match;
+
+        match = strstr (data, key);
+
+        if (match != NULL)
+            return match;
+    }
+
+    return NULL;
+#endif
+}
+
+/*
+ * Sets a bit for each row whose key contains the term. Keys are separated by
+ * nul bytes, so a match never spans two rows and the whole buffer is
+ * scanned at once, which the C library does several bytes at a time.
+ */
+static void
+match_keys_in_thread (GTask *task,
+                      gpointer source_object,
+                      FilterJob *job,
+                      GCancellable *cancellable)
+{
+    const gchar *data;
+    guint8 *bits;
+    gsize key_length;
+    gsize size;
+    guint n_rows;
+    guint i;
+
+    data = g_bytes_get_data (job->keys, &size);
+    n_rows = job->ids->len;
+    bits = g_malloc0 (n_rows / 8 + 1);
+    key_length = strlen (job->key);
+
+    if (job->previous != NULL) {
+        /* Only rows that contain the previous term can contain this one */
+        for (i = 0; i < n_rows; i++) {
+            if (i % 1024 == 0 && g_cancellable_is_cancelled (cancellable))
+                break;
+
+            if (g_array_index (job->previous, guint8, i) &&
+                strstr (data + g_array_index (job->offsets, gsize, i), job->key) != NULL)
+                bits[i / 8] |= 1 << (i % 8);
+        }
+    }
+    else {
+        gsize position = 0;
+
+        while (position < size && !g_cancellable_is_cancelled (cancellable)) {
+            const gchar *match;
+            guint row;
+
+            match = find_key (data + position, size - position, job->key, key_length);
+
+            if (match == NULL)
+                break;
+
+            row = find_row_at (job->offsets, match - data);
+            bits[row / 8] |= 1 << (row % 8);
+            position = g_array_index (job->offsets, gsize, row + 1);
+        }
+    }
+
+    if (g_task_return_error_if_cancelled (task)) {
+        g_free (bits);
+        return;
+    }
+
+    g_task_return_pointer (task, bits, g_free);
+}
+
+/*
+ * Shows and hides rows according to the matches of the job. Rows added
+ * since the job started are matched right here.
+ */
+static void
+apply_matches (BooksCollectionModel *model,
+               FilterJob *job,
+               const guint8 *bits)
+{
+    BooksCollectionModelPrivate *priv;
+    GSequenceIter *iter;
+
+    priv = model->priv;
+    g_free (priv->filter_key);
+    priv->filter_key = g_strdup (job->key);
+
+    for (iter = g_sequence_get_begin_iter (priv->order);
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter)) {
+        Node *node;
+        guint index;
+
+        node = g_sequence_get (iter);
+
+        if (find_id (job->ids, node->id, &index))
+            node->match = (bits[index / 8] >> (index % 8)) & 1;
+        else
+            node->match = matches_filter (priv, node->key);
+    }
+
+    update_view (model);
+}
+
+static void
+on_keys_matched (GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+    GTask *task;
+    guint8 *bits;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    bits = g_task_propagate_pointer (G_TASK (result), &error);
+
+    if (bits == NULL) {
+        g_task_return_error (task, error);
+    }
+    else {
+        apply_matches (BOOKS_COLLECTION_MODEL (source), g_task_get_task_data (G_TASK (result)), bits);
+        g_free (bits);
+        g_task_return_boolean (task, TRUE);
+    }
+
+    g_object_unref (task);
+}
+
+/*
+ * Matches the search keys of all rows against @term on a worker thread,
+ * @term may be NULL to match everything. A filter that is still running is
+ * cancelled. Rows are shown and hidden before the callback is invoked.
+ */
+void
+books_collection_model_set_filter_async (BooksCollectionModel *model,
+                                         const gchar *term,
+                                         GAsyncReadyCallback callback,
+                                         gpointer user_data)
+{
+    BooksCollectionModelPrivate *priv;
+    FilterJob *job;
+    GTask *task;
+    GTask *match_task;
+    gchar *key;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION_MODEL (model));
+
+    priv = model->priv;
+    task = g_task_new (model, NULL, callback, user_data);
+
+    g_cancellable_cancel (priv->filter_cancellable);
+    g_object_unref (priv->filter_cancellable);
+    priv->filter_cancellable = g_cancellable_new ();
+
+    key = term != NULL && term[0] != '\0' ? normalize (term) : NULL;
+
+    if (key == NULL) {
+        GSequenceIter *iter;
+
+        g_free (priv->filter_key);
+        priv->filter_key = NULL;
+
+        for (iter = g_sequence_get_begin_iter (priv->order);
+             !g_sequence_iter_is_end (iter);
+             iter = g_sequence_iter_next (iter))
+            ((Node *) g_sequence_get (iter))->match = TRUE;
+
+        update_view (model);
+
+        g_task_return_boolean (task, TRUE);
+        g_object_unref (task);
+        return;
+    }
+
+    pack_keys (priv);
+
+    job = g_new0 (FilterJob, 1);
+    job->keys = g_bytes_ref (priv->packed_keys);
+    job->offsets = g_array_ref (priv->packed_offsets);
+    job->ids = g_array_ref (priv->packed_ids);
+    job->key = key;
+
+    /* Only rows that match the previous term can match one that contains it */
+    if (priv->filter_key != NULL && strstr (key, priv->filter_key) != NULL) {
+        guint i;
+
+        job->previous = g_array_sized_new (FALSE, FALSE, sizeof (guint8), job->ids->len);
+
+        for (i = 0; i < job->ids->len; i++) {
+            Node *node;
+            guint8 visible;
+
+            node = g_hash_table_lookup (priv->nodes, &g_array_index (job->ids, gint64, i));
+            visible = node->view_iter != NULL;
+            g_array_append_val (job->previous, visible);
+        }
+    }
+
+    match_task = g_task_new (model, priv->filter_cancellable, on_keys_matched, task);
+    g_task_set_task_data (match_task, job, (GDestroyNotify) filter_job_free);
+    g_task_run_in_thread (match_task, (GTaskThreadFunc) match_keys_in_thread);
+    g_object_unref (match_task);
+}
+
+/* Fails with G_IO_ERROR_CANCELLED if a newer filter has been set meanwhile */
+gboolean
+books_collection_model_set_filter_finish (BooksCollectionModel *model,
+                                          GAsyncResult *result,
+                                          GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, model), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static GtkTreeModelFlags
+books_collection_model_get_flags (GtkTreeModel *tree_model)
+{
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint
+books_collection_model_get_n_columns (GtkTreeModel *tree_model)
+{
+    return BOOKS_COLLECTION_N_COLUMNS;
+}
+
+static GType
+books_collection_model_get_column_type (GtkTreeModel *tree_model,
+                                        gint index)
+{
+    return index == BOOKS_COLLECTION_ICON_COLUMN ? GDK_TYPE_PIXBUF : G_TYPE_STRING;
+}
+
+static gboolean
+books_collection_model_iter_nth_child (GtkTreeModel *tree_model,
+                                       GtkTreeIter *iter,
+                                       GtkTreeIter *parent,
+                                       gint n)
+{
+    BooksCollectionModelPrivate *priv;
+
+    priv = BOOKS_COLLECTION_MODEL (tree_model)->priv;
+
+    if (parent != NULL || n < 0 || n >= g_sequence_get_length (priv->view))
+        return FALSE;
+
+    iter->stamp = priv->stamp;
+    iter->user_data = g_sequence_get_iter_at_pos (priv->view, n);
+    return TRUE;
+}
+
+static gboolean
+books_collection_model_get_iter (GtkTreeModel *tree_model,
+                                 GtkTreeIter *iter,
+                                 GtkTreePath *path)
+{
+    if (gtk_tree_path_get_depth (path) != 1)
+        return FALSE;
+
+    return books_collection_model_iter_nth_child (tree_model, iter, NULL,
+                                                  gtk_tree_path_get_indices (path)[0]);
+}
+
+static GtkTreePath *
+books_collection_model_get_path (GtkTreeModel *tree_model,
+                                 GtkTreeIter *iter)
+{
+    return get_node_path (get_node (iter));
+}
+
+static void
+books_collection_model_get_value (GtkTreeModel *tree_model,
+                                  GtkTreeIter *iter,
+                                  gint column,
+                                  GValue *value)
+{
+    BooksCollectionModelPrivate *priv;
+    Node *node;
+    Row *row;
+
+    priv = BOOKS_COLLECTION_MODEL (tree_model)->priv;
+    g_return_if_fail (iter->stamp == priv->stamp);
+
+    node = get_node (iter);
+
+    if (column == BOOKS_COLLECTION_ICON_COLUMN) {
+        g_value_init (value, GDK_TYPE_PIXBUF);
+        g_value_set_object (value, node->cover != NULL ? node->cover : priv->placeholder);
+        return;
+    }
+
+    row = get_row (priv, node->id);
+    g_value_init (value, G_TYPE_STRING);
+
+    if (row == NULL)
+        return;
+
+    switch (column) {
+        case BOOKS_COLLECTION_AUTHOR_COLUMN:
+            g_value_set_string (value, row->author);
+            break;
+        case BOOKS_COLLECTION_TITLE_COLUMN:
+            g_value_set_string (value, row->title);
+            break;
+        case BOOKS_COLLECTION_MARKUP_COLUMN:
+            g_value_set_string (value, row->markup);
+            break;
+        case BOOKS_COLLECTION_PATH_COLUMN:
+            g_value_set_string (value, row->path);
+            break;
+    }
+}
+
+static gboolean
+books_collection_model_iter_next (GtkTreeModel *tree_model,
+                                  GtkTreeIter *iter)
+{
+    GSequenceIter *next;
+
+    next = g_sequence_iter_next (iter->user_data);
+
+    if (g_sequence_iter_is_end (next)) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    iter->user_data = next;
+    return TRUE;
+}
+
+static gboolean
+books_collection_model_iter_previous (GtkTreeModel *tree_model,
+                                      GtkTreeIter *iter)
+{
+    if (g_sequence_iter_is_begin (iter->user_data)) {
+        iter->stamp = 0;
+        return FALSE;
+    }
+
+    iter->user_data = g_sequence_iter_prev (iter->user_data);
+    return TRUE;
+}
+
+static gboolean
+books_collection_model_iter_children (GtkTreeModel *tree_model,
+                                      GtkTreeIter *iter,
+                                      GtkTreeIter *parent)
+{
+    return books_collection_model_iter_nth_child (tree_model, iter, parent, 0);
+}
+
+static gboolean
+books_collection_model_iter_has_child (GtkTreeModel *tree_model,
+                                       GtkTreeIter *iter)
+{
+    return FALSE;
+}
+
+static gint
+books_collection_model_iter_n_children (GtkTreeModel *tree_model,
+                                        GtkTreeIter *iter)
+{
+    return iter == NULL ? g_sequence_get_length (BOOKS_COLLECTION_MODEL (tree_model)->priv->view) : 0;
+}
+
+static gboolean
+books_collection_model_iter_parent (GtkTreeModel *tree_model,
+                                    GtkTreeIter *iter,
+                                    GtkTreeIter *child)
+{
+    return FALSE;
+}
+
+static void
+books_collection_model_tree_model_init (GtkTreeModelIface *iface)
+{
+    iface->get_flags = books_collection_model_get_flags;
+    iface->get_n_columns = books_collection_model_get_n_columns;
+    iface->get_column_type = books_collection_model_get_column_type;
+    iface->get_iter = books_collection_model_get_iter;
+    iface->get_path = books_collection_model_get_path;
+    iface->get_value = books_collection_model_get_value;
+    iface->iter_next = books_collection_model_iter_next;
+    iface->iter_previous = books_collection_model_iter_previous;
+    iface->iter_children = books_collection_model_iter_children;
+    iface->iter_has_child = books_collection_model_iter_has_child;
+    iface->iter_n_children = books_collection_model_iter_n_children;
+    iface->iter_nth_child = books_collection_model_iter_nth_child;
+    iface->iter_parent = books_collection_model_iter_parent;
+}
+
+static gboolean
+books_collection_model_get_sort_column_id (GtkTreeSortable *sortable,
+                                           gint *sort_column_id,
+                                           GtkSortType *order)
+{
+    BooksCollectionModelPrivate *priv;
+
+    priv = BOOKS_COLLECTION_MODEL (sortable)->priv;
+
+    if (sort_column_id != NULL)
+        *sort_column_id = priv->sort_column;
+
+    if (order != NULL)
+        *order = priv->sort_order;
+
+    return priv->sort_column != GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID &&
+           priv->sort_column != GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID;
+}
+
+/*
+ * Sorts all books, shown or not, and tells views about the new order of the
+ * shown rows with a single signal.
+ */
+static void
+books_collection_model_set_sort_column_id (GtkTreeSortable *sortable,
+                                           gint sort_column_id,
+                                           GtkSortType order)
+{
+    BooksCollectionModelPrivate *priv;
+    GSequenceIter *iter;
+    GtkTreePath *path;
+    gint *new_order;
+    gint i;
+
+    g_return_if_fail (sort_column_id == BOOKS_COLLECTION_AUTHOR_COLUMN ||
+                      sort_column_id == BOOKS_COLLECTION_TITLE_COLUMN ||
+                      sort_column_id == GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID ||
+                      sort_column_id == GTK_TREE_SORTABLE_UNSORTED_SORT_COLUMN_ID);
+
+    priv = BOOKS_COLLECTION_MODEL (sortable)->priv;
+
+    if (priv->sort_column == sort_column_id && priv->sort_order == order)
+        return;
+
+    priv->sort_column = sort_column_id;
+    priv->sort_order = order;
+
+    for (iter = g_sequence_get_begin_iter (priv->view), i = 0;
+         !g_sequence_iter_is_end (iter);
+         iter = g_sequence_iter_next (iter), i++)
+        ((Node *) g_sequence_get (iter))->position = i;
+
+    /*
+     * Iters still point to the same books after sorting, but at other
+     * positions, so the ones handed out before are invalidated.
+     */
+    g_sequence_sort (priv->order, (GCompareDataFunc) compare_nodes, priv);
+    g_sequence_sort (priv->view, (GCompareDataFunc) compare_nodes, priv);
+    priv->stamp++;
+
+    if (i > 0) {
+        new_order = g_new (gint, i);
+
+        for (iter = g_sequence_get_begin_iter (priv->view), i = 0;
+             !g_sequence_iter_is_end (iter);
+             iter = g_sequence_iter_next (iter), i++)
+            new_order[i] = ((Node *) g_sequence_get (iter))->position;
+
+        path = gtk_tree_path_new ();
+        gtk_tree_model_rows_reordered (GTK_TREE_MODEL (sortable), path, NULL, new_order);
+        gtk_tree_path_free (path);
+        g_free (new_order);
+    }
+
+    gtk_tree_sortable_sort_column_changed (sortable);
+}
+
+/* Sorting is done on the keys of all books, which other functions cannot see */
+static void
+books_collection_model_set_sort_func (GtkTreeSortable *sortable,
+                                      gint sort_column_id,
+                                      GtkTreeIterCompareFunc sort_func,
+                                      gpointer user_data,
+                                      GDestroyNotify destroy)
+{
+    g_warning ("BooksCollectionModel does not support custom sort functions\n");
+
+    if (destroy != NULL)
+        destroy (user_data);
+}
+
+static void
+books_collection_model_set_default_sort_func (GtkTreeSortable *sortable,
+                                              GtkTreeIterCompareFunc sort_func,
+                                              gpointer user_data,
+                                              GDestroyNotify destroy)
+{
+    g_warning ("BooksCollectionModel does not support custom sort functions\n");
+
+    if (destroy != NULL)
+        destroy (user_data);
+}
+
+/* Books are sorted by author, by title or in the order they were added in */
+static gboolean
+books_collection_model_has_default_sort_func (GtkTreeSortable *sortable)
+{
+    return TRUE;
+}
+
+static void
+books_collection_model_tree_sortable_init (GtkTreeSortableIface *iface)
+{
+    iface->get_sort_column_id = books_collection_model_get_sort_column_id;
+    iface->set_sort_column_id = books_collection_model_set_sort_column_id;
+    iface->set_sort_func = books_collection_model_set_sort_func;
+    iface->set_default_sort_func = books_collection_model_set_default_sort_func;
+    iface->has_default_sort_func = books_collection_model_has_default_sort_func;
+}
+
+static void
+books_collection_model_finalize (GObject *object)
+{
+    BooksCollectionModelPrivate *priv;
+
+    priv = BOOKS_COLLECTION_MODEL_GET_PRIVATE (object);
+
+    sqlite3_finalize (priv->page_stmt);
+    sqlite3_close (priv->db);
+    g_sequence_free (priv->view);
+    g_sequence_free (priv->order);
+    g_hash_table_destroy (priv->nodes);
+    g_array_unref (priv->ids);
+    g_free (priv->filter_key);
+    g_object_unref (priv->filter_cancellable);
+    drop_packed_keys (priv);
+    g_hash_table_destroy (priv->rows);
+
+    if (priv->placeholder != NULL)
+        g_object_unref (priv->placeholder);
+
+    G_OBJECT_CLASS (books_collection_model_parent_class)->finalize (object);
+}
+
+static void
+books_collection_model_class_init (BooksCollectionModelClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->finalize = books_collection_model_finalize;
+
+    /* Emitted around a rebuild of the shown rows, views must not be attached meanwhile */
+    signals[BEGIN_RESET] =
+        g_signal_new ("begin-reset",
+                      G_OBJECT_CLASS_TYPE (klass),
+                      G_SIGNAL_RUN_LAST,
+                      0, NULL, NULL,
+                      g_cclosure_marshal_VOID__VOID,
+                      G_TYPE_NONE, 0);
+
+    signals[END_RESET] =
+        g_signal_new ("end-reset",
+                      G_OBJECT_CLASS_TYPE (klass),
+                      G_SIGNAL_RUN_LAST,
+                      0, NULL, NULL,
+                      g_cclosure_marshal_VOID__VOID,
+                      G_TYPE_NONE, 0);
+
+    g_type_class_add_private (klass, sizeof(BooksCollectionModelPrivate));
+}
+
+static void
+books_collection_model_init (BooksCollectionModel *model)
+{
+    BooksCollectionModelPrivate *priv;
+
+    model->priv = priv = BOOKS_COLLECTION_MODEL_GET_PRIVATE (model);
+
+    priv->db = NULL;
+    priv->page_stmt = NULL;
+    priv->placeholder = NULL;
+    priv->filter_key = NULL;
+    priv->filter_cancellable = g_cancellable_new ();
+    priv->packed_keys = NULL;
+    priv->packed_offsets = NULL;
+    priv->packed_ids = NULL;
+    priv->ids = g_array_new (FALSE, FALSE, sizeof (gint64));
+    priv->nodes = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) free_node);
+    priv->order = g_sequence_new (NULL);
+    priv->view = g_sequence_new (NULL);
+    priv->sort_column = GTK_TREE_SORTABLE_DEFAULT_SORT_COLUMN_ID;
+    priv->sort_order = GTK_SORT_ASCENDING;
+    priv->rows = g_hash_table_new_full (g_int64_hash, g_int64_equal, NULL, (GDestroyNotify) free_row);
+    g_queue_init (&priv->lru);
+    priv->stamp = g_random_int ();
+}
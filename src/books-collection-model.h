@@ -0,0 +1,62 @@
+#ifndef BOOKS_COLLECTION_MODEL_H
+#define BOOKS_COLLECTION_MODEL_H
+
+#include <gtk/gtk.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_COLLECTION_MODEL             (books_collection_model_get_type())
+#define BOOKS_COLLECTION_MODEL(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_COLLECTION_MODEL, BooksCollectionModel))
+#define BOOKS_IS_COLLECTION_MODEL(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_COLLECTION_MODEL))
+#define BOOKS_COLLECTION_MODEL_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_COLLECTION_MODEL, BooksCollectionModelClass))
+#define BOOKS_IS_COLLECTION_MODEL_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_COLLECTION_MODEL))
+#define BOOKS_COLLECTION_MODEL_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_COLLECTION_MODEL, BooksCollectionModelClass))
+
+typedef struct _BooksCollectionModel           BooksCollectionModel;
+typedef struct _BooksCollectionModelClass      BooksCollectionModelClass;
+typedef struct _BooksCollectionModelPrivate    BooksCollectionModelPrivate;
+
+/* A book to add with the search key of its author and title */
+typedef struct {
+    gint64   id;
+    gchar   *key;
+} BooksCollectionModelEntry;
+
+struct _BooksCollectionModel {
+    GObject parent_instance;
+
+    BooksCollectionModelPrivate *priv;
+};
+
+struct _BooksCollectionModelClass {
+    GObjectClass parent_class;
+};
+
+BooksCollectionModel * books_collection_model_new               (const gchar           *filename,
+                                                                 GdkPixbuf             *placeholder);
+void                   books_collection_model_add               (BooksCollectionModel  *model,
+                                                                 GArray                *entries);
+void                   books_collection_model_remove            (BooksCollectionModel  *model,
+                                                                 GtkTreeIter           *iter);
+void                   books_collection_model_remove_ids        (BooksCollectionModel  *model,
+                                                                 GArray                *ids);
+void                   books_collection_model_reload_ids        (BooksCollectionModel  *model,
+                                                                 GArray                *ids);
+void                   books_collection_model_set_cover         (BooksCollectionModel  *model,
+                                                                 GtkTreeIter           *iter,
+                                                                 GdkPixbuf             *pixbuf);
+void                   books_collection_model_set_filter_async  (BooksCollectionModel  *model,
+                                                                 const gchar           *term,
+                                                                 GAsyncReadyCallback    callback,
+                                                                 gpointer               user_data);
+gboolean               books_collection_model_set_filter_finish (BooksCollectionModel  *model,
+                                                                 GAsyncResult          *result,
+                                                                 GError               **error);
+GArray               * books_collection_model_entries_new       (void);
+gchar                * books_collection_model_get_search_key    (const gchar           *author,
+                                                                 const gchar           *title);
+GType                  books_collection_model_get_type          (void);
+
+G_END_DECLS
+
+#endif
@@ -3,373 +3,2416 @@
 #endif
 
 #include <string.h>
-#include <sqlite3.h>
 #include <glib/gi18n.h>
 #include <glib/gstdio.h>
 
 #include "books-collection.h"
-#include "books-removed-dialog.h"
+#include "books-collection-model.h"
+#include "books-archive.h"
+#include "books-cover-cache.h"
+#include "books-database.h"
+#include "books-thumbnail.h"
 
 
 G_DEFINE_TYPE(BooksCollection, books_collection, G_TYPE_OBJECT)
 
+/* Paths checked for existence per job, and threads that check them */
+#define CHECK_CHUNK_SIZE    64
+#define CHECK_THREADS       4
+
+/* Rows shown at once at startup, the first chunk fills about a screen */
+#define LOAD_FIRST_CHUNK_SIZE   128
+#define LOAD_CHUNK_SIZE         512
+
 #define BOOKS_COLLECTION_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_COLLECTION, BooksCollectionPrivate))
 
-static void   set_pixbuf_column_from_file (BooksCollectionPrivate *priv, GtkTreeIter *iter, const gchar *cover);
-static gchar *get_author_title_markup     (const gchar *author, const gchar *title);
+static void   set_cover                   (BooksCollectionPrivate *priv, GtkTreeRowReference *reference, GdkPixbuf *pixbuf);
+static GdkPixbuf *load_cover_from_data    (GBytes *data, GError **error);
+static GBytes *save_thumbnail             (GdkPixbuf *pixbuf, GError **error);
+static gchar *get_author_title_markup     (const gchar *author, const gchar *title);
+static void   on_database_changed         (GObject *source, GAsyncResult *result, gpointer user_data);
+static void   load_chunk                  (BooksCollection *collection, gint64 after, guint limit);
+
+enum {
+    PROP_0,
+    PROP_FILTER_TERM
+};
+
+typedef struct {
+    gchar       *filename;
+    gchar       *fingerprint;
+    GVariant    *state;
+} StateData;
+
+typedef struct {
+    gchar   *markup;
+    gchar   *snippet;
+    gchar   *path;
+    guint    position;
+} SearchResult;
+
+struct _BooksCollectionPrivate {
+    BooksCollectionModel *model;
+    BooksDatabase   *database;
+    gchar           *filter_term;
+    GdkPixbuf       *placeholder;
+
+    /* Book paths mapped to row references of rows showing a thumbnail */
+    GHashTable      *covers;
+    GHashTable      *cover_requests;
+    GCancellable    *cover_cancellable;
+};
+
+BooksCollection *
+books_collection_new (void)
+{
+    return BOOKS_COLLECTION (g_object_new (BOOKS_TYPE_COLLECTION, NULL));
+}
+
+GtkTreeModel *
+books_collection_get_model (BooksCollection *collection)
+{
+    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection), NULL);
+    return GTK_TREE_MODEL (collection->priv->model);
+}
+
+/*
+ * Collects what the collection needs to know about @epub, which must have
+ * been opened at least with books_epub_open_metadata. The cover is decoded
+ * here, so this is best called from a worker thread.
+ */
+BooksCollectionItem *
+books_collection_item_new (BooksEpub *epub,
+                           const gchar *path)
+{
+    BooksCollectionItem *item;
+    const gchar *author;
+    const gchar *title;
+    const gchar *cover;
+    GBytes *cover_data;
+
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && path != NULL, NULL);
+
+    author = books_epub_get_meta (epub, "creator");
+    title = books_epub_get_meta (epub, "title");
+    cover = books_epub_get_cover (epub);
+
+    item = g_new0 (BooksCollectionItem, 1);
+    item->author = g_strdup (author != NULL ? author : "n/a");
+    item->title = g_strdup (title != NULL ? title : "");
+    item->path = g_strdup (path);
+    item->cover = g_strdup (cover != NULL ? cover : "");
+    item->fingerprint = g_strdup (books_epub_get_fingerprint (epub));
+
+    cover_data = books_epub_get_cover_data (epub);
+
+    if (cover_data != NULL) {
+        GdkPixbuf *pixbuf;
+        GError *error = NULL;
+
+        pixbuf = load_cover_from_data (cover_data, &error);
+
+        if (pixbuf != NULL) {
+            item->thumbnail = save_thumbnail (pixbuf, &error);
+            g_object_unref (pixbuf);
+        }
+
+        if (error != NULL) {
+            g_printerr (_("Could not load cover image: %s\n"), error->message);
+            g_error_free (error);
+        }
+    }
+
+    return item;
+}
+
+void
+books_collection_item_free (BooksCollectionItem *item)
+{
+    g_free (item->author);
+    g_free (item->title);
+    g_free (item->path);
+    g_free (item->cover);
+    g_free (item->fingerprint);
+
+    if (item->thumbnail != NULL)
+        g_bytes_unref (item->thumbnail);
+
+    g_free (item);
+}
+
+/*
+ * Books without a cover get a row as well, so that nobody tries to create
+ * their thumbnail again.
+ */
+static gboolean
+insert_thumbnail (sqlite3_stmt *stmt,
+                  BooksCollectionItem *item)
+{
+    gboolean success;
+
+    if (item->fingerprint == NULL)
+        return TRUE;
+
+    sqlite3_bind_text (stmt, 1, item->fingerprint, strlen (item->fingerprint), NULL);
+
+    if (item->thumbnail != NULL)
+        sqlite3_bind_blob (stmt, 2, g_bytes_get_data (item->thumbnail, NULL),
+                           g_bytes_get_size (item->thumbnail), NULL);
+    else
+        sqlite3_bind_null (stmt, 2);
+
+    success = sqlite3_step (stmt) == SQLITE_DONE;
+    sqlite3_reset (stmt);
+    return success;
+}
+
+static gpointer
+insert_items (sqlite3 *db,
+              GPtrArray *items,
+              GError **error)
+{
+    sqlite3_stmt *insert_stmt = NULL;
+    sqlite3_stmt *thumbnail_stmt = NULL;
+    const gchar *insert_sql = "INSERT INTO books (author, title, path, cover, fingerprint) VALUES (?, ?, ?, ?, ?)";
+    const gchar *thumbnail_sql = "INSERT OR REPLACE INTO thumbnails (fingerprint, data) VALUES (?, ?)";
+    GArray *entries;
+    gboolean success = TRUE;
+    guint i;
+
+    if (!books_database_exec (db, "BEGIN", error))
+        return NULL;
+
+    entries = books_collection_model_entries_new ();
+    sqlite3_prepare_v2 (db, insert_sql, -1, &insert_stmt, NULL);
+    sqlite3_prepare_v2 (db, thumbnail_sql, -1, &thumbnail_stmt, NULL);
+
+    for (i = 0; i < items->len && success; i++) {
+        BooksCollectionItem *item;
+
+        item = g_ptr_array_index (items, i);
+        sqlite3_bind_text (insert_stmt, 1, item->author, strlen (item->author), NULL);
+        sqlite3_bind_text (insert_stmt, 2, item->title, strlen (item->title), NULL);
+        sqlite3_bind_text (insert_stmt, 3, item->path, strlen (item->path), NULL);
+        sqlite3_bind_text (insert_stmt, 4, item->cover, strlen (item->cover), NULL);
+
+        if (item->fingerprint != NULL)
+            sqlite3_bind_text (insert_stmt, 5, item->fingerprint, strlen (item->fingerprint), NULL);
+        else
+            sqlite3_bind_null (insert_stmt, 5);
+
+        success = sqlite3_step (insert_stmt) == SQLITE_DONE;
+
+        if (success) {
+            BooksCollectionModelEntry entry;
+
+            entry.id = sqlite3_last_insert_rowid (db);
+            entry.key = books_collection_model_get_search_key (item->author, item->title);
+            g_array_append_val (entries, entry);
+            success = insert_thumbnail (thumbnail_stmt, item);
+        }
+
+        sqlite3_reset (insert_stmt);
+    }
+
+    if (success) {
+        success = books_database_exec (db, "COMMIT", error);
+    }
+    else {
+        books_database_set_error (db, error);
+        books_database_exec (db, "ROLLBACK", NULL);
+    }
+
+    sqlite3_finalize (insert_stmt);
+    sqlite3_finalize (thumbnail_stmt);
+
+    if (!success) {
+        g_array_unref (entries);
+        return NULL;
+    }
+
+    return entries;
+}
+
+static void
+on_items_inserted (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    BooksCollection *collection;
+    GTask *task;
+    GArray *entries;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    collection = BOOKS_COLLECTION (g_task_get_source_object (task));
+    entries = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (entries == NULL) {
+        g_task_return_error (task, error);
+    }
+    else {
+        books_collection_model_add (collection->priv->model, entries);
+        g_array_unref (entries);
+        g_task_return_boolean (task, TRUE);
+    }
+
+    g_object_unref (task);
+}
+
+/*
+ * Stores all of @items in meta.db in a single transaction, they show up in
+ * the model once it has been committed. Finish with
+ * books_collection_add_items_finish.
+ */
+void
+books_collection_add_items_async (BooksCollection *collection,
+                                  GPtrArray *items,
+                                  GAsyncReadyCallback callback,
+                                  gpointer user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && items != NULL);
+
+    task = g_task_new (collection, NULL, callback, user_data);
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) insert_items,
+                              g_ptr_array_ref (items), (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_items_inserted, task);
+}
+
+gboolean
+books_collection_add_items_finish (BooksCollection *collection,
+                                   GAsyncResult *result,
+                                   GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, collection), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/*
+ * Returns those of @paths that are not in the collection yet. Each lookup
+ * goes through the index on books.path.
+ */
+static gpointer
+select_new_files (sqlite3 *db,
+                  GPtrArray *paths,
+                  GError **error)
+{
+    GPtrArray *new_paths;
+    sqlite3_stmt *select_stmt = NULL;
+    const gchar *select_sql = "SELECT 1 FROM books WHERE path=? LIMIT 1";
+    guint i;
+
+    new_paths = g_ptr_array_new_with_free_func (g_free);
+    sqlite3_prepare_v2 (db, select_sql, -1, &select_stmt, NULL);
+
+    for (i = 0; i < paths->len; i++) {
+        const gchar *path;
+        gint result;
+
+        path = g_ptr_array_index (paths, i);
+        sqlite3_bind_text (select_stmt, 1, path, strlen (path), NULL);
+        result = sqlite3_step (select_stmt);
+
+        if (result == SQLITE_DONE) {
+            g_ptr_array_add (new_paths, g_strdup (path));
+        }
+        else if (result != SQLITE_ROW) {
+            books_database_set_error (db, error);
+            g_ptr_array_unref (new_paths);
+            new_paths = NULL;
+            break;
+        }
+
+        sqlite3_reset (select_stmt);
+    }
+
+    sqlite3_finalize (select_stmt);
+    return new_paths;
+}
+
+static void
+on_new_files_selected (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
+{
+    GTask *task;
+    GPtrArray *new_paths;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    new_paths = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (new_paths == NULL)
+        g_task_return_error (task, error);
+    else
+        g_task_return_pointer (task, new_paths, (GDestroyNotify) g_ptr_array_unref);
+
+    g_object_unref (task);
+}
+
+/*
+ * Looks up which of the file names in @paths are not part of the
+ * collection. Finish with books_collection_filter_new_files_finish.
+ */
+void
+books_collection_filter_new_files_async (BooksCollection *collection,
+                                         GPtrArray *paths,
+                                         GCancellable *cancellable,
+                                         GAsyncReadyCallback callback,
+                                         gpointer user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && paths != NULL);
+
+    task = g_task_new (collection, cancellable, callback, user_data);
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) select_new_files,
+                              g_ptr_array_ref (paths), (GDestroyNotify) g_ptr_array_unref,
+                              cancellable, on_new_files_selected, task);
+}
+
+/*
+ * Returns an array of file names that must be released with
+ * g_ptr_array_unref.
+ */
+GPtrArray *
+books_collection_filter_new_files_finish (BooksCollection *collection,
+                                          GAsyncResult *result,
+                                          GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, collection), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static gpointer
+delete_books (sqlite3 *db,
+              GPtrArray *paths,
+              GError **error)
+{
+    sqlite3_stmt *state_stmt = NULL;
+    sqlite3_stmt *thumbnail_stmt = NULL;
+    sqlite3_stmt *books_stmt = NULL;
+    sqlite3_stmt *contents_stmt = NULL;
+    /* Identical copies of a book share state and thumbnail, which are kept for the others */
+    const gchar *state_sql =
+        "DELETE FROM state WHERE fingerprint IN (SELECT fingerprint FROM books WHERE path=?1) "
+        "AND NOT EXISTS (SELECT 1 FROM books WHERE fingerprint=state.fingerprint AND path<>?1)";
+    const gchar *thumbnail_sql =
+        "DELETE FROM thumbnails WHERE fingerprint IN (SELECT fingerprint FROM books WHERE path=?1) "
+        "AND NOT EXISTS (SELECT 1 FROM books WHERE fingerprint=thumbnails.fingerprint AND path<>?1)";
+    const gchar *books_sql = "DELETE FROM books WHERE path=?";
+    const gchar *contents_sql =
+        "DELETE FROM contents WHERE rowid BETWEEN (SELECT id FROM books WHERE path=?1) << 20 "
+        "AND ((SELECT id FROM books WHERE path=?1) << 20) + 1048575";
+    gboolean success = TRUE;
+    guint i;
+
+    /* A savepoint, so that renames can replace books in their transaction */
+    if (!books_database_exec (db, "SAVEPOINT delete_books", error))
+        return NULL;
+
+    sqlite3_prepare_v2 (db, state_sql, -1, &state_stmt, NULL);
+    sqlite3_prepare_v2 (db, thumbnail_sql, -1, &thumbnail_stmt, NULL);
+    sqlite3_prepare_v2 (db, books_sql, -1, &books_stmt, NULL);
+    sqlite3_prepare_v2 (db, contents_sql, -1, &contents_stmt, NULL);
+
+    for (i = 0; i < paths->len && success; i++) {
+        const gchar *path;
+
+        path = g_ptr_array_index (paths, i);
+        sqlite3_bind_text (state_stmt, 1, path, strlen (path), NULL);
+        sqlite3_bind_text (thumbnail_stmt, 1, path, strlen (path), NULL);
+        sqlite3_bind_text (books_stmt, 1, path, strlen (path), NULL);
+        sqlite3_bind_text (contents_stmt, 1, path, strlen (path), NULL);
+
+        success = sqlite3_step (state_stmt) == SQLITE_DONE &&
+                  sqlite3_step (thumbnail_stmt) == SQLITE_DONE &&
+                  sqlite3_step (contents_stmt) == SQLITE_DONE &&
+                  sqlite3_step (books_stmt) == SQLITE_DONE;
+
+        sqlite3_reset (state_stmt);
+        sqlite3_reset (thumbnail_stmt);
+        sqlite3_reset (books_stmt);
+        sqlite3_reset (contents_stmt);
+    }
+
+    if (success) {
+        books_database_exec (db, "RELEASE delete_books", error);
+    }
+    else {
+        books_database_set_error (db, error);
+        books_database_exec (db, "ROLLBACK TO delete_books; RELEASE delete_books", NULL);
+    }
+
+    sqlite3_finalize (state_stmt);
+    sqlite3_finalize (thumbnail_stmt);
+    sqlite3_finalize (books_stmt);
+    sqlite3_finalize (contents_stmt);
+    return NULL;
+}
+
+void
+books_collection_remove_book (BooksCollection *collection,
+                              GtkTreeIter *iter)
+{
+    BooksCollectionPrivate *priv;
+    GPtrArray *paths;
+    gchar *path;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection));
+    priv = collection->priv;
+
+    gtk_tree_model_get (GTK_TREE_MODEL (priv->model), iter, BOOKS_COLLECTION_PATH_COLUMN, &path, -1);
+    books_collection_model_remove (priv->model, iter);
+
+    paths = g_ptr_array_new_with_free_func (g_free);
+    g_ptr_array_add (paths, path);
+    books_database_run_async (priv->database, (BooksDatabaseFunc) delete_books,
+                              paths, (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_database_changed, NULL);
+}
+
+/*
+ * Appends the row ids and paths of the book at @path or, if it names a
+ * folder, of all books below it. Paths below a folder sort between the
+ * folder with a trailing separator and the one with the next character
+ * instead, which keeps the lookup on the index on books.path.
+ */
+static gboolean
+select_books_at (sqlite3_stmt *stmt,
+                 const gchar *path,
+                 GArray *ids,
+                 GPtrArray *paths)
+{
+    gchar *lower;
+    gchar *upper;
+    gint result;
+
+    lower = g_strconcat (path, G_DIR_SEPARATOR_S, NULL);
+    upper = g_strdup (lower);
+    upper[strlen (upper) - 1]++;
+
+    sqlite3_bind_text (stmt, 1, path, strlen (path), SQLITE_TRANSIENT);
+    sqlite3_bind_text (stmt, 2, lower, strlen (lower), SQLITE_TRANSIENT);
+    sqlite3_bind_text (stmt, 3, upper, strlen (upper), SQLITE_TRANSIENT);
+
+    while ((result = sqlite3_step (stmt)) == SQLITE_ROW) {
+        gint64 id;
+
+        id = sqlite3_column_int64 (stmt, 0);
+        g_array_append_val (ids, id);
+        g_ptr_array_add (paths, g_strdup ((const gchar *) sqlite3_column_text (stmt, 1)));
+    }
+
+    sqlite3_reset (stmt);
+    g_free (lower);
+    g_free (upper);
+    return result == SQLITE_DONE;
+}
+
+static sqlite3_stmt *
+prepare_select_books_at (sqlite3 *db)
+{
+    sqlite3_stmt *stmt = NULL;
+    const gchar *sql = "SELECT id, path FROM books WHERE path=?1 OR (path>?2 AND path<?3)";
+
+    sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL);
+    return stmt;
+}
+
+/* Returns the row ids of the removed books */
+static gpointer
+delete_files (sqlite3 *db,
+              GPtrArray *paths,
+              GError **error)
+{
+    sqlite3_stmt *select_stmt;
+    GPtrArray *books;
+    GArray *ids;
+    GError *delete_error = NULL;
+    gboolean success = TRUE;
+    guint i;
+
+    ids = g_array_new (FALSE, FALSE, sizeof (gint64));
+    books = g_ptr_array_new_with_free_func (g_free);
+    select_stmt = prepare_select_books_at (db);
+
+    for (i = 0; i < paths->len && success; i++)
+        success = select_books_at (select_stmt, g_ptr_array_index (paths, i), ids, books);
+
+    if (!success)
+        books_database_set_error (db, &delete_error);
+    else if (books->len > 0)
+        delete_books (db, books, &delete_error);
+
+    sqlite3_finalize (select_stmt);
+    g_ptr_array_unref (books);
+
+    if (delete_error != NULL) {
+        g_propagate_error (error, delete_error);
+        g_array_unref (ids);
+        return NULL;
+    }
+
+    return ids;
+}
+
+static void
+on_files_deleted (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    BooksCollection *collection;
+    GArray *ids;
+    GError *error = NULL;
+
+    collection = BOOKS_COLLECTION (user_data);
+    ids = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (ids == NULL) {
+        g_printerr (_("Could not update database: %s\n"), error->message);
+        g_error_free (error);
+    }
+    else {
+        books_collection_model_remove_ids (collection->priv->model, ids);
+        g_array_unref (ids);
+    }
+
+    g_object_unref (collection);
+}
+
+/*
+ * Removes the books stored at @paths, e.g. because the files have been
+ * deleted. A path may also name a folder, all books below it are removed.
+ */
+void
+books_collection_remove_files (BooksCollection *collection,
+                               GPtrArray *paths)
+{
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && paths != NULL);
+
+    if (paths->len == 0)
+        return;
+
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) delete_files,
+                              g_ptr_array_ref (paths), (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_files_deleted, g_object_ref (collection));
+}
+
+/* Pairs of old and new paths, one after another */
+static gpointer
+update_paths (sqlite3 *db,
+              GPtrArray *renames,
+              GError **error)
+{
+    sqlite3_stmt *books_stmt = NULL;
+    const gchar *books_sql = "UPDATE books SET path=? WHERE path=?";
+    gboolean success = TRUE;
+    guint i;
+
+    if (!books_database_exec (db, "SAVEPOINT update_paths", error))
+        return NULL;
+
+    sqlite3_prepare_v2 (db, books_sql, -1, &books_stmt, NULL);
+
+    for (i = 0; i + 1 < renames->len && success; i += 2) {
+        const gchar *old_path;
+        const gchar *new_path;
+
+        old_path = g_ptr_array_index (renames, i);
+        new_path = g_ptr_array_index (renames, i + 1);
+
+        sqlite3_bind_text (books_stmt, 1, new_path, strlen (new_path), NULL);
+        sqlite3_bind_text (books_stmt, 2, old_path, strlen (old_path), NULL);
+
+        success = sqlite3_step (books_stmt) == SQLITE_DONE;
+        sqlite3_reset (books_stmt);
+    }
+
+    if (success) {
+        books_database_exec (db, "RELEASE update_paths", error);
+    }
+    else {
+        books_database_set_error (db, error);
+        books_database_exec (db, "ROLLBACK TO update_paths; RELEASE update_paths", NULL);
+    }
+
+    sqlite3_finalize (books_stmt);
+    return NULL;
+}
+
+typedef struct {
+    GArray  *moved;
+    GArray  *replaced;
+} Renamed;
+
+static void
+renamed_free (Renamed *renamed)
+{
+    g_array_unref (renamed->moved);
+    g_array_unref (renamed->replaced);
+    g_free (renamed);
+}
+
+/*
+ * Moves the books at or below the old paths in @renames and returns the
+ * row ids of the moved books and of those that were overwritten by them.
+ * Each rename is applied before the next one is looked up, because a later
+ * one may move the same books again.
+ */
+static gpointer
+rename_books (sqlite3 *db,
+              GPtrArray *renames,
+              GError **error)
+{
+    sqlite3_stmt *select_stmt;
+    Renamed *renamed;
+    GError *rename_error = NULL;
+    guint i;
+
+    if (!books_database_exec (db, "BEGIN", error))
+        return NULL;
+
+    renamed = g_new0 (Renamed, 1);
+    renamed->moved = g_array_new (FALSE, FALSE, sizeof (gint64));
+    renamed->replaced = g_array_new (FALSE, FALSE, sizeof (gint64));
+    select_stmt = prepare_select_books_at (db);
+
+    for (i = 0; i + 1 < renames->len && rename_error == NULL; i += 2) {
+        GPtrArray *old_paths;
+        GPtrArray *replaced_paths;
+        const gchar *old_path;
+        const gchar *new_path;
+
+        old_path = g_ptr_array_index (renames, i);
+        new_path = g_ptr_array_index (renames, i + 1);
+
+        if (!strcmp (old_path, new_path))
+            continue;
+
+        old_paths = g_ptr_array_new_with_free_func (g_free);
+        replaced_paths = g_ptr_array_new_with_free_func (g_free);
+
+        /* Books at the new path, e.g. a file moved over another one, are gone */
+        if (!select_books_at (select_stmt, old_path, renamed->moved, old_paths) ||
+            !select_books_at (select_stmt, new_path, renamed->replaced, replaced_paths))
+            books_database_set_error (db, &rename_error);
+        else if (replaced_paths->len > 0)
+            delete_books (db, replaced_paths, &rename_error);
+
+        if (rename_error == NULL && old_paths->len > 0) {
+            GPtrArray *books;
+            guint j;
+
+            books = g_ptr_array_new_with_free_func (g_free);
+
+            for (j = 0; j < old_paths->len; j++) {
+                const gchar *path;
+
+                path = g_ptr_array_index (old_paths, j);
+                g_ptr_array_add (books, g_strdup (path));
+                g_ptr_array_add (books, g_strconcat (new_path, path + strlen (old_path), NULL));
+            }
+
+            update_paths (db, books, &rename_error);
+            g_ptr_array_unref (books);
+        }
+
+        g_ptr_array_unref (old_paths);
+        g_ptr_array_unref (replaced_paths);
+    }
+
+    sqlite3_finalize (select_stmt);
+
+    if (rename_error == NULL && books_database_exec (db, "COMMIT", &rename_error))
+        return renamed;
+
+    books_database_exec (db, "ROLLBACK", NULL);
+    g_propagate_error (error, rename_error);
+    renamed_free (renamed);
+    return NULL;
+}
+
+static void
+on_books_renamed (GObject *source,
+                  GAsyncResult *result,
+                  gpointer user_data)
+{
+    BooksCollection *collection;
+    Renamed *renamed;
+    GError *error = NULL;
+
+    collection = BOOKS_COLLECTION (user_data);
+    renamed = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (renamed == NULL) {
+        g_printerr (_("Could not update database: %s\n"), error->message);
+        g_error_free (error);
+    }
+    else {
+        /* Books moved and overwritten later on are not reloaded */
+        books_collection_model_remove_ids (collection->priv->model, renamed->replaced);
+        books_collection_model_reload_ids (collection->priv->model, renamed->moved);
+        renamed_free (renamed);
+    }
+
+    g_object_unref (collection);
+}
+
+/*
+ * Follows books that have been moved or renamed. @renames holds the old
+ * and the new path of each file or folder one after another.
+ */
+void
+books_collection_rename_files (BooksCollection *collection,
+                               GPtrArray *renames)
+{
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && renames != NULL);
+
+    if (renames->len < 2)
+        return;
+
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) rename_books,
+                              g_ptr_array_ref (renames), (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_books_renamed, g_object_ref (collection));
+}
+
+static void
+on_book_opened (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    GTask *task;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+
+    if (books_epub_open_finish (BOOKS_EPUB (source), result, &error))
+        g_task_return_pointer (task, g_object_ref (source), g_object_unref);
+    else
+        g_task_return_error (task, error);
+
+    g_object_unref (task);
+}
+
+typedef struct {
+    BooksEpubProgressCallback    progress_callback;
+    gpointer                     progress_data;
+    gchar                       *filename;
+} OpenData;
+
+static void
+open_data_free (OpenData *data)
+{
+    g_free (data->filename);
+    g_free (data);
+}
+
+/*
+ * Returns the state saved when the book at @filename was closed the last
+ * time or NULL if there is none.
+ */
+static gpointer
+select_state (sqlite3 *db,
+              const gchar *filename,
+              GError **error)
+{
+    sqlite3_stmt *select_stmt = NULL;
+    GVariant *state = NULL;
+    gint result;
+    const gchar *select_sql =
+        "SELECT state.data FROM books JOIN state ON state.fingerprint = books.fingerprint "
+        "WHERE books.path=?";
+
+    sqlite3_prepare_v2 (db, select_sql, -1, &select_stmt, NULL);
+    sqlite3_bind_text (select_stmt, 1, filename, strlen (filename), NULL);
+
+    result = sqlite3_step (select_stmt);
+
+    if (result == SQLITE_ROW) {
+        GVariant *container;
+        gsize size;
+
+        size = (gsize) sqlite3_column_bytes (select_stmt, 0);
+        container = g_variant_new_from_data (G_VARIANT_TYPE_VARIANT,
+                                             g_memdup (sqlite3_column_blob (select_stmt, 0), size),
+                                             size, FALSE, g_free, NULL);
+        g_variant_ref_sink (container);
+        state = g_variant_get_variant (container);
+        g_variant_unref (container);
+    }
+    else if (result != SQLITE_DONE) {
+        books_database_set_error (db, error);
+    }
+
+    sqlite3_finalize (select_stmt);
+    return state;
+}
+
+static void
+on_state_loaded (GObject *source,
+                 GAsyncResult *result,
+                 gpointer user_data)
+{
+    GTask *task;
+    OpenData *data;
+    BooksEpub *epub;
+    GVariant *state;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    data = g_task_get_task_data (task);
+    state = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (error != NULL) {
+        /* Without a saved state the book is simply parsed from scratch */
+        if (g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_task_return_error (task, error);
+            g_object_unref (task);
+            return;
+        }
+
+        g_printerr (_("Could not load reading position: %s\n"), error->message);
+        g_error_free (error);
+    }
+
+    epub = books_epub_new ();
+
+    if (state != NULL) {
+        books_epub_set_state (epub, state);
+        g_variant_unref (state);
+    }
+
+    /* The task is passed on and released in on_book_opened */
+    books_epub_open_async (epub, data->filename, g_task_get_cancellable (task),
+                           data->progress_callback, data->progress_data,
+                           on_book_opened, task);
+
+    g_object_unref (epub);
+}
+
+static void
+open_file (BooksCollectionPrivate *priv,
+           GTask *task,
+           const gchar *filename,
+           BooksEpubProgressCallback progress_callback,
+           gpointer progress_data)
+{
+    OpenData *data;
+
+    data = g_new0 (OpenData, 1);
+    data->progress_callback = progress_callback;
+    data->progress_data = progress_data;
+    data->filename = g_strdup (filename);
+    g_task_set_task_data (task, data, (GDestroyNotify) open_data_free);
+
+    books_database_run_async (priv->database, (BooksDatabaseFunc) select_state,
+                              g_strdup (filename), g_free,
+                              g_task_get_cancellable (task), on_state_loaded, task);
+}
+
+void
+books_collection_get_book_async (BooksCollection *collection,
+                                 GtkTreePath *path,
+                                 GCancellable *cancellable,
+                                 BooksEpubProgressCallback progress_callback,
+                                 gpointer progress_data,
+                                 GAsyncReadyCallback callback,
+                                 gpointer user_data)
+{
+    BooksCollectionPrivate *priv;
+    GtkTreeIter iter;
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection));
+
+    priv = collection->priv;
+    task = g_task_new (collection, cancellable, callback, user_data);
+
+    if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->model), &iter, path)) {
+        gchar *filename;
+
+        gtk_tree_model_get (GTK_TREE_MODEL (priv->model), &iter, BOOKS_COLLECTION_PATH_COLUMN, &filename, -1);
+        open_file (priv, task, filename, progress_callback, progress_data);
+        g_free (filename);
+    }
+    else {
+        g_task_return_new_error (task, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                                 "No book at this position");
+        g_object_unref (task);
+    }
+}
+
+/*
+ * Like books_collection_get_book_async for a book given by its file name.
+ * Finish with books_collection_get_book_finish.
+ */
+void
+books_collection_get_book_for_file_async (BooksCollection *collection,
+                                          const gchar *filename,
+                                          GCancellable *cancellable,
+                                          BooksEpubProgressCallback progress_callback,
+                                          gpointer progress_data,
+                                          GAsyncReadyCallback callback,
+                                          gpointer user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && filename != NULL);
+
+    task = g_task_new (collection, cancellable, callback, user_data);
+    open_file (collection->priv, task, filename, progress_callback, progress_data);
+}
+
+BooksEpub *
+books_collection_get_book_finish (BooksCollection *collection,
+                                  GAsyncResult *result,
+                                  GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, collection), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+const gchar *
+books_collection_get_database_filename (BooksCollection *collection)
+{
+    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection), NULL);
+    return books_database_get_filename (collection->priv->database);
+}
+
+static void
+on_database_changed (GObject *source,
+                     GAsyncResult *result,
+                     gpointer user_data)
+{
+    GError *error = NULL;
+
+    books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (error != NULL) {
+        g_printerr (_("Could not update database: %s\n"), error->message);
+        g_error_free (error);
+    }
+}
+
+static void
+state_data_free (StateData *data)
+{
+    g_free (data->filename);
+    g_free (data->fingerprint);
+    g_variant_unref (data->state);
+    g_free (data);
+}
+
+static gpointer
+write_state (sqlite3 *db,
+             StateData *data,
+             GError **error)
+{
+    sqlite3_stmt *delete_stmt = NULL;
+    sqlite3_stmt *update_stmt = NULL;
+    sqlite3_stmt *insert_stmt = NULL;
+    /* The state of the old fingerprint is kept while identical copies use it */
+    const gchar *delete_sql =
+        "DELETE FROM state WHERE fingerprint IN (SELECT fingerprint FROM books WHERE path=?1) "
+        "AND NOT EXISTS (SELECT 1 FROM books WHERE fingerprint=state.fingerprint AND path<>?1)";
+    const gchar *update_sql = "UPDATE books SET fingerprint=? WHERE path=?";
+    const gchar *insert_sql = "INSERT OR REPLACE INTO state (fingerprint, data) VALUES (?, ?)";
+
+    if (!books_database_exec (db, "BEGIN", error))
+        return NULL;
+
+    sqlite3_prepare_v2 (db, delete_sql, -1, &delete_stmt, NULL);
+    sqlite3_prepare_v2 (db, update_sql, -1, &update_stmt, NULL);
+    sqlite3_prepare_v2 (db, insert_sql, -1, &insert_stmt, NULL);
+
+    sqlite3_bind_text (delete_stmt, 1, data->filename, strlen (data->filename), NULL);
+    sqlite3_bind_text (update_stmt, 1, data->fingerprint, strlen (data->fingerprint), NULL);
+    sqlite3_bind_text (update_stmt, 2, data->filename, strlen (data->filename), NULL);
+    sqlite3_bind_text (insert_stmt, 1, data->fingerprint, strlen (data->fingerprint), NULL);
+    sqlite3_bind_blob (insert_stmt, 2, g_variant_get_data (data->state),
+                       (int) g_variant_get_size (data->state), NULL);
+
+    if (sqlite3_step (delete_stmt) == SQLITE_DONE &&
+        sqlite3_step (update_stmt) == SQLITE_DONE &&
+        sqlite3_step (insert_stmt) == SQLITE_DONE) {
+        books_database_exec (db, "COMMIT", error);
+    }
+    else {
+        books_database_set_error (db, error);
+        books_database_exec (db, "ROLLBACK", NULL);
+    }
+
+    sqlite3_finalize (delete_stmt);
+    sqlite3_finalize (update_stmt);
+    sqlite3_finalize (insert_stmt);
+    return NULL;
+}
+
+/*
+ * Remembers the reading position and the parsed package of @epub, so that
+ * the next time it is opened it starts right there without parsing. The
+ * state is taken immediately and written in the background.
+ */
+void
+books_collection_save_state (BooksCollection *collection,
+                             BooksEpub *epub)
+{
+    StateData *data;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && BOOKS_IS_EPUB (epub));
+
+    data = g_new0 (StateData, 1);
+    data->filename = g_strdup (books_epub_get_filename (epub));
+    data->fingerprint = g_strdup (books_epub_get_fingerprint (epub));
+    data->state = g_variant_ref_sink (g_variant_new_variant (books_epub_get_state (epub)));
+
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) write_state,
+                              data, (GDestroyNotify) state_data_free,
+                              NULL, on_database_changed, NULL);
+}
+
+/*
+ * Turns user input into an FTS5 query that matches documents containing
+ * all words. Each word is quoted so that operators and punctuation typed by
+ * the user cannot cause syntax errors, the last one is matched as a prefix.
+ */
+static gchar *
+get_match_expression (const gchar *query)
+{
+    GString *expression;
+    gchar **words;
+    guint i;
+
+    expression = g_string_new (NULL);
+    words = g_strsplit_set (query, " \t\n", -1);
+
+    for (i = 0; words[i] != NULL; i++) {
+        gchar **quotes;
+        gchar *escaped;
+
+        if (words[i][0] == '\0')
+            continue;
+
+        quotes = g_strsplit (words[i], "\"", -1);
+        escaped = g_strjoinv ("\"\"", quotes);
+
+        if (expression->len > 0)
+            g_string_append_c (expression, ' ');
+
+        g_string_append_printf (expression, "\"%s\"", escaped);
+        g_strfreev (quotes);
+        g_free (escaped);
+    }
+
+    if (expression->len > 0)
+        g_string_append_c (expression, '*');
+
+    g_strfreev (words);
+    return g_string_free (expression, FALSE);
+}
+
+/*
+ * snippet() marks matches with control characters, escape the rest for
+ * Pango and turn the marks into bold markup afterwards.
+ */
+static gchar *
+get_snippet_markup (const gchar *snippet)
+{
+    GString *markup;
+    const gchar *p;
+
+    markup = g_string_new (NULL);
+
+    for (p = snippet; *p != '\0'; p++) {
+        if (*p == '\001')
+            g_string_append (markup, "<b>");
+        else if (*p == '\002')
+            g_string_append (markup, "</b>");
+        else if (*p == '&')
+            g_string_append (markup, "&amp;");
+        else if (*p == '<')
+            g_string_append (markup, "&lt;");
+        else if (*p == '>')
+            g_string_append (markup, "&gt;");
+        else
+            g_string_append_c (markup, *p);
+    }
+
+    return g_string_free (markup, FALSE);
+}
+
+static void
+search_result_free (SearchResult *result)
+{
+    g_free (result->markup);
+    g_free (result->snippet);
+    g_free (result->path);
+    g_free (result);
+}
+
+static gpointer
+search_contents (sqlite3 *db,
+                 const gchar *expression,
+                 GError **error)
+{
+    GPtrArray *results;
+    sqlite3_stmt *search_stmt = NULL;
+    gint result;
+    const gchar *search_sql =
+        "SELECT books.author, books.title, books.path, contents.rowid & 1048575, "
+        "       snippet(contents, 0, char(1), char(2), '...', 12) "
+        "FROM contents JOIN books ON books.id = contents.rowid >> 20 "
+        "WHERE contents MATCH ? ORDER BY rank LIMIT 200";
+
+    results = g_ptr_array_new_with_free_func ((GDestroyNotify) search_result_free);
+
+    if (expression[0] == '\0')
+        return results;
+
+    if (sqlite3_prepare_v2 (db, search_sql, -1, &search_stmt, NULL) != SQLITE_OK) {
+        books_database_set_error (db, error);
+        g_ptr_array_unref (results);
+        return NULL;
+    }
+
+    sqlite3_bind_text (search_stmt, 1, expression, strlen (expression), NULL);
+
+    while ((result = sqlite3_step (search_stmt)) == SQLITE_ROW) {
+        SearchResult *search_result;
+
+        search_result = g_new0 (SearchResult, 1);
+        search_result->markup = get_author_title_markup ((const gchar *) sqlite3_column_text (search_stmt, 0),
+                                                         (const gchar *) sqlite3_column_text (search_stmt, 1));
+        search_result->snippet = get_snippet_markup ((const gchar *) sqlite3_column_text (search_stmt, 4));
+        search_result->path = g_strdup ((const gchar *) sqlite3_column_text (search_stmt, 2));
+        search_result->position = (guint) sqlite3_column_int (search_stmt, 3);
+        g_ptr_array_add (results, search_result);
+    }
+
+    if (result != SQLITE_DONE) {
+        books_database_set_error (db, error);
+        g_ptr_array_unref (results);
+        results = NULL;
+    }
+
+    sqlite3_finalize (search_stmt);
+    return results;
+}
+
+static void
+on_search_done (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    GTask *task;
+    GPtrArray *results;
+    GtkListStore *store;
+    GError *error = NULL;
+    guint i;
+
+    task = G_TASK (user_data);
+    results = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (results == NULL) {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
+
+    store = gtk_list_store_new (BOOKS_SEARCH_RESULT_N_COLUMNS,
+                                G_TYPE_STRING,
+                                G_TYPE_STRING,
+                                G_TYPE_STRING,
+                                G_TYPE_UINT);
+
+    for (i = 0; i < results->len; i++) {
+        SearchResult *search_result;
+        GtkTreeIter iter;
+
+        search_result = g_ptr_array_index (results, i);
+        gtk_list_store_append (store, &iter);
+        gtk_list_store_set (store, &iter,
+                            BOOKS_SEARCH_RESULT_MARKUP_COLUMN, search_result->markup,
+                            BOOKS_SEARCH_RESULT_SNIPPET_COLUMN, search_result->snippet,
+                            BOOKS_SEARCH_RESULT_PATH_COLUMN, search_result->path,
+                            BOOKS_SEARCH_RESULT_POSITION_COLUMN, search_result->position,
+                            -1);
+    }
+
+    g_ptr_array_unref (results);
+    g_task_return_pointer (task, store, g_object_unref);
+    g_object_unref (task);
+}
+
+/*
+ * Searches the full-text index on the database thread. Finish with
+ * books_collection_search_finish to get a list model with the
+ * BOOKS_SEARCH_RESULT columns, best matches first.
+ */
+void
+books_collection_search_async (BooksCollection *collection,
+                               const gchar *query,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
+{
+    GTask *task;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && query != NULL);
+
+    task = g_task_new (collection, cancellable, callback, user_data);
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) search_contents,
+                              get_match_expression (query), g_free,
+                              cancellable, on_search_done, task);
+}
+
+GtkTreeModel *
+books_collection_search_finish (BooksCollection *collection,
+                                GAsyncResult *result,
+                                GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, collection), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static GdkPixbuf *
+load_cover_from_data (GBytes *data,
+                      GError **error)
+{
+    return books_thumbnail_decode (data, 64, error);
+}
+
+/* Thumbnails are stored as JPEG unless the cover is transparent */
+static GBytes *
+save_thumbnail (GdkPixbuf *pixbuf,
+                GError **error)
+{
+    gchar *buffer;
+    gsize size;
+    gboolean success;
+
+    if (gdk_pixbuf_get_has_alpha (pixbuf))
+        success = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "png", error, NULL);
+    else
+        success = gdk_pixbuf_save_to_buffer (pixbuf, &buffer, &size, "jpeg", error, "quality", "90", NULL);
+
+    return success ? g_bytes_new_take (buffer, size) : NULL;
+}
+
+/*
+ * Creates the thumbnail of a book that was added before thumbnails were
+ * stored. Reading the archive also yields its fingerprint.
+ */
+static gboolean
+create_item_thumbnail (BooksCollectionItem *item,
+                       GError **error)
+{
+    BooksArchive *archive;
+    GBytes *data;
+    GdkPixbuf *pixbuf;
+    const gchar *cover;
+    gchar *legacy_path;
+    gchar *legacy_prefix;
+    gchar *basename;
+
+    /*
+     * Older versions stored the cover as a file in the extraction cache,
+     * strip that to get the archive entry name.
+     */
+    cover = item->cover;
+    basename = g_path_get_basename (item->path);
+    legacy_path = g_build_filename (g_get_user_cache_dir (), "books", basename, NULL);
+    legacy_prefix = g_strconcat (legacy_path, G_DIR_SEPARATOR_S, NULL);
+
+    if (g_str_has_prefix (cover, legacy_prefix))
+        cover += strlen (legacy_prefix);
+
+    g_free (legacy_prefix);
+    g_free (legacy_path);
+    g_free (basename);
+
+    archive = books_archive_new ();
+
+    if (!books_archive_open (archive, item->path, error)) {
+        g_object_unref (archive);
+        return FALSE;
+    }
+
+    g_free (item->fingerprint);
+    item->fingerprint = g_strdup (books_archive_get_fingerprint (archive));
+    data = books_archive_read_entry (archive, cover, error);
+    g_object_unref (archive);
+
+    if (data == NULL)
+        return FALSE;
+
+    pixbuf = load_cover_from_data (data, error);
+    g_bytes_unref (data);
+
+    if (pixbuf == NULL)
+        return FALSE;
+
+    item->thumbnail = save_thumbnail (pixbuf, error);
+    g_object_unref (pixbuf);
+    return item->thumbnail != NULL;
+}
+
+static gchar *
+get_author_title_markup (const gchar *author,
+                         const gchar *title)
+{
+    return g_markup_printf_escaped ("%s &#8212; <i>%s</i>", author, title);
+}
+
+static gint
+get_db_version (sqlite3 *db)
+{
+    sqlite3_stmt *stmt = NULL;
+    gint version = 0;
+
+    sqlite3_prepare_v2 (db, "PRAGMA user_version", -1, &stmt, NULL);
+
+    if (sqlite3_step (stmt) == SQLITE_ROW)
+        version = sqlite3_column_int (stmt, 0);
+
+    sqlite3_finalize (stmt);
+    return version;
+}
+
+/*
+ * Brings older databases up to date. Each step is applied once and bumps
+ * user_version so that it is skipped on the next start.
+ */
+static void
+migrate_db (sqlite3 *db)
+{
+    GError *error = NULL;
+
+    if (get_db_version (db) < 1) {
+        /* Existing books are queued for the indexer, starting at the first document */
+        if (!books_database_exec (db,
+                                  "BEGIN;"
+                                  "ALTER TABLE books ADD COLUMN index_status INTEGER NOT NULL DEFAULT 0;"
+                                  "ALTER TABLE books ADD COLUMN index_position INTEGER NOT NULL DEFAULT 0;"
+                                  "PRAGMA user_version = 1;"
+                                  "COMMIT",
+                                  &error)) {
+            g_warning (_("Could not update database: %s\n"), error->message);
+            g_clear_error (&error);
+            books_database_exec (db, "ROLLBACK", NULL);
+        }
+    }
+
+    if (get_db_version (db) < 2) {
+        /* Serialized BooksEpub states, found through the fingerprint of a book */
+        if (!books_database_exec (db,
+                                  "BEGIN;"
+                                  "ALTER TABLE books ADD COLUMN fingerprint TEXT;"
+                                  "CREATE TABLE state (fingerprint TEXT PRIMARY KEY, data BLOB);"
+                                  "PRAGMA user_version = 2;"
+                                  "COMMIT",
+                                  &error)) {
+            g_warning (_("Could not update database: %s\n"), error->message);
+            g_clear_error (&error);
+            books_database_exec (db, "ROLLBACK", NULL);
+        }
+    }
+
+    if (get_db_version (db) < 3) {
+        /* Pre-scaled covers, decoded once on import instead of on every start */
+        if (!books_database_exec (db,
+                                  "BEGIN;"
+                                  "CREATE TABLE thumbnails (fingerprint TEXT PRIMARY KEY, data BLOB);"
+                                  "PRAGMA user_version = 3;"
+                                  "COMMIT",
+                                  &error)) {
+            g_warning (_("Could not update database: %s\n"), error->message);
+            g_clear_error (&error);
+            books_database_exec (db, "ROLLBACK", NULL);
+        }
+    }
+
+    if (get_db_version (db) < 4) {
+        /* Indexed text is keyed by book instead of path, so all books are indexed again */
+        if (!books_database_exec (db,
+                                  "BEGIN;"
+                                  "DROP TABLE IF EXISTS contents;"
+                                  "UPDATE books SET index_status = 0, index_position = 0;"
+                                  "PRAGMA user_version = 4;"
+                                  "COMMIT",
+                                  &error)) {
+            g_warning (_("Could not update database: %s\n"), error->message);
+            g_clear_error (&error);
+            books_database_exec (db, "ROLLBACK", NULL);
+        }
+    }
+
+    if (get_db_version (db) < 5) {
+        /*
+         * Books get an explicit id that indexed text and the collection refer
+         * to, implicit rowids may be renumbered by VACUUM. Ids are taken over
+         * from the rowids, so that the indexed text stays valid.
+         */
+        if (!books_database_exec (db,
+                                  "BEGIN;"
+                                  "CREATE TABLE books_new (id INTEGER PRIMARY KEY, author TEXT, title TEXT, "
+                                  "path TEXT, cover TEXT, index_status INTEGER NOT NULL DEFAULT 0, "
+                                  "index_position INTEGER NOT NULL DEFAULT 0, fingerprint TEXT);"
+                                  "INSERT INTO books_new (id, author, title, path, cover, index_status, "
+                                  "index_position, fingerprint) SELECT rowid, author, title, path, cover, "
+                                  "index_status, index_position, fingerprint FROM books;"
+                                  "DROP TABLE books;"
+                                  "ALTER TABLE books_new RENAME TO books;"
+                                  "PRAGMA user_version = 5;"
+                                  "COMMIT",
+                                  &error)) {
+            g_warning (_("Could not update database: %s\n"), error->message);
+            g_clear_error (&error);
+            books_database_exec (db, "ROLLBACK", NULL);
+        }
+    }
+}
+
+static gpointer
+setup_db (sqlite3 *db,
+          gpointer data,
+          GError **error)
+{
+    gchar *db_error;
+
+    if (sqlite3_exec (db,
+                      "CREATE TABLE IF NOT EXISTS books (author TEXT, title TEXT, path TEXT, cover TEXT)",
+                      NULL, NULL, &db_error)) {
+        g_warning (_("Could not create table: %s\n"), db_error);
+        sqlite3_free (db_error);
+    }
+
+    /* Lets the background indexer write while the collection reads */
+    sqlite3_exec (db, "PRAGMA journal_mode=WAL", NULL, NULL, NULL);
+
+    migrate_db (db);
+
+    /*
+     * Indexes keep looking up books by path and identical copies of a book
+     * by fingerprint cheap.
+     *
+     * Text of each spine document for full-text search. Its rowid is the
+     * id of the book shifted left by 20 bits plus the spine position, so
+     * that the text of a book is found through a rowid range, which FTS5
+     * looks up directly, while unindexed columns would be scanned.
+     */
+    if (sqlite3_exec (db,
+                      "CREATE INDEX IF NOT EXISTS books_path ON books (path);"
+                      "CREATE INDEX IF NOT EXISTS books_fingerprint ON books (fingerprint);"
+                      "CREATE VIRTUAL TABLE IF NOT EXISTS contents USING fts5 "
+                      "(text, tokenize = 'unicode61 remove_diacritics 1')",
+                      NULL, NULL, &db_error)) {
+        g_warning (_("Could not create full-text index: %s\n"), db_error);
+        sqlite3_free (db_error);
+    }
+
+    return NULL;
+}
+
+static void
+create_db (BooksCollectionPrivate *priv)
+{
+    gchar *config_path;
+    gchar *db_path;
+    GError *error = NULL;
+
+    /* Make sure the path exists */
+    config_path = g_build_path (G_DIR_SEPARATOR_S, g_get_user_data_dir(), "books", NULL);
+
+    if (!g_file_test (config_path, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
+        g_mkdir (config_path, 0700);
+
+    db_path = g_build_filename (config_path, "meta.db", NULL);
+    priv->database = books_database_new (db_path);
+
+    /* Nothing else may use the database before its schema is up to date */
+    books_database_run (priv->database, setup_db, NULL, &error);
+
+    if (error != NULL) {
+        g_warning ("%s\n", error->message);
+        g_error_free (error);
+    }
+
+    g_free (db_path);
+    g_free (config_path);
+}
+
+typedef struct {
+    GThreadPool *pool;
+    GPtrArray   *missing;
+    GMutex       lock;
+    gint         n_running;
+} MissingData;
+
+static void
+missing_data_free (MissingData *data)
+{
+    /* All jobs have been processed at this point, so this does not block */
+    if (data->pool != NULL)
+        g_thread_pool_free (data->pool, TRUE, TRUE);
+
+    g_ptr_array_unref (data->missing);
+    g_mutex_clear (&data->lock);
+    g_free (data);
+}
+
+static int
+append_path (gpointer user_data,
+             gint argc,
+             gchar **argv,
+             gchar **column)
+{
+    g_ptr_array_add ((GPtrArray *) user_data, g_strdup (argv[0]));
+    return 0;
+}
+
+static gpointer
+select_paths (sqlite3 *db,
+              gpointer data,
+              GError **error)
+{
+    GPtrArray *paths;
+    gchar *db_error;
+
+    paths = g_ptr_array_new_with_free_func (g_free);
+
+    if (sqlite3_exec (db, "SELECT path FROM books", append_path, paths, &db_error)) {
+        g_set_error (error, BOOKS_DATABASE_ERROR, BOOKS_DATABASE_ERROR_QUERY,
+                     "%s", db_error);
+        sqlite3_free (db_error);
+        g_ptr_array_unref (paths);
+        return NULL;
+    }
+
+    return paths;
+}
+
+static void
+on_missing_books_deleted (GObject *source,
+                          GAsyncResult *result,
+                          gpointer user_data)
+{
+    BooksCollection *collection;
+    MissingData *data;
+    GTask *task;
+    GArray *ids;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    collection = BOOKS_COLLECTION (g_task_get_source_object (task));
+    data = g_task_get_task_data (task);
+    ids = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (ids == NULL) {
+        g_task_return_error (task, error);
+    }
+    else {
+        books_collection_model_remove_ids (collection->priv->model, ids);
+        g_array_unref (ids);
+        g_task_return_pointer (task, g_ptr_array_ref (data->missing), (GDestroyNotify) g_ptr_array_unref);
+    }
+
+    g_object_unref (task);
+}
+
+static gboolean
+finish_missing_check (GTask *task)
+{
+    BooksCollection *collection;
+    MissingData *data;
+
+    collection = BOOKS_COLLECTION (g_task_get_source_object (task));
+    data = g_task_get_task_data (task);
+
+    if (g_task_return_error_if_cancelled (task))
+        return G_SOURCE_REMOVE;
+
+    if (data->missing->len == 0) {
+        g_task_return_pointer (task, g_ptr_array_ref (data->missing), (GDestroyNotify) g_ptr_array_unref);
+        return G_SOURCE_REMOVE;
+    }
+
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) delete_files,
+                              g_ptr_array_ref (data->missing), (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_missing_books_deleted, g_object_ref (task));
+
+    return G_SOURCE_REMOVE;
+}
+
+/* Runs on the pool, the last job hands the task back to the main thread */
+static void
+check_paths (GPtrArray *paths,
+             GTask *task)
+{
+    MissingData *data;
+    guint i;
+
+    data = g_task_get_task_data (task);
+
+    for (i = 0; i < paths->len; i++) {
+        const gchar *path;
+
+        if (g_cancellable_is_cancelled (g_task_get_cancellable (task)))
+            break;
+
+        path = g_ptr_array_index (paths, i);
+
+        if (!g_file_test (path, G_FILE_TEST_EXISTS)) {
+            g_mutex_lock (&data->lock);
+            g_ptr_array_add (data->missing, g_strdup (path));
+            g_mutex_unlock (&data->lock);
+        }
+    }
+
+    g_ptr_array_unref (paths);
+
+    /* Hands over the reference that kept the task alive while the jobs ran */
+    if (g_atomic_int_dec_and_test (&data->n_running)) {
+        g_main_context_invoke_full (g_task_get_context (task), G_PRIORITY_DEFAULT,
+                                    (GSourceFunc) finish_missing_check,
+                                    task, g_object_unref);
+    }
+}
+
+static void
+on_paths_selected (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    GTask *task;
+    MissingData *data;
+    GPtrArray *paths;
+    GError *error = NULL;
+    guint i;
 
-enum {
-    PROP_0,
-    PROP_FILTER_TERM
-};
+    task = G_TASK (user_data);
+    data = g_task_get_task_data (task);
+    paths = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
 
-struct _BooksCollectionPrivate {
-    GtkListStore    *store;
-    GtkTreeModel    *sorted;
-    GtkTreeModel    *filtered;
-    sqlite3         *db;
-    gchar           *filter_term;
-    GdkPixbuf       *placeholder;
-};
+    if (paths == NULL) {
+        g_task_return_error (task, error);
+        g_object_unref (task);
+        return;
+    }
 
-BooksCollection *
-books_collection_new (void)
+    if (paths->len == 0) {
+        finish_missing_check (task);
+        g_ptr_array_unref (paths);
+        g_object_unref (task);
+        return;
+    }
+
+    /*
+     * Slow disks answer several requests at once faster than one after
+     * another. The pool is bounded and separate from the one of GTask, so
+     * that opening a book does not wait for the whole check.
+     */
+    data->pool = g_thread_pool_new ((GFunc) check_paths, task, CHECK_THREADS, FALSE, NULL);
+    data->n_running = (paths->len + CHECK_CHUNK_SIZE - 1) / CHECK_CHUNK_SIZE;
+
+    for (i = 0; i < paths->len; i += CHECK_CHUNK_SIZE) {
+        GPtrArray *chunk;
+        guint j;
+
+        chunk = g_ptr_array_new_with_free_func (g_free);
+
+        for (j = i; j < MIN (i + CHECK_CHUNK_SIZE, paths->len); j++)
+            g_ptr_array_add (chunk, g_strdup (g_ptr_array_index (paths, j)));
+
+        g_thread_pool_push (data->pool, chunk, NULL);
+    }
+
+    g_ptr_array_unref (paths);
+}
+
+/*
+ * Removes books whose files do not exist anymore. The files are checked on
+ * several threads and the books are removed in one transaction. Finish
+ * with books_collection_remove_missing_books_finish.
+ */
+void
+books_collection_remove_missing_books_async (BooksCollection *collection,
+                                             GCancellable *cancellable,
+                                             GAsyncReadyCallback callback,
+                                             gpointer user_data)
 {
-    return BOOKS_COLLECTION (g_object_new (BOOKS_TYPE_COLLECTION, NULL));
+    GTask *task;
+    MissingData *data;
+
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection));
+
+    task = g_task_new (collection, cancellable, callback, user_data);
+    data = g_new0 (MissingData, 1);
+    data->missing = g_ptr_array_new_with_free_func (g_free);
+    g_mutex_init (&data->lock);
+    g_task_set_task_data (task, data, (GDestroyNotify) missing_data_free);
+
+    books_database_run_async (collection->priv->database, select_paths, NULL, NULL,
+                              cancellable, on_paths_selected, task);
 }
 
-GtkTreeModel *
-books_collection_get_model (BooksCollection *collection)
+/*
+ * Returns the paths of the removed books, release them with
+ * g_ptr_array_unref.
+ */
+GPtrArray *
+books_collection_remove_missing_books_finish (BooksCollection *collection,
+                                              GAsyncResult *result,
+                                              GError **error)
 {
-    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection), NULL);
-    return collection->priv->sorted;
+    g_return_val_if_fail (g_task_is_valid (result, collection), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
 }
 
-void
-books_collection_add_book (BooksCollection *collection,
-                           BooksEpub *epub,
-                           const gchar *path)
+static gchar *
+column_dup_text (sqlite3_stmt *stmt,
+                 gint column)
 {
-    BooksCollectionPrivate *priv;
-    GtkTreeIter iter;
-    gchar *markup;
-    const gchar *author;
-    const gchar *title;
-    const gchar *cover;
-    const gchar *empty = "";
-    const gchar *insert_sql = "INSERT INTO books (author, title, path, cover) VALUES (?, ?, ?, ?)";
-    sqlite3_stmt *insert_stmt = NULL;
+    return g_strdup ((const gchar *) sqlite3_column_text (stmt, column));
+}
 
-    g_return_if_fail (BOOKS_IS_COLLECTION (collection));
+typedef struct {
+    gint64   after;
+    guint    limit;
+} LoadChunk;
+
+/*
+ * Returns the next @chunk of books in the order they were added, with their
+ * search keys computed here rather than on the main thread.
+ */
+static gpointer
+select_entries (sqlite3 *db,
+                LoadChunk *chunk,
+                GError **error)
+{
+    GArray *entries;
+    sqlite3_stmt *stmt = NULL;
+    const gchar *sql = "SELECT id, author, title FROM books WHERE id > ? ORDER BY id LIMIT ?";
+    gint result;
+
+    if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        books_database_set_error (db, error);
+        return NULL;
+    }
 
-    priv = collection->priv;
-    author = books_epub_get_meta (epub, "creator");
-    title = books_epub_get_meta (epub, "title");
-    cover = books_epub_get_cover (epub);
-    markup = get_author_title_markup (author, title);
+    sqlite3_bind_int64 (stmt, 1, chunk->after);
+    sqlite3_bind_int (stmt, 2, (int) chunk->limit);
+    entries = books_collection_model_entries_new ();
 
-    if (author == NULL)
-        author = g_strdup ("n/a");
+    while ((result = sqlite3_step (stmt)) == SQLITE_ROW) {
+        BooksCollectionModelEntry entry;
 
-    gtk_list_store_append (priv->store, &iter);
-    gtk_list_store_set (priv->store, &iter,
-                        BOOKS_COLLECTION_AUTHOR_COLUMN, author,
-                        BOOKS_COLLECTION_TITLE_COLUMN, title,
-                        BOOKS_COLLECTION_PATH_COLUMN, path,
-                        BOOKS_COLLECTION_MARKUP_COLUMN, markup,
-                        -1);
+        entry.id = sqlite3_column_int64 (stmt, 0);
+        entry.key = books_collection_model_get_search_key ((const gchar *) sqlite3_column_text (stmt, 1),
+                                                           (const gchar *) sqlite3_column_text (stmt, 2));
+        g_array_append_val (entries, entry);
+    }
 
-    set_pixbuf_column_from_file (priv, &iter, cover);
+    if (result != SQLITE_DONE) {
+        books_database_set_error (db, error);
+        g_array_unref (entries);
+        entries = NULL;
+    }
 
-    sqlite3_prepare_v2 (priv->db, insert_sql, -1, &insert_stmt, NULL);
-    sqlite3_bind_text (insert_stmt, 1, author, strlen (author), NULL);
-    sqlite3_bind_text (insert_stmt, 2, title, strlen (title), NULL);
-    sqlite3_bind_text (insert_stmt, 3, path, strlen (path), NULL);
+    sqlite3_finalize (stmt);
+    return entries;
+}
 
-    if (cover != NULL)
-        sqlite3_bind_text (insert_stmt, 4, cover, strlen (cover), NULL);
-    else
-        sqlite3_bind_text (insert_stmt, 4, empty, strlen (empty), NULL);
+static void
+on_books_selected (GObject *source,
+                   GAsyncResult *result,
+                   gpointer user_data)
+{
+    BooksCollection *collection;
+    LoadChunk *chunk;
+    GArray *entries;
+    GError *error = NULL;
 
-    sqlite3_step (insert_stmt);
-    sqlite3_finalize (insert_stmt);
-    g_free (markup);
+    collection = BOOKS_COLLECTION (user_data);
+    chunk = g_task_get_task_data (G_TASK (result));
+    entries = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (entries == NULL) {
+        g_warning (_("Could not select data: %s\n"), error->message);
+        g_error_free (error);
+        g_object_unref (collection);
+        return;
+    }
+
+    books_collection_model_add (collection->priv->model, entries);
+
+    /* The main loop gets to draw and handle input while the next chunk is read */
+    if (entries->len == chunk->limit)
+        load_chunk (collection, g_array_index (entries, BooksCollectionModelEntry, entries->len - 1).id,
+                    LOAD_CHUNK_SIZE);
+
+    g_array_unref (entries);
+    g_object_unref (collection);
 }
 
-void
-books_collection_remove_book (BooksCollection *collection,
-                              GtkTreeIter *iter)
+static void
+load_chunk (BooksCollection *collection,
+            gint64 after,
+            guint limit)
 {
-    BooksCollectionPrivate *priv;
-    GtkTreeIter filtered_iter;
-    GtkTreeIter real_iter;
-    gchar *path;
-    const gchar *remove_sql = "DELETE FROM books WHERE path=?";
-    sqlite3_stmt *remove_stmt = NULL;
+    LoadChunk *chunk;
 
-    g_return_if_fail (BOOKS_IS_COLLECTION (collection));
-    priv = collection->priv;
+    chunk = g_new0 (LoadChunk, 1);
+    chunk->after = after;
+    chunk->limit = limit;
 
-    gtk_tree_model_get (priv->sorted, iter, BOOKS_COLLECTION_PATH_COLUMN, &path, -1);
-    gtk_tree_model_sort_convert_iter_to_child_iter (GTK_TREE_MODEL_SORT (priv->sorted), &filtered_iter, iter);
-    gtk_tree_model_filter_convert_iter_to_child_iter (GTK_TREE_MODEL_FILTER (priv->filtered), &real_iter, &filtered_iter);
-    gtk_list_store_remove (priv->store, &real_iter);
-    gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (priv->filtered));
+    books_database_run_async (collection->priv->database, (BooksDatabaseFunc) select_entries,
+                              chunk, g_free, NULL, on_books_selected, g_object_ref (collection));
+}
 
-    /*
-     * TODO: sqlite operations are noticeable. We should execute them
-     * asynchronously.
-     */
-    sqlite3_prepare_v2 (priv->db, remove_sql, -1, &remove_stmt, NULL);
-    sqlite3_bind_text (remove_stmt, 1, path, strlen (path), NULL);
-    sqlite3_step (remove_stmt);
-    sqlite3_finalize (remove_stmt);
+/* Books added before thumbnails were stored in meta.db */
+static gpointer
+select_books_without_thumbnail (sqlite3 *db,
+                                gpointer data,
+                                GError **error)
+{
+    GPtrArray *items;
+    sqlite3_stmt *stmt = NULL;
+    const gchar *sql =
+        "SELECT books.path, books.cover FROM books "
+        "LEFT JOIN thumbnails ON thumbnails.fingerprint = books.fingerprint "
+        "WHERE thumbnails.fingerprint IS NULL";
+    gint result;
+
+    if (sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL) != SQLITE_OK) {
+        books_database_set_error (db, error);
+        return NULL;
+    }
+
+    items = g_ptr_array_new_with_free_func ((GDestroyNotify) books_collection_item_free);
+
+    while ((result = sqlite3_step (stmt)) == SQLITE_ROW) {
+        BooksCollectionItem *item;
+
+        item = g_new0 (BooksCollectionItem, 1);
+        item->path = column_dup_text (stmt, 0);
+        item->cover = column_dup_text (stmt, 1);
+        g_ptr_array_add (items, item);
+    }
+
+    if (result != SQLITE_DONE) {
+        books_database_set_error (db, error);
+        g_ptr_array_unref (items);
+        items = NULL;
+    }
 
-    g_free (path);
+    sqlite3_finalize (stmt);
+    return items;
 }
 
-BooksEpub *
-books_collection_get_book (BooksCollection *collection,
-                           GtkTreePath *path,
-                           GError **error)
+static gpointer
+update_thumbnails (sqlite3 *db,
+                   GPtrArray *items,
+                   GError **error)
 {
-    BooksCollectionPrivate *priv;
-    GtkTreePath *filtered_path;
-    GtkTreePath *real_path;
-    GtkTreeIter iter;
+    sqlite3_stmt *update_stmt = NULL;
+    sqlite3_stmt *thumbnail_stmt = NULL;
+    const gchar *update_sql = "UPDATE books SET fingerprint=? WHERE path=?";
+    const gchar *thumbnail_sql = "INSERT OR REPLACE INTO thumbnails (fingerprint, data) VALUES (?, ?)";
+    gboolean success = TRUE;
+    guint i;
 
-    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection), NULL);
+    if (!books_database_exec (db, "BEGIN", error))
+        return NULL;
 
-    priv = collection->priv;
-    filtered_path = gtk_tree_model_sort_convert_path_to_child_path (GTK_TREE_MODEL_SORT (priv->sorted),
-                                                                    path);
+    sqlite3_prepare_v2 (db, update_sql, -1, &update_stmt, NULL);
+    sqlite3_prepare_v2 (db, thumbnail_sql, -1, &thumbnail_stmt, NULL);
 
-    real_path = gtk_tree_model_filter_convert_path_to_child_path (GTK_TREE_MODEL_FILTER (priv->filtered),
-                                                                  filtered_path);
+    for (i = 0; i < items->len && success; i++) {
+        BooksCollectionItem *item;
 
-    if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->store), &iter, real_path)) {
-        BooksEpub *epub;
-        gchar *filename;
+        item = g_ptr_array_index (items, i);
 
-        gtk_tree_model_get (GTK_TREE_MODEL (priv->store), &iter, BOOKS_COLLECTION_PATH_COLUMN, &filename, -1);
-        epub = books_epub_new ();
+        /* The archive could not be opened, try again next time */
+        if (item->fingerprint == NULL)
+            continue;
 
-        if (books_epub_open (epub, filename, error))
-            return epub;
-        else
-            g_object_unref (epub);
+        sqlite3_bind_text (update_stmt, 1, item->fingerprint, strlen (item->fingerprint), NULL);
+        sqlite3_bind_text (update_stmt, 2, item->path, strlen (item->path), NULL);
 
-        g_free (filename);
+        success = sqlite3_step (update_stmt) == SQLITE_DONE &&
+                  insert_thumbnail (thumbnail_stmt, item);
+
+        sqlite3_reset (update_stmt);
+    }
+
+    if (success) {
+        books_database_exec (db, "COMMIT", error);
+    }
+    else {
+        books_database_set_error (db, error);
+        books_database_exec (db, "ROLLBACK", NULL);
     }
 
+    sqlite3_finalize (update_stmt);
+    sqlite3_finalize (thumbnail_stmt);
     return NULL;
 }
 
 static void
-set_pixbuf_column_from_file (BooksCollectionPrivate *priv,
-                             GtkTreeIter *iter,
-                             const gchar *cover)
+create_thumbnails_in_thread (GTask *task,
+                             gpointer source_object,
+                             GPtrArray *items,
+                             GCancellable *cancellable)
 {
-    GdkPixbuf *pixbuf = priv->placeholder;
+    guint i;
 
-    if (cover != NULL && strlen (cover) > 0) {
+    for (i = 0; i < items->len; i++) {
+        BooksCollectionItem *item;
         GError *error = NULL;
 
-        pixbuf = gdk_pixbuf_new_from_file_at_size (cover, 64, -1, &error);
+        item = g_ptr_array_index (items, i);
 
-        if (error != NULL) {
+        if (item->cover != NULL && strlen (item->cover) > 0 && !create_item_thumbnail (item, &error)) {
             g_printerr (_("Could not load cover image: %s\n"), error->message);
-            pixbuf = priv->placeholder;
+            g_error_free (error);
+        }
+        else if (item->fingerprint == NULL) {
+            BooksArchive *archive;
+
+            /* Remember books without cover as well */
+            archive = books_archive_new ();
+
+            if (books_archive_open (archive, item->path, NULL))
+                item->fingerprint = g_strdup (books_archive_get_fingerprint (archive));
+
+            g_object_unref (archive);
         }
     }
 
-    gtk_list_store_set (priv->store, iter, BOOKS_COLLECTION_ICON_COLUMN, pixbuf, -1);
+    g_task_return_pointer (task, g_ptr_array_ref (items), (GDestroyNotify) g_ptr_array_unref);
 }
 
-static gchar *
-get_author_title_markup (const gchar *author,
-                         const gchar *title)
+static void
+on_thumbnails_created (GObject *source,
+                       GAsyncResult *result,
+                       gpointer user_data)
 {
-    return g_markup_printf_escaped ("%s &#8212; <i>%s</i>", author, title);
+    BooksCollectionPrivate *priv;
+    GPtrArray *items;
+    guint i;
+
+    priv = BOOKS_COLLECTION (source)->priv;
+    items = g_task_propagate_pointer (G_TASK (result), NULL);
+
+    /* Only rows in view show their cover right away */
+    for (i = 0; i < items->len; i++) {
+        BooksCollectionItem *item;
+        GtkTreeRowReference *reference;
+
+        item = g_ptr_array_index (items, i);
+        reference = g_hash_table_lookup (priv->covers, item->path);
+
+        if (reference == NULL)
+            reference = g_hash_table_lookup (priv->cover_requests, item->path);
+
+        if (reference != NULL && item->thumbnail != NULL) {
+            GdkPixbuf *pixbuf;
+
+            pixbuf = books_cover_cache_load (books_cover_cache_get_default (), item->thumbnail, NULL);
+
+            if (pixbuf != NULL) {
+                set_cover (priv, reference, pixbuf);
+                g_object_unref (pixbuf);
+            }
+        }
+    }
+
+    books_database_run_async (priv->database, (BooksDatabaseFunc) update_thumbnails,
+                              items, (GDestroyNotify) g_ptr_array_unref,
+                              NULL, on_database_changed, NULL);
 }
 
 static void
-create_db (BooksCollectionPrivate *priv)
+on_books_without_thumbnail_selected (GObject *source,
+                                     GAsyncResult *result,
+                                     gpointer user_data)
 {
-    gchar *config_path;
-    gchar *db_path;
-    gchar *db_error;
-
-    /* Make sure the path exists */
-    config_path = g_build_path (G_DIR_SEPARATOR_S, g_get_user_data_dir(), "books", NULL);
+    BooksCollection *collection;
+    GPtrArray *items;
+    GTask *task;
+    GError *error = NULL;
 
-    if (!g_file_test (config_path, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
-        g_mkdir (config_path, 0700);
+    collection = BOOKS_COLLECTION (user_data);
+    items = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
 
-    db_path = g_build_filename (config_path, "meta.db", NULL);
-    g_assert (sqlite3_open (db_path, &priv->db) == SQLITE_OK);
+    if (items == NULL) {
+        g_warning (_("Could not select data: %s\n"), error->message);
+        g_error_free (error);
+        g_object_unref (collection);
+        return;
+    }
 
-    if (sqlite3_exec (priv->db,
-                      "CREATE TABLE IF NOT EXISTS books (author TEXT, title TEXT, path TEXT, cover TEXT)",
-                      NULL, NULL, &db_error)) {
-        g_warning (_("Could not create table: %s\n"), db_error);
-        sqlite3_free (db_error);
+    if (items->len > 0) {
+        task = g_task_new (collection, NULL, on_thumbnails_created, NULL);
+        g_task_set_task_data (task, items, (GDestroyNotify) g_ptr_array_unref);
+        g_task_run_in_thread (task, (GTaskThreadFunc) create_thumbnails_in_thread);
+        g_object_unref (task);
+    }
+    else {
+        g_ptr_array_unref (items);
     }
 
-    g_free (db_path);
-    g_free (config_path);
+    g_object_unref (collection);
 }
 
-static int
-test_missing_book (gpointer user_data,
-                   gint argc,
-                   gchar **argv,
-                   gchar **column)
+/*
+ * Streams the books into the model chunk by chunk, so that the window is up
+ * with its first screen of books right away. Thumbnails that are still
+ * missing are created once in the background.
+ */
+static void
+load_books (BooksCollection *collection)
 {
-    GPtrArray *missing_books;
-    gchar *filename;
-    filename = argv[0];
-    missing_books = (GPtrArray *) user_data;
+    load_chunk (collection, 0, LOAD_FIRST_CHUNK_SIZE);
+
+    books_database_run_async (collection->priv->database, select_books_without_thumbnail, NULL, NULL,
+                              NULL, on_books_without_thumbnail_selected, g_object_ref (collection));
+}
 
-    if (!g_file_test (filename, G_FILE_TEST_EXISTS))
-        g_ptr_array_add (missing_books, g_strdup (filename));
+typedef struct {
+    GPtrArray       *paths;
+    GCancellable    *cancellable;
+} CoverRequest;
 
-    return 0;
+typedef struct {
+    gchar       *path;
+    GdkPixbuf   *pixbuf;
+} Cover;
+
+static void
+cover_request_free (CoverRequest *request)
+{
+    g_ptr_array_unref (request->paths);
+    g_object_unref (request->cancellable);
+    g_free (request);
 }
 
 static void
-remove_missing_books_from_db (BooksCollectionPrivate *priv)
+cover_free (Cover *cover)
 {
-    GPtrArray *missing_books;
-    guint i;
-    const gchar *delete_sql = "DELETE FROM books WHERE path=?";
-    sqlite3_stmt *delete_stmt = NULL;
+    g_free (cover->path);
+    g_object_unref (cover->pixbuf);
+    g_free (cover);
+}
 
-    missing_books = g_ptr_array_new_with_free_func ((GDestroyNotify) g_free);
-    sqlite3_exec (priv->db, "SELECT path FROM books", test_missing_book, missing_books, NULL);
+/*
+ * Runs on the database thread, rows scrolled out of view are skipped. Books
+ * with the same cover get the same pixbuf from the cover cache.
+ */
+static gpointer
+select_thumbnails (sqlite3 *db,
+                   CoverRequest *request,
+                   GError **error)
+{
+    GPtrArray *covers;
+    sqlite3_stmt *stmt = NULL;
+    const gchar *sql =
+        "SELECT thumbnails.data FROM books "
+        "JOIN thumbnails ON thumbnails.fingerprint = books.fingerprint "
+        "WHERE books.path=? AND thumbnails.data IS NOT NULL LIMIT 1";
+    guint i;
 
-    sqlite3_prepare_v2 (priv->db, delete_sql, -1, &delete_stmt, NULL);
+    covers = g_ptr_array_new_with_free_func ((GDestroyNotify) cover_free);
+    sqlite3_prepare_v2 (db, sql, -1, &stmt, NULL);
 
-    for (i = 0; i < missing_books->len; i++) {
-        gchar *filename;
+    for (i = 0; i < request->paths->len; i++) {
+        const gchar *path;
 
-        filename = (gchar *) g_ptr_array_index (missing_books, i);
-        sqlite3_bind_text (delete_stmt, 1, filename, strlen (filename), NULL);
-        sqlite3_step (delete_stmt);
-        sqlite3_reset (delete_stmt);
-    }
+        if (g_cancellable_is_cancelled (request->cancellable))
+            break;
 
-    sqlite3_finalize (delete_stmt);
+        path = g_ptr_array_index (request->paths, i);
+        sqlite3_bind_text (stmt, 1, path, strlen (path), NULL);
 
-    if (missing_books->len > 0) {
-       GtkDialog *dialog;
-       GtkListStore *model;
+        if (sqlite3_step (stmt) == SQLITE_ROW) {
+            GBytes *data;
+            GdkPixbuf *pixbuf;
 
-       model = gtk_list_store_new (1, G_TYPE_STRING);
+            data = g_bytes_new (sqlite3_column_blob (stmt, 0), sqlite3_column_bytes (stmt, 0));
+            pixbuf = books_cover_cache_load (books_cover_cache_get_default (), data, NULL);
+            g_bytes_unref (data);
 
-       for (i = 0; i < missing_books->len; i++) {
-           gchar *filename;
-           GtkTreeIter iter;
+            if (pixbuf != NULL) {
+                Cover *cover;
 
-           filename = (gchar *) g_ptr_array_index (missing_books, i);
-           gtk_list_store_append (model, &iter);
-           gtk_list_store_set (model, &iter, 0, filename, -1);
-       }
+                cover = g_new0 (Cover, 1);
+                cover->path = g_strdup (path);
+                cover->pixbuf = pixbuf;
+                g_ptr_array_add (covers, cover);
+            }
+        }
 
-       dialog = books_removed_dialog_new (GTK_TREE_MODEL (model));
-       gtk_dialog_run (dialog);
+        sqlite3_reset (stmt);
     }
 
-    g_ptr_array_free (missing_books, TRUE);
+    sqlite3_finalize (stmt);
+    return covers;
 }
 
-static int
-insert_row_into_model (gpointer user_data,
-                       gint argc,
-                       gchar **argv,
-                       gchar **column)
+static void
+set_cover (BooksCollectionPrivate *priv,
+           GtkTreeRowReference *reference,
+           GdkPixbuf *pixbuf)
 {
-    BooksCollectionPrivate *priv;
+    GtkTreePath *path;
     GtkTreeIter iter;
-    gchar *author;
-    gchar *title;
-    gchar *cover;
-    gchar *markup;
-
-    g_assert (argc == 4);
-    priv = (BooksCollectionPrivate *) user_data;
-    author = argv[0];
-    title = argv[1];
-    cover = argv[3];
-    markup = get_author_title_markup (author, title);
-
-    gtk_list_store_append (priv->store, &iter);
-    gtk_list_store_set (priv->store, &iter,
-                        BOOKS_COLLECTION_AUTHOR_COLUMN, author,
-                        BOOKS_COLLECTION_TITLE_COLUMN, title,
-                        BOOKS_COLLECTION_MARKUP_COLUMN, markup,
-                        BOOKS_COLLECTION_PATH_COLUMN, argv[2],
-                        -1);
-
-    set_pixbuf_column_from_file (priv, &iter, cover);
-    g_free (markup);
-    return 0;
+
+    path = gtk_tree_row_reference_get_path (reference);
+
+    if (path == NULL)
+        return;
+
+    if (gtk_tree_model_get_iter (GTK_TREE_MODEL (priv->model), &iter, path))
+        books_collection_model_set_cover (priv->model, &iter, pixbuf);
+
+    gtk_tree_path_free (path);
 }
 
 static void
-insert_books_from_db_into_model (BooksCollectionPrivate *priv)
+on_thumbnails_selected (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
 {
-    gchar *db_error;
+    BooksCollection *collection;
+    BooksCollectionPrivate *priv;
+    CoverRequest *request;
+    GPtrArray *covers;
+    GError *error = NULL;
+    guint i;
 
-    if (sqlite3_exec (priv->db, "SELECT author, title, path, cover FROM books",
-                      insert_row_into_model, priv, &db_error)) {
-        g_warning (_("Could not select data: %s\n"), db_error);
-        sqlite3_free (db_error);
+    collection = BOOKS_COLLECTION (user_data);
+    priv = collection->priv;
+    request = g_task_get_task_data (G_TASK (result));
+    covers = books_database_run_finish (BOOKS_DATABASE (source), result, &error);
+
+    if (covers == NULL) {
+        g_warning (_("Could not select data: %s\n"), error->message);
+        g_error_free (error);
+        g_object_unref (collection);
+        return;
+    }
+
+    /* The requested rows have been handed to a newer request */
+    if (g_cancellable_is_cancelled (request->cancellable)) {
+        g_ptr_array_unref (covers);
+        g_object_unref (collection);
+        return;
+    }
+
+    for (i = 0; i < covers->len; i++) {
+        Cover *cover;
+        GtkTreeRowReference *reference;
+
+        cover = g_ptr_array_index (covers, i);
+        reference = g_hash_table_lookup (priv->cover_requests, cover->path);
+
+        if (reference != NULL)
+            set_cover (priv, reference, cover->pixbuf);
+    }
+
+    /* Rows without a thumbnail keep the placeholder and are not asked for again */
+    for (i = 0; i < request->paths->len; i++) {
+        gchar *path;
+        GtkTreeRowReference *reference;
+
+        if (g_hash_table_lookup_extended (priv->cover_requests, g_ptr_array_index (request->paths, i),
+                                          (gpointer *) &path, (gpointer *) &reference)) {
+            g_hash_table_steal (priv->cover_requests, path);
+            g_hash_table_insert (priv->covers, path, reference);
+        }
     }
+
+    g_ptr_array_unref (covers);
+    g_object_unref (collection);
 }
 
-static gboolean
-row_visible (GtkTreeModel *model,
-             GtkTreeIter *iter,
-             BooksCollectionPrivate *priv)
-{
-    gboolean visible;
-    gchar *lowered_author;
-    gchar *lowered_title;
-    gchar *lowered_term;
-    gchar *author;
-    gchar *title;
-
-    if (priv->filter_term == NULL)
-        return TRUE;
+/*
+ * Loads the thumbnails of the rows from @start to @end of the model returned
+ * by books_collection_get_model. All other rows fall back to the placeholder,
+ * so that only the covers around the visible part are kept in memory.
+ */
+void
+books_collection_load_covers (BooksCollection *collection,
+                              GtkTreePath *start,
+                              GtkTreePath *end)
+{
+    BooksCollectionPrivate *priv;
+    GHashTable *wanted;
+    GHashTableIter iter;
+    GPtrArray *paths;
+    gpointer key;
+    gpointer value;
+    gint first;
+    gint last;
+    gint i;
 
-    gtk_tree_model_get (model, iter,
-                        BOOKS_COLLECTION_AUTHOR_COLUMN, &author,
-                        BOOKS_COLLECTION_TITLE_COLUMN, &title,
-                        -1);
+    g_return_if_fail (BOOKS_IS_COLLECTION (collection) && start != NULL && end != NULL);
 
-    if (author == NULL || title == NULL)
-        return TRUE;
+    priv = collection->priv;
+    first = gtk_tree_path_get_indices (start)[0];
+    last = gtk_tree_path_get_indices (end)[0];
+
+    /* Path of each wanted row mapped to its reference in the model */
+    wanted = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                    (GDestroyNotify) gtk_tree_row_reference_free);
+
+    for (i = first; i <= last; i++) {
+        GtkTreeIter row_iter;
+        GtkTreePath *path;
+        gchar *filename;
+
+        if (!gtk_tree_model_iter_nth_child (GTK_TREE_MODEL (priv->model), &row_iter, NULL, i))
+            break;
+
+        gtk_tree_model_get (GTK_TREE_MODEL (priv->model), &row_iter,
+                            BOOKS_COLLECTION_PATH_COLUMN, &filename, -1);
+
+        path = gtk_tree_path_new_from_indices (i, -1);
+        g_hash_table_insert (wanted, filename,
+                             gtk_tree_row_reference_new (GTK_TREE_MODEL (priv->model), path));
+        gtk_tree_path_free (path);
+    }
+
+    /* Give up covers that are out of range */
+    g_hash_table_iter_init (&iter, priv->covers);
+
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (!g_hash_table_contains (wanted, key)) {
+            set_cover (priv, value, NULL);
+            g_hash_table_iter_remove (&iter);
+        }
+    }
+
+    /* Cancel pending requests once they contain rows that are not needed anymore */
+    g_hash_table_iter_init (&iter, priv->cover_requests);
+
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        if (!g_hash_table_contains (wanted, key)) {
+            g_cancellable_cancel (priv->cover_cancellable);
+            g_object_unref (priv->cover_cancellable);
+            priv->cover_cancellable = g_cancellable_new ();
+            g_hash_table_remove_all (priv->cover_requests);
+            break;
+        }
+    }
+
+    paths = g_ptr_array_new_with_free_func (g_free);
+    g_hash_table_iter_init (&iter, wanted);
+
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        GtkTreeRowReference *reference;
+
+        /* Entries of removed rows are left behind and asked for again */
+        reference = g_hash_table_lookup (priv->covers, key);
+
+        if (reference == NULL)
+            reference = g_hash_table_lookup (priv->cover_requests, key);
+
+        if (reference != NULL && gtk_tree_row_reference_valid (reference))
+            continue;
+
+        g_hash_table_remove (priv->covers, key);
+        g_hash_table_remove (priv->cover_requests, key);
+
+        g_hash_table_iter_steal (&iter);
+        g_hash_table_insert (priv->cover_requests, key, value);
+        g_ptr_array_add (paths, g_strdup (key));
+    }
+
+    g_hash_table_destroy (wanted);
+
+    if (paths->len > 0) {
+        CoverRequest *request;
 
-    lowered_term = g_utf8_strdown (priv->filter_term, -1);
-    lowered_author = g_utf8_strdown (author, -1);
-    lowered_title = g_utf8_strdown (title, -1);
+        request = g_new0 (CoverRequest, 1);
+        request->paths = paths;
+        request->cancellable = g_object_ref (priv->cover_cancellable);
 
-    visible = strstr (lowered_author, lowered_term) != NULL ||
-              strstr (lowered_title, lowered_term) != NULL;
+        books_database_run_async (priv->database, (BooksDatabaseFunc) select_thumbnails,
+                                  request, (GDestroyNotify) cover_request_free,
+                                  NULL, on_thumbnails_selected, g_object_ref (collection));
+    }
+    else {
+        g_ptr_array_unref (paths);
+    }
+}
+
+/*
+ * Row references do not follow a reset of the model, so covers are given
+ * up before and loaded again once the views have been attached again.
+ */
+static void
+on_model_begin_reset (BooksCollectionModel *model,
+                      BooksCollectionPrivate *priv)
+{
+    GHashTableIter iter;
+    gpointer value;
+
+    g_hash_table_iter_init (&iter, priv->covers);
+
+    while (g_hash_table_iter_next (&iter, NULL, &value))
+        set_cover (priv, value, NULL);
 
-    g_free (lowered_author);
-    g_free (lowered_title);
-    g_free (lowered_term);
-    g_free (author);
-    g_free (title);
+    g_hash_table_remove_all (priv->covers);
 
-    return visible;
+    g_cancellable_cancel (priv->cover_cancellable);
+    g_object_unref (priv->cover_cancellable);
+    priv->cover_cancellable = g_cancellable_new ();
+    g_hash_table_remove_all (priv->cover_requests);
+}
+
+static void
+on_filter_set (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+    BooksCollection *collection;
+
+    collection = BOOKS_COLLECTION (user_data);
+
+    /* Only the latest term is applied, earlier ones have been cancelled */
+    books_collection_model_set_filter_finish (BOOKS_COLLECTION_MODEL (source), result, NULL);
+
+    g_object_unref (collection);
 }
 
 static void
 books_collection_dispose (GObject *object)
 {
+    BooksCollectionPrivate *priv;
+
+    priv = BOOKS_COLLECTION_GET_PRIVATE (object);
+
+    if (priv->cover_cancellable != NULL) {
+        g_cancellable_cancel (priv->cover_cancellable);
+        g_object_unref (priv->cover_cancellable);
+        priv->cover_cancellable = NULL;
+    }
+
+    if (priv->model != NULL)
+        g_signal_handlers_disconnect_by_data (priv->model, priv);
+
+    g_clear_object (&priv->model);
+
+    if (priv->database != NULL) {
+        g_object_unref (priv->database);
+        priv->database = NULL;
+    }
+
     G_OBJECT_CLASS (books_collection_parent_class)->dispose (object);
 }
 
@@ -380,7 +2423,8 @@ books_collection_finalize (GObject *object)
 
     priv = BOOKS_COLLECTION_GET_PRIVATE (object);
     g_free (priv->filter_term);
-    sqlite3_close (priv->db);
+    g_hash_table_destroy (priv->covers);
+    g_hash_table_destroy (priv->cover_requests);
 
     G_OBJECT_CLASS (books_collection_parent_class)->finalize (object);
 }
@@ -401,7 +2445,8 @@ books_collection_set_property (GObject *object,
                 g_free (priv->filter_term);
 
             priv->filter_term = g_strdup (g_value_get_string (value));
-            gtk_tree_model_filter_refilter (GTK_TREE_MODEL_FILTER (priv->filtered));
+            books_collection_model_set_filter_async (priv->model, priv->filter_term,
+                                                     on_filter_set, g_object_ref (object));
             break;
 
         default:
@@ -462,6 +2507,12 @@ books_collection_init (BooksCollection *collection)
 
     collection->priv = priv = BOOKS_COLLECTION_GET_PRIVATE (collection);
     priv->filter_term = NULL;
+    priv->database = NULL;
+    priv->covers = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                          (GDestroyNotify) gtk_tree_row_reference_free);
+    priv->cover_requests = g_hash_table_new_full (g_str_hash, g_str_equal, g_free,
+                                                  (GDestroyNotify) gtk_tree_row_reference_free);
+    priv->cover_cancellable = g_cancellable_new ();
 
     /* Create pixbuf for unknown cover image */
     stream = g_resources_open_stream ("/com/github/matze/books/ui/book-cover.png", 0, &error);
@@ -480,24 +2531,15 @@ books_collection_init (BooksCollection *collection)
 
     g_input_stream_close (stream, NULL, NULL);
 
-    /* Create model */
-    priv->store = gtk_list_store_new (BOOKS_COLLECTION_N_COLUMNS,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      G_TYPE_STRING,
-                                      GDK_TYPE_PIXBUF);
-
-    priv->filtered = gtk_tree_model_filter_new (GTK_TREE_MODEL (priv->store), NULL);
+    /* Create database */
+    create_db (priv);
 
-    gtk_tree_model_filter_set_visible_func (GTK_TREE_MODEL_FILTER (priv->filtered),
-                                            (GtkTreeModelFilterVisibleFunc) row_visible,
-                                            priv, NULL);
+    /* Create model */
+    priv->model = books_collection_model_new (books_database_get_filename (priv->database),
+                                              priv->placeholder);
 
-    priv->sorted = gtk_tree_model_sort_new_with_model (priv->filtered);
+    g_signal_connect (priv->model, "begin-reset",
+                      G_CALLBACK (on_model_begin_reset), priv);
 
-    /* Create database */
-    create_db (priv);
-    remove_missing_books_from_db (priv);
-    insert_books_from_db_into_model (priv);
+    load_books (collection);
 }
@@ -28,6 +28,24 @@ struct _BooksCollectionClass {
     GObjectClass parent_class;
 };
 
+/* A book as it is stored in the collection */
+typedef struct {
+    gchar       *author;
+    gchar       *title;
+    gchar       *path;
+    gchar       *cover;
+    gchar       *fingerprint;
+    GBytes      *thumbnail;
+} BooksCollectionItem;
+
+enum {
+    BOOKS_SEARCH_RESULT_MARKUP_COLUMN,
+    BOOKS_SEARCH_RESULT_SNIPPET_COLUMN,
+    BOOKS_SEARCH_RESULT_PATH_COLUMN,
+    BOOKS_SEARCH_RESULT_POSITION_COLUMN,
+    BOOKS_SEARCH_RESULT_N_COLUMNS
+};
+
 enum {
     BOOKS_COLLECTION_AUTHOR_COLUMN,
     BOOKS_COLLECTION_TITLE_COLUMN,
@@ -37,17 +55,71 @@ enum {
     BOOKS_COLLECTION_N_COLUMNS
 };
 
-BooksCollection *books_collection_new           (void);
-GtkTreeModel    *books_collection_get_model     (BooksCollection    *collection);
-void             books_collection_add_book      (BooksCollection    *collection,
-                                                 BooksEpub          *epub,
-                                                 const gchar        *path);
-void             books_collection_remove_book   (BooksCollection    *collection,
-                                                 GtkTreeIter        *iter);
-BooksEpub       *books_collection_get_book      (BooksCollection    *collection,
-                                                 GtkTreePath        *path,
-                                                 GError            **error);
-GType            books_collection_get_type      (void);
+BooksCollection     *books_collection_new                         (void);
+GtkTreeModel        *books_collection_get_model                   (BooksCollection          *collection);
+void                 books_collection_add_items_async             (BooksCollection          *collection,
+                                                                   GPtrArray                *items,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+gboolean             books_collection_add_items_finish            (BooksCollection          *collection,
+                                                                   GAsyncResult             *result,
+                                                                   GError                  **error);
+void                 books_collection_filter_new_files_async      (BooksCollection          *collection,
+                                                                   GPtrArray                *paths,
+                                                                   GCancellable             *cancellable,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+GPtrArray           *books_collection_filter_new_files_finish     (BooksCollection          *collection,
+                                                                   GAsyncResult             *result,
+                                                                   GError                  **error);
+void                 books_collection_remove_book                 (BooksCollection          *collection,
+                                                                   GtkTreeIter              *iter);
+void                 books_collection_remove_files                (BooksCollection          *collection,
+                                                                   GPtrArray                *paths);
+void                 books_collection_remove_missing_books_async  (BooksCollection          *collection,
+                                                                   GCancellable             *cancellable,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+GPtrArray           *books_collection_remove_missing_books_finish (BooksCollection          *collection,
+                                                                   GAsyncResult             *result,
+                                                                   GError                  **error);
+void                 books_collection_rename_files                (BooksCollection          *collection,
+                                                                   GPtrArray                *renames);
+void                 books_collection_get_book_async              (BooksCollection          *collection,
+                                                                   GtkTreePath              *path,
+                                                                   GCancellable             *cancellable,
+                                                                   BooksEpubProgressCallback progress_callback,
+                                                                   gpointer                  progress_data,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+void                 books_collection_get_book_for_file_async     (BooksCollection          *collection,
+                                                                   const gchar              *filename,
+                                                                   GCancellable             *cancellable,
+                                                                   BooksEpubProgressCallback progress_callback,
+                                                                   gpointer                  progress_data,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+BooksEpub           *books_collection_get_book_finish             (BooksCollection          *collection,
+                                                                   GAsyncResult             *result,
+                                                                   GError                  **error);
+void                 books_collection_save_state                  (BooksCollection          *collection,
+                                                                   BooksEpub                *epub);
+void                 books_collection_load_covers                 (BooksCollection          *collection,
+                                                                   GtkTreePath              *start,
+                                                                   GtkTreePath              *end);
+const gchar         *books_collection_get_database_filename       (BooksCollection          *collection);
+void                 books_collection_search_async                (BooksCollection          *collection,
+                                                                   const gchar              *query,
+                                                                   GCancellable             *cancellable,
+                                                                   GAsyncReadyCallback       callback,
+                                                                   gpointer                  user_data);
+GtkTreeModel        *books_collection_search_finish               (BooksCollection          *collection,
+                                                                   GAsyncResult             *result,
+                                                                   GError                  **error);
+BooksCollectionItem *books_collection_item_new                    (BooksEpub                *epub,
+                                                                   const gchar              *path);
+void                 books_collection_item_free                   (BooksCollectionItem      *item);
+GType                books_collection_get_type                    (void);
 
 G_END_DECLS
 
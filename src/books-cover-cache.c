@@ -0,0 +1,257 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gio/gio.h>
+
+#include "books-cover-cache.h"
+
+
+G_DEFINE_TYPE(BooksCoverCache, books_cover_cache, G_TYPE_OBJECT)
+
+#define BOOKS_COVER_CACHE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_COVER_CACHE, BooksCoverCachePrivate))
+
+#define DEFAULT_BUDGET  (16 * 1024 * 1024)
+
+enum {
+    PROP_0,
+    PROP_BUDGET
+};
+
+typedef struct {
+    gchar      *key;
+    GdkPixbuf  *pixbuf;
+    gsize       size;
+    GList       link;
+} CacheEntry;
+
+/*
+ * Decoded cover thumbnails, keyed by a checksum of the encoded image so that
+ * books sharing the same cover share one pixbuf. Thumbnails are decoded on
+ * the database thread, hence the lock.
+ */
+struct _BooksCoverCachePrivate {
+    GMutex      lock;
+    GHashTable *entries;
+    GQueue      lru;
+    guint64     size;
+    guint64     budget;
+};
+
+static void evict (BooksCoverCachePrivate *priv);
+
+
+BooksCoverCache *
+books_cover_cache_get_default (void)
+{
+    static gsize cache = 0;
+
+    if (g_once_init_enter (&cache))
+        g_once_init_leave (&cache, (gsize) g_object_new (BOOKS_TYPE_COVER_CACHE, NULL));
+
+    return BOOKS_COVER_CACHE (cache);
+}
+
+static GdkPixbuf *
+lookup (BooksCoverCachePrivate *priv,
+        const gchar *key)
+{
+    CacheEntry *entry;
+    GdkPixbuf *pixbuf = NULL;
+
+    g_mutex_lock (&priv->lock);
+    entry = g_hash_table_lookup (priv->entries, key);
+
+    if (entry != NULL) {
+        g_queue_unlink (&priv->lru, &entry->link);
+        g_queue_push_head_link (&priv->lru, &entry->link);
+        pixbuf = g_object_ref (entry->pixbuf);
+    }
+
+    g_mutex_unlock (&priv->lock);
+    return pixbuf;
+}
+
+/* Returns the cached pixbuf if another thread decoded the same cover meanwhile */
+static GdkPixbuf *
+insert (BooksCoverCachePrivate *priv,
+        const gchar *key,
+        GdkPixbuf *pixbuf)
+{
+    CacheEntry *entry;
+
+    g_mutex_lock (&priv->lock);
+    entry = g_hash_table_lookup (priv->entries, key);
+
+    if (entry != NULL) {
+        pixbuf = g_object_ref (entry->pixbuf);
+        g_mutex_unlock (&priv->lock);
+        return pixbuf;
+    }
+
+    entry = g_new0 (CacheEntry, 1);
+    entry->key = g_strdup (key);
+    entry->pixbuf = g_object_ref (pixbuf);
+    entry->size = gdk_pixbuf_get_rowstride (pixbuf) * gdk_pixbuf_get_height (pixbuf);
+    entry->link.data = entry;
+
+    g_hash_table_insert (priv->entries, entry->key, entry);
+    g_queue_push_head_link (&priv->lru, &entry->link);
+    priv->size += entry->size;
+
+    evict (priv);
+    g_mutex_unlock (&priv->lock);
+    return g_object_ref (pixbuf);
+}
+
+/*
+ * Decodes the encoded thumbnail @data or returns the pixbuf of an identical
+ * thumbnail decoded before. Release the result with g_object_unref.
+ */
+GdkPixbuf *
+books_cover_cache_load (BooksCoverCache *cache,
+                        GBytes *data,
+                        GError **error)
+{
+    BooksCoverCachePrivate *priv;
+    GInputStream *stream;
+    GdkPixbuf *decoded;
+    GdkPixbuf *pixbuf;
+    gchar *key;
+
+    g_return_val_if_fail (BOOKS_IS_COVER_CACHE (cache) && data != NULL, NULL);
+
+    priv = cache->priv;
+    key = g_compute_checksum_for_bytes (G_CHECKSUM_SHA1, data);
+    pixbuf = lookup (priv, key);
+
+    if (pixbuf != NULL) {
+        g_free (key);
+        return pixbuf;
+    }
+
+    stream = g_memory_input_stream_new_from_bytes (data);
+    decoded = gdk_pixbuf_new_from_stream (stream, NULL, error);
+    g_object_unref (stream);
+
+    if (decoded != NULL) {
+        pixbuf = insert (priv, key, decoded);
+        g_object_unref (decoded);
+    }
+
+    g_free (key);
+    return pixbuf;
+}
+
+/* Rows in view keep their own reference, eviction only drops ours */
+static void
+evict (BooksCoverCachePrivate *priv)
+{
+    while (priv->size > priv->budget && priv->lru.tail != NULL) {
+        CacheEntry *entry;
+
+        entry = priv->lru.tail->data;
+        g_queue_unlink (&priv->lru, &entry->link);
+        priv->size -= entry->size;
+        g_hash_table_remove (priv->entries, entry->key);
+    }
+}
+
+static void
+free_entry (CacheEntry *entry)
+{
+    g_object_unref (entry->pixbuf);
+    g_free (entry->key);
+    g_free (entry);
+}
+
+static void
+books_cover_cache_finalize (GObject *object)
+{
+    BooksCoverCachePrivate *priv;
+
+    priv = BOOKS_COVER_CACHE_GET_PRIVATE (object);
+    g_hash_table_destroy (priv->entries);
+    g_mutex_clear (&priv->lock);
+
+    G_OBJECT_CLASS (books_cover_cache_parent_class)->finalize (object);
+}
+
+static void
+books_cover_cache_set_property (GObject *object,
+                                guint property_id,
+                                const GValue *value,
+                                GParamSpec *pspec)
+{
+    BooksCoverCachePrivate *priv;
+
+    priv = BOOKS_COVER_CACHE_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BUDGET:
+            g_mutex_lock (&priv->lock);
+            priv->budget = g_value_get_uint64 (value);
+            evict (priv);
+            g_mutex_unlock (&priv->lock);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+books_cover_cache_get_property (GObject *object,
+                                guint property_id,
+                                GValue *value,
+                                GParamSpec *pspec)
+{
+    BooksCoverCachePrivate *priv;
+
+    priv = BOOKS_COVER_CACHE_GET_PRIVATE (object);
+
+    switch (property_id) {
+        case PROP_BUDGET:
+            g_value_set_uint64 (value, priv->budget);
+            break;
+
+        default:
+            G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+            break;
+    }
+}
+
+static void
+books_cover_cache_class_init (BooksCoverCacheClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->set_property = books_cover_cache_set_property;
+    object_class->get_property = books_cover_cache_get_property;
+    object_class->finalize = books_cover_cache_finalize;
+
+    g_object_class_install_property (object_class,
+                                     PROP_BUDGET,
+                                     g_param_spec_uint64 ("budget",
+                                                          "Cache budget in bytes",
+                                                          "Cache budget in bytes",
+                                                          0, G_MAXUINT64, DEFAULT_BUDGET,
+                                                          G_PARAM_READWRITE));
+
+    g_type_class_add_private (klass, sizeof(BooksCoverCachePrivate));
+}
+
+static void
+books_cover_cache_init (BooksCoverCache *cache)
+{
+    BooksCoverCachePrivate *priv;
+
+    cache->priv = priv = BOOKS_COVER_CACHE_GET_PRIVATE (cache);
+
+    g_mutex_init (&priv->lock);
+    g_queue_init (&priv->lru);
+    priv->entries = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, (GDestroyNotify) free_entry);
+    priv->size = 0;
+    priv->budget = DEFAULT_BUDGET;
+}
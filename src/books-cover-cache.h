@@ -0,0 +1,38 @@
+#ifndef BOOKS_COVER_CACHE_H
+#define BOOKS_COVER_CACHE_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_COVER_CACHE             (books_cover_cache_get_type())
+#define BOOKS_COVER_CACHE(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_COVER_CACHE, BooksCoverCache))
+#define BOOKS_IS_COVER_CACHE(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_COVER_CACHE))
+#define BOOKS_COVER_CACHE_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_COVER_CACHE, BooksCoverCacheClass))
+#define BOOKS_IS_COVER_CACHE_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_COVER_CACHE))
+#define BOOKS_COVER_CACHE_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_COVER_CACHE, BooksCoverCacheClass))
+
+
+typedef struct _BooksCoverCache           BooksCoverCache;
+typedef struct _BooksCoverCacheClass      BooksCoverCacheClass;
+typedef struct _BooksCoverCachePrivate    BooksCoverCachePrivate;
+
+struct _BooksCoverCache {
+    GObject parent;
+
+    BooksCoverCachePrivate *priv;
+};
+
+struct _BooksCoverCacheClass {
+    GObjectClass parent_class;
+};
+
+BooksCoverCache * books_cover_cache_get_default (void);
+GdkPixbuf       * books_cover_cache_load        (BooksCoverCache   *cache,
+                                                 GBytes            *data,
+                                                 GError           **error);
+GType             books_cover_cache_get_type    (void);
+
+G_END_DECLS
+
+#endif
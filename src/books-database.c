@@ -0,0 +1,282 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib/gi18n.h>
+
+#include "books-database.h"
+
+
+G_DEFINE_TYPE(BooksDatabase, books_database, G_TYPE_OBJECT)
+
+#define BOOKS_DATABASE_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_DATABASE, BooksDatabasePrivate))
+
+/*
+ * Owns the connection to meta.db on a thread of its own. Commands are
+ * queued and executed one after another, so callers on the main thread
+ * never wait for the disk and never see a half-finished transaction.
+ */
+struct _BooksDatabasePrivate {
+    gchar          *filename;
+    GThread        *thread;
+    GAsyncQueue    *queue;
+    GMutex          lock;
+    GCond           cond;
+};
+
+typedef struct {
+    BooksDatabaseFunc    func;
+    GTask               *task;
+    gpointer             data;
+    gpointer             result;
+    GError              *error;
+    gboolean             done;
+} Command;
+
+static gpointer process_commands (BooksDatabasePrivate *priv);
+
+
+BooksDatabase *
+books_database_new (const gchar *filename)
+{
+    BooksDatabase *database;
+    BooksDatabasePrivate *priv;
+
+    g_return_val_if_fail (filename != NULL, NULL);
+
+    database = BOOKS_DATABASE (g_object_new (BOOKS_TYPE_DATABASE, NULL));
+    priv = database->priv;
+    priv->filename = g_strdup (filename);
+    priv->thread = g_thread_new ("database", (GThreadFunc) process_commands, priv);
+
+    return database;
+}
+
+const gchar *
+books_database_get_filename (BooksDatabase *database)
+{
+    g_return_val_if_fail (BOOKS_IS_DATABASE (database), NULL);
+    return database->priv->filename;
+}
+
+/*
+ * Executes @func on the database thread and waits for it. Only meant for
+ * setting up the schema before anything else may touch it.
+ */
+gpointer
+books_database_run (BooksDatabase *database,
+                    BooksDatabaseFunc func,
+                    gpointer data,
+                    GError **error)
+{
+    BooksDatabasePrivate *priv;
+    Command command = { func, NULL, data, NULL, NULL, FALSE };
+
+    g_return_val_if_fail (BOOKS_IS_DATABASE (database) && func != NULL, NULL);
+
+    priv = database->priv;
+    g_async_queue_push (priv->queue, &command);
+
+    g_mutex_lock (&priv->lock);
+
+    while (!command.done)
+        g_cond_wait (&priv->cond, &priv->lock);
+
+    g_mutex_unlock (&priv->lock);
+
+    if (command.error != NULL)
+        g_propagate_error (error, command.error);
+
+    return command.result;
+}
+
+/*
+ * Queues @func with @data, which is released with @data_free once the
+ * command has been completed. @callback is invoked in the thread-default
+ * main context of the caller and must call books_database_run_finish.
+ */
+void
+books_database_run_async (BooksDatabase *database,
+                          BooksDatabaseFunc func,
+                          gpointer data,
+                          GDestroyNotify data_free,
+                          GCancellable *cancellable,
+                          GAsyncReadyCallback callback,
+                          gpointer user_data)
+{
+    Command *command;
+
+    g_return_if_fail (BOOKS_IS_DATABASE (database) && func != NULL);
+
+    command = g_new0 (Command, 1);
+    command->func = func;
+    command->data = data;
+    command->task = g_task_new (database, cancellable, callback, user_data);
+    g_task_set_task_data (command->task, data, data_free);
+
+    g_async_queue_push (database->priv->queue, command);
+}
+
+gpointer
+books_database_run_finish (BooksDatabase *database,
+                           GAsyncResult *result,
+                           GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, database), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/*
+ * Runs one or more statements without results, for use inside commands.
+ */
+gboolean
+books_database_exec (sqlite3 *db,
+                     const gchar *sql,
+                     GError **error)
+{
+    gchar *db_error;
+
+    if (sqlite3_exec (db, sql, NULL, NULL, &db_error) != SQLITE_OK) {
+        g_set_error (error, BOOKS_DATABASE_ERROR, BOOKS_DATABASE_ERROR_QUERY,
+                     "%s", db_error);
+        sqlite3_free (db_error);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+void
+books_database_set_error (sqlite3 *db,
+                          GError **error)
+{
+    g_set_error (error, BOOKS_DATABASE_ERROR, BOOKS_DATABASE_ERROR_QUERY,
+                 "%s", sqlite3_errmsg (db));
+}
+
+GQuark
+books_database_error_quark (void)
+{
+    return g_quark_from_static_string ("books-database-error-quark");
+}
+
+static void
+complete_command (BooksDatabasePrivate *priv,
+                  Command *command)
+{
+    if (command->task != NULL) {
+        if (command->error != NULL)
+            g_task_return_error (command->task, command->error);
+        else
+            g_task_return_pointer (command->task, command->result, NULL);
+
+        g_object_unref (command->task);
+        g_free (command);
+        return;
+    }
+
+    g_mutex_lock (&priv->lock);
+    command->done = TRUE;
+    g_cond_broadcast (&priv->cond);
+    g_mutex_unlock (&priv->lock);
+}
+
+static gpointer
+process_commands (BooksDatabasePrivate *priv)
+{
+    sqlite3 *db;
+    GError *open_error = NULL;
+
+    if (sqlite3_open (priv->filename, &db) != SQLITE_OK) {
+        g_set_error (&open_error, BOOKS_DATABASE_ERROR, BOOKS_DATABASE_ERROR_OPEN,
+                     _("Could not open database: %s"), sqlite3_errmsg (db));
+    }
+    else {
+        /* The indexer writes through its own connection */
+        sqlite3_busy_timeout (db, 5000);
+    }
+
+    while (TRUE) {
+        Command *command;
+
+        command = (Command *) g_async_queue_pop (priv->queue);
+
+        /* Pushed on dispose after everything else */
+        if (command->func == NULL) {
+            g_free (command);
+            break;
+        }
+
+        if (open_error != NULL)
+            command->error = g_error_copy (open_error);
+        else if (command->task == NULL || !g_task_return_error_if_cancelled (command->task))
+            command->result = command->func (db, command->data, &command->error);
+        else {
+            g_object_unref (command->task);
+            g_free (command);
+            continue;
+        }
+
+        complete_command (priv, command);
+    }
+
+    g_clear_error (&open_error);
+    sqlite3_close (db);
+    return NULL;
+}
+
+static void
+books_database_dispose (GObject *object)
+{
+    BooksDatabasePrivate *priv;
+
+    priv = BOOKS_DATABASE_GET_PRIVATE (object);
+
+    /* Pending commands are still executed, a stop command ends the thread */
+    if (priv->thread != NULL) {
+        g_async_queue_push (priv->queue, g_new0 (Command, 1));
+        g_thread_join (priv->thread);
+        priv->thread = NULL;
+    }
+
+    G_OBJECT_CLASS (books_database_parent_class)->dispose (object);
+}
+
+static void
+books_database_finalize (GObject *object)
+{
+    BooksDatabasePrivate *priv;
+
+    priv = BOOKS_DATABASE_GET_PRIVATE (object);
+    g_free (priv->filename);
+    g_async_queue_unref (priv->queue);
+    g_mutex_clear (&priv->lock);
+    g_cond_clear (&priv->cond);
+
+    G_OBJECT_CLASS (books_database_parent_class)->finalize (object);
+}
+
+static void
+books_database_class_init (BooksDatabaseClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = books_database_dispose;
+    object_class->finalize = books_database_finalize;
+
+    g_type_class_add_private (klass, sizeof(BooksDatabasePrivate));
+}
+
+static void
+books_database_init (BooksDatabase *database)
+{
+    BooksDatabasePrivate *priv;
+
+    database->priv = priv = BOOKS_DATABASE_GET_PRIVATE (database);
+
+    g_mutex_init (&priv->lock);
+    g_cond_init (&priv->cond);
+    priv->filename = NULL;
+    priv->thread = NULL;
+    priv->queue = g_async_queue_new ();
+}
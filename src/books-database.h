@@ -0,0 +1,69 @@
+#ifndef BOOKS_DATABASE_H
+#define BOOKS_DATABASE_H
+
+#include <gio/gio.h>
+#include <sqlite3.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_DATABASE             (books_database_get_type())
+#define BOOKS_DATABASE(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_DATABASE, BooksDatabase))
+#define BOOKS_IS_DATABASE(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_DATABASE))
+#define BOOKS_DATABASE_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_DATABASE, BooksDatabaseClass))
+#define BOOKS_IS_DATABASE_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_DATABASE))
+#define BOOKS_DATABASE_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_DATABASE, BooksDatabaseClass))
+
+#define BOOKS_DATABASE_ERROR books_database_error_quark()
+
+typedef enum {
+    BOOKS_DATABASE_ERROR_OPEN,
+    BOOKS_DATABASE_ERROR_QUERY
+} BooksDatabaseError;
+
+/*
+ * A command executed on the database thread. The returned pointer is handed
+ * to the caller of books_database_run_finish.
+ */
+typedef gpointer (*BooksDatabaseFunc) (sqlite3 *db, gpointer data, GError **error);
+
+typedef struct _BooksDatabase           BooksDatabase;
+typedef struct _BooksDatabaseClass      BooksDatabaseClass;
+typedef struct _BooksDatabasePrivate    BooksDatabasePrivate;
+
+struct _BooksDatabase {
+    GObject parent_instance;
+
+    BooksDatabasePrivate *priv;
+};
+
+struct _BooksDatabaseClass {
+    GObjectClass parent_class;
+};
+
+BooksDatabase * books_database_new            (const gchar          *filename);
+const gchar   * books_database_get_filename   (BooksDatabase        *database);
+gpointer        books_database_run            (BooksDatabase        *database,
+                                               BooksDatabaseFunc     func,
+                                               gpointer              data,
+                                               GError              **error);
+void            books_database_run_async      (BooksDatabase        *database,
+                                               BooksDatabaseFunc     func,
+                                               gpointer              data,
+                                               GDestroyNotify        data_free,
+                                               GCancellable         *cancellable,
+                                               GAsyncReadyCallback   callback,
+                                               gpointer              user_data);
+gpointer        books_database_run_finish     (BooksDatabase        *database,
+                                               GAsyncResult         *result,
+                                               GError              **error);
+gboolean        books_database_exec           (sqlite3              *db,
+                                               const gchar          *sql,
+                                               GError              **error);
+void            books_database_set_error      (sqlite3              *db,
+                                               GError              **error);
+GType           books_database_get_type       (void);
+GQuark          books_database_error_quark    (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,164 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gio/gio.h>
+
+#include "books-epub-request.h"
+#include "books-epub.h"
+
+
+G_DEFINE_TYPE(BooksEpubRequest, books_epub_request, SOUP_TYPE_REQUEST)
+
+#define BOOKS_EPUB_REQUEST_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_EPUB_REQUEST, BooksEpubRequestPrivate))
+
+struct _BooksEpubRequestPrivate {
+    gchar   *content_type;
+    goffset  content_length;
+};
+
+static const gchar *schemes[] = { BOOKS_EPUB_URI_SCHEME, NULL };
+
+
+static gboolean
+books_epub_request_check_uri (SoupRequest *request,
+                              SoupURI *uri,
+                              GError **error)
+{
+    return uri->host != NULL && uri->host[0] != '\0';
+}
+
+static GInputStream *
+books_epub_request_send (SoupRequest *request,
+                         GCancellable *cancellable,
+                         GError **error)
+{
+    BooksEpubRequestPrivate *priv;
+    SoupURI *uri;
+    BooksEpub *epub;
+    GBytes *content;
+    gchar *content_type;
+
+    priv = BOOKS_EPUB_REQUEST (request)->priv;
+    uri = soup_request_get_uri (request);
+    epub = books_epub_lookup (uri->host);
+
+    if (epub == NULL) {
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                     "No open book is known as `%s'", uri->host);
+        return NULL;
+    }
+
+    content = books_epub_read_resource (epub, uri->path, error);
+    g_object_unref (epub);
+
+    if (content == NULL)
+        return NULL;
+
+    content_type = g_content_type_guess (uri->path,
+                                         g_bytes_get_data (content, NULL),
+                                         g_bytes_get_size (content),
+                                         NULL);
+
+    g_free (priv->content_type);
+    priv->content_type = g_content_type_get_mime_type (content_type);
+    priv->content_length = (goffset) g_bytes_get_size (content);
+    g_free (content_type);
+
+    return g_memory_input_stream_new_from_bytes (content);
+}
+
+static void
+send_in_thread (GTask *task,
+                gpointer source_object,
+                gpointer task_data,
+                GCancellable *cancellable)
+{
+    GInputStream *stream;
+    GError *error = NULL;
+
+    stream = books_epub_request_send (SOUP_REQUEST (source_object), cancellable, &error);
+
+    if (stream != NULL)
+        g_task_return_pointer (task, stream, g_object_unref);
+    else
+        g_task_return_error (task, error);
+}
+
+/*
+ * Inflating large images takes a while, so do it off the main thread that
+ * WebKit issues its requests from.
+ */
+static void
+books_epub_request_send_async (SoupRequest *request,
+                               GCancellable *cancellable,
+                               GAsyncReadyCallback callback,
+                               gpointer user_data)
+{
+    GTask *task;
+
+    task = g_task_new (request, cancellable, callback, user_data);
+    g_task_run_in_thread (task, send_in_thread);
+    g_object_unref (task);
+}
+
+static GInputStream *
+books_epub_request_send_finish (SoupRequest *request,
+                                GAsyncResult *result,
+                                GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, request), NULL);
+    return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static goffset
+books_epub_request_get_content_length (SoupRequest *request)
+{
+    return BOOKS_EPUB_REQUEST (request)->priv->content_length;
+}
+
+static const gchar *
+books_epub_request_get_content_type (SoupRequest *request)
+{
+    return BOOKS_EPUB_REQUEST (request)->priv->content_type;
+}
+
+static void
+books_epub_request_finalize (GObject *object)
+{
+    BooksEpubRequestPrivate *priv;
+
+    priv = BOOKS_EPUB_REQUEST_GET_PRIVATE (object);
+    g_free (priv->content_type);
+
+    G_OBJECT_CLASS (books_epub_request_parent_class)->finalize (object);
+}
+
+static void
+books_epub_request_class_init (BooksEpubRequestClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+    SoupRequestClass *request_class = SOUP_REQUEST_CLASS (klass);
+
+    object_class->finalize = books_epub_request_finalize;
+
+    request_class->schemes = schemes;
+    request_class->check_uri = books_epub_request_check_uri;
+    request_class->send = books_epub_request_send;
+    request_class->send_async = books_epub_request_send_async;
+    request_class->send_finish = books_epub_request_send_finish;
+    request_class->get_content_length = books_epub_request_get_content_length;
+    request_class->get_content_type = books_epub_request_get_content_type;
+
+    g_type_class_add_private (klass, sizeof(BooksEpubRequestPrivate));
+}
+
+static void
+books_epub_request_init (BooksEpubRequest *request)
+{
+    BooksEpubRequestPrivate *priv;
+
+    request->priv = priv = BOOKS_EPUB_REQUEST_GET_PRIVATE (request);
+    priv->content_type = NULL;
+    priv->content_length = -1;
+}
@@ -0,0 +1,34 @@
+#ifndef BOOKS_EPUB_REQUEST_H
+#define BOOKS_EPUB_REQUEST_H
+
+#include <libsoup/soup.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_EPUB_REQUEST             (books_epub_request_get_type())
+#define BOOKS_EPUB_REQUEST(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_EPUB_REQUEST, BooksEpubRequest))
+#define BOOKS_IS_EPUB_REQUEST(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_EPUB_REQUEST))
+#define BOOKS_EPUB_REQUEST_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_EPUB_REQUEST, BooksEpubRequestClass))
+#define BOOKS_IS_EPUB_REQUEST_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_EPUB_REQUEST))
+#define BOOKS_EPUB_REQUEST_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_EPUB_REQUEST, BooksEpubRequestClass))
+
+
+typedef struct _BooksEpubRequest           BooksEpubRequest;
+typedef struct _BooksEpubRequestClass      BooksEpubRequestClass;
+typedef struct _BooksEpubRequestPrivate    BooksEpubRequestPrivate;
+
+struct _BooksEpubRequest {
+    SoupRequest parent;
+
+    BooksEpubRequestPrivate *priv;
+};
+
+struct _BooksEpubRequestClass {
+    SoupRequestClass parent_class;
+};
+
+GType   books_epub_request_get_type     (void);
+
+G_END_DECLS
+
+#endif
@@ -1,24 +1,65 @@
 
-#include <archive.h>
-#include <archive_entry.h>
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <glib/gi18n.h>
 #include <libxml/parser.h>
-#include <libxml/xpath.h>
-#include <libxml/xpathInternals.h>
+#include <libxml/xmlreader.h>
 #include "books-epub.h"
+#include "books-archive.h"
+#include "books-cache.h"
 
 G_DEFINE_TYPE(BooksEpub, books_epub, G_TYPE_OBJECT)
 
 #define BOOKS_EPUB_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_EPUB, BooksEpubPrivate))
 
-static GError   *extract_archive            (BooksEpubPrivate *priv,
-                                             const gchar *pathname,
-                                             const gchar *path);
-static gchar    *get_content                (BooksEpubPrivate *priv, const gchar *filename);
 static gchar    *get_opf_path               (BooksEpubPrivate *priv);
+static gboolean  parse_package              (BooksEpubPrivate *priv, GBytes *data);
 static gchar    *get_cover_path             (BooksEpubPrivate *priv);
 static gchar    *get_content_filename       (BooksEpubPrivate *priv, const gchar *filename);
+static gchar    *get_content_uri            (BooksEpubPrivate *priv, const gchar *filename);
 static void      populate_document_spine    (BooksEpubPrivate *priv);
-static gchar    *remove_uri_anchor          (const gchar *uri);
+static gchar    *normalize_uri              (BooksEpubPrivate *priv, const gchar *uri);
+
+/*
+ * Open books are known to the epub:// URI handler by a unique host name. The
+ * handler runs on worker threads, so the books are only weakly referenced.
+ */
+static GHashTable *open_books = NULL;
+static guint       n_opened_books = 0;
+G_LOCK_DEFINE_STATIC (open_books);
+
+enum {
+    PROP_0,
+    PROP_STRIP_STYLE_SHEETS
+};
+
+#define OPF_NAMESPACE   "http://www.idpf.org/2007/opf"
+#define DC_NAMESPACE    "http://purl.org/dc/elements/1.1/"
+
+typedef struct {
+    gchar *filename;
+    gchar *media_type;
+    gchar *properties;
+} ManifestItem;
+
+static void
+manifest_item_free (ManifestItem *item)
+{
+    g_free (item->filename);
+    g_free (item->media_type);
+    g_free (item->properties);
+    g_free (item);
+}
+
+static void
+free_weak_ref (GWeakRef *ref)
+{
+    g_weak_ref_clear (ref);
+    g_free (ref);
+}
 
 GQuark
 books_epub_error_quark (void)
@@ -27,16 +68,33 @@ books_epub_error_quark (void)
 }
 
 struct _BooksEpubPrivate {
-    GList   *documents;
-    GList   *current;
-    gchar   *path;
+    GPtrArray  *documents;
+    GHashTable *document_positions;
+    guint       position;
+    BooksArchive *archive;
+    gchar   *fingerprint;
+    gchar   *host;
     gchar   *opf_path;
     gchar   *opf_prefix;
     gchar   *cover_path;
-    xmlDoc  *opf_tree;
-    xmlXPathContext *opf_xpath_context;
+    GBytes  *cover_data;
+    GHashTable *manifest;
+    GPtrArray  *spine;
+    GHashTable *metadata;
+    gchar   *cover_id;
+    gchar   *filename;
+    gdouble  offset;
+    GVariant *state;
+    gboolean strip_style_sheets;
 };
 
+/*
+ * Serialized form of an opened book: fingerprint, package document path,
+ * cover id, manifest (id to filename, media type and properties), spine
+ * idrefs, metadata, spine position and offset within that document.
+ */
+#define STATE_FORMAT    "(sssa{s(sss)}asa{ss}ud)"
+
 
 BooksEpub *
 books_epub_new (void)
@@ -44,62 +102,761 @@ books_epub_new (void)
     return BOOKS_EPUB (g_object_new (BOOKS_TYPE_EPUB, NULL));
 }
 
-gboolean
-books_epub_open (BooksEpub *epub,
-                 const gchar *filename,
+typedef struct {
+    gchar                      *filename;
+    BooksEpubProgressCallback   progress_callback;
+    gpointer                    progress_data;
+} OpenData;
+
+typedef struct {
+    GTask   *task;
+    gdouble  fraction;
+} ProgressData;
+
+static void
+open_data_free (OpenData *data)
+{
+    g_free (data->filename);
+    g_free (data);
+}
+
+static gboolean
+invoke_progress_callback (ProgressData *progress)
+{
+    OpenData *data;
+
+    data = g_task_get_task_data (progress->task);
+
+    /* The caller may be gone already if it cancelled */
+    if (!g_cancellable_is_cancelled (g_task_get_cancellable (progress->task)))
+        data->progress_callback (progress->fraction, data->progress_data);
+
+    g_object_unref (progress->task);
+    g_free (progress);
+    return FALSE;
+}
+
+/*
+ * Reports progress of an asynchronous open on the caller's main context.
+ * Returns FALSE if the operation has been cancelled in the meantime.
+ */
+static gboolean
+report_progress (GTask *task,
+                 gdouble fraction,
                  GError **error)
+{
+    OpenData *data;
+    ProgressData *progress;
+
+    if (task == NULL)
+        return TRUE;
+
+    if (g_cancellable_set_error_if_cancelled (g_task_get_cancellable (task), error))
+        return FALSE;
+
+    data = g_task_get_task_data (task);
+
+    if (data->progress_callback == NULL)
+        return TRUE;
+
+    progress = g_new0 (ProgressData, 1);
+    progress->task = g_object_ref (task);
+    progress->fraction = fraction;
+
+    g_main_context_invoke (g_task_get_context (task),
+                           (GSourceFunc) invoke_progress_callback, progress);
+    return TRUE;
+}
+
+/* Forgets what an earlier open found, so that a BooksEpub can be opened again */
+static void
+clear_package (BooksEpubPrivate *priv)
+{
+    g_free (priv->opf_path);
+    g_free (priv->opf_prefix);
+    g_free (priv->cover_path);
+    g_free (priv->cover_id);
+    priv->opf_path = NULL;
+    priv->opf_prefix = NULL;
+    priv->cover_path = NULL;
+    priv->cover_id = NULL;
+
+    if (priv->cover_data != NULL) {
+        g_bytes_unref (priv->cover_data);
+        priv->cover_data = NULL;
+    }
+
+    g_hash_table_remove_all (priv->manifest);
+    g_hash_table_remove_all (priv->metadata);
+    g_ptr_array_set_size (priv->spine, 0);
+}
+
+static gboolean
+restore_package (BooksEpubPrivate *priv)
+{
+    const gchar *fingerprint;
+    GVariantIter *manifest;
+    GVariantIter *spine;
+    GVariantIter *metadata;
+    gchar *id;
+    gchar *value;
+    ManifestItem *item;
+
+    g_variant_get_child (priv->state, 0, "&s", &fingerprint);
+
+    /* The file has been changed since the state was saved */
+    if (g_strcmp0 (fingerprint, priv->fingerprint)) {
+        g_variant_unref (priv->state);
+        priv->state = NULL;
+        return FALSE;
+    }
+
+    g_variant_get (priv->state, "(&sssa{s(sss)}asa{ss}ud)",
+                   NULL, &priv->opf_path, &priv->cover_id,
+                   &manifest, &spine, &metadata, NULL, NULL);
+
+    priv->opf_prefix = g_path_get_dirname (priv->opf_path);
+
+    if (!g_strcmp0 (priv->opf_prefix, ".")) {
+        g_free (priv->opf_prefix);
+        priv->opf_prefix = g_strdup ("");
+    }
+
+    if (priv->cover_id[0] == '\0') {
+        g_free (priv->cover_id);
+        priv->cover_id = NULL;
+    }
+
+    item = g_new0 (ManifestItem, 1);
+
+    while (g_variant_iter_next (manifest, "{s(sss)}", &id,
+                                &item->filename, &item->media_type, &item->properties)) {
+        if (item->properties[0] == '\0') {
+            g_free (item->properties);
+            item->properties = NULL;
+        }
+
+        g_hash_table_insert (priv->manifest, id, item);
+        item = g_new0 (ManifestItem, 1);
+    }
+
+    g_free (item);
+
+    while (g_variant_iter_next (spine, "s", &value))
+        g_ptr_array_add (priv->spine, value);
+
+    while (g_variant_iter_next (metadata, "{ss}", &id, &value))
+        g_hash_table_insert (priv->metadata, id, value);
+
+    g_variant_iter_free (manifest);
+    g_variant_iter_free (spine);
+    g_variant_iter_free (metadata);
+    return TRUE;
+}
+
+static void
+restore_position (BooksEpubPrivate *priv)
+{
+    guint position;
+    gdouble offset;
+
+    g_variant_get_child (priv->state, 6, "u", &position);
+    g_variant_get_child (priv->state, 7, "d", &offset);
+
+    if (position < priv->documents->len) {
+        priv->position = position;
+        priv->offset = offset;
+    }
+}
+
+/*
+ * Returns a compact snapshot of the opened book, see books_epub_set_state.
+ */
+GVariant *
+books_epub_get_state (BooksEpub *epub)
 {
     BooksEpubPrivate *priv;
-    gchar *basename;
-    gchar *opf_data;
-    GError *tmp_error = NULL;
+    GVariantBuilder manifest;
+    GVariantBuilder spine;
+    GVariantBuilder metadata;
+    GHashTableIter iter;
+    gpointer key;
+    gpointer value;
+    guint i;
 
-    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && filename != NULL, FALSE);
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && epub->priv->fingerprint != NULL, NULL);
 
     priv = epub->priv;
+    g_variant_builder_init (&manifest, G_VARIANT_TYPE ("a{s(sss)}"));
+    g_hash_table_iter_init (&iter, priv->manifest);
 
-    if (priv->path != NULL)
-        g_free (priv->path);
+    while (g_hash_table_iter_next (&iter, &key, &value)) {
+        ManifestItem *item = value;
 
-    basename = g_path_get_basename (filename);
+        g_variant_builder_add (&manifest, "{s(sss)}", key,
+                               item->filename,
+                               item->media_type != NULL ? item->media_type : "",
+                               item->properties != NULL ? item->properties : "");
+    }
 
-    priv->path = g_build_path (G_DIR_SEPARATOR_S,
-                               g_get_user_cache_dir(),
-                               "books",
-                               basename,
-                               NULL);
+    g_variant_builder_init (&spine, G_VARIANT_TYPE ("as"));
 
-    g_free (basename);
+    for (i = 0; i < priv->spine->len; i++)
+        g_variant_builder_add (&spine, "s", g_ptr_array_index (priv->spine, i));
 
-    if (!g_file_test (priv->path, G_FILE_TEST_EXISTS | G_FILE_TEST_IS_DIR))
-        tmp_error = extract_archive (priv, filename, priv->path);
+    g_variant_builder_init (&metadata, G_VARIANT_TYPE ("a{ss}"));
+    g_hash_table_iter_init (&iter, priv->metadata);
+
+    while (g_hash_table_iter_next (&iter, &key, &value))
+        g_variant_builder_add (&metadata, "{ss}", key, value);
+
+    return g_variant_new (STATE_FORMAT,
+                          priv->fingerprint,
+                          priv->opf_path,
+                          priv->cover_id != NULL ? priv->cover_id : "",
+                          &manifest, &spine, &metadata,
+                          priv->position, priv->offset);
+}
 
-    if (tmp_error != NULL) {
-        g_propagate_error (error, tmp_error);
+/*
+ * Hands a state from books_epub_get_state to the next open. If it belongs
+ * to the same file, the package document is not parsed again and the book
+ * starts at the saved position. Unknown or stale states are ignored.
+ */
+void
+books_epub_set_state (BooksEpub *epub,
+                      GVariant *state)
+{
+    BooksEpubPrivate *priv;
+
+    g_return_if_fail (BOOKS_IS_EPUB (epub));
+
+    priv = epub->priv;
+
+    if (priv->state != NULL)
+        g_variant_unref (priv->state);
+
+    priv->state = NULL;
+
+    if (state != NULL && g_variant_is_of_type (state, G_VARIANT_TYPE (STATE_FORMAT)))
+        priv->state = g_variant_ref_sink (state);
+}
+
+static gboolean
+open_package (BooksEpubPrivate *priv,
+              const gchar *filename,
+              GTask *task,
+              GError **error)
+{
+    GBytes *opf_data;
+
+    clear_package (priv);
+
+    if (priv->archive != NULL)
+        g_object_unref (priv->archive);
+
+    priv->archive = books_archive_new ();
+
+    if (!books_archive_open (priv->archive, filename, error))
         return FALSE;
+
+    if (!report_progress (task, 0.25, error))
+        return FALSE;
+
+    g_free (priv->fingerprint);
+    priv->fingerprint = g_strdup (books_archive_get_fingerprint (priv->archive));
+
+    /* A saved state of the very same file saves parsing the package */
+    if (priv->state != NULL && restore_package (priv)) {
+        priv->cover_path = get_cover_path (priv);
+        return report_progress (task, 0.75, error);
     }
 
     priv->opf_path = get_opf_path (priv);
+
+    if (priv->opf_path == NULL) {
+        g_set_error (error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_NO_META_DATA,
+                     "`%s' does not reference a package document", filename);
+        return FALSE;
+    }
+
     priv->opf_prefix = g_path_get_dirname (priv->opf_path);
-    opf_data = get_content (priv, priv->opf_path);
-    priv->opf_tree = xmlParseDoc ((const xmlChar*) opf_data);
-    g_free (opf_data);
-    priv->opf_xpath_context = xmlXPathNewContext (priv->opf_tree);
 
-    xmlXPathRegisterNs (priv->opf_xpath_context,
-                        (const xmlChar *) "dc",
-                        (const xmlChar *) "http://purl.org/dc/elements/1.1/");
+    if (!g_strcmp0 (priv->opf_prefix, ".")) {
+        g_free (priv->opf_prefix);
+        priv->opf_prefix = g_strdup ("");
+    }
 
-    xmlXPathRegisterNs (priv->opf_xpath_context,
-                        (const xmlChar *) "pkg",
-                        (const xmlChar *) "http://www.idpf.org/2007/opf");
+    opf_data = books_archive_read_entry (priv->archive, priv->opf_path, error);
 
-    populate_document_spine (priv);
+    if (opf_data == NULL)
+        return FALSE;
+
+    if (!report_progress (task, 0.5, error)) {
+        g_bytes_unref (opf_data);
+        return FALSE;
+    }
+
+    if (!parse_package (priv, opf_data)) {
+        g_bytes_unref (opf_data);
+        g_set_error (error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_NO_META_DATA,
+                     "`%s' has a malformed package document", filename);
+        return FALSE;
+    }
+
+    g_bytes_unref (opf_data);
     priv->cover_path = get_cover_path (priv);
+    return report_progress (task, 0.75, error);
+}
+
+static gboolean
+open_book (BooksEpub *epub,
+           const gchar *filename,
+           GTask *task,
+           GError **error)
+{
+    BooksEpubPrivate *priv;
+
+    priv = epub->priv;
+
+    if (!open_package (priv, filename, task, error))
+        return FALSE;
+
+    g_free (priv->filename);
+    priv->filename = g_strdup (filename);
+
+    G_LOCK (open_books);
+
+    if (priv->host == NULL) {
+        GWeakRef *ref;
+
+        if (open_books == NULL)
+            open_books = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, (GDestroyNotify) free_weak_ref);
+
+        priv->host = g_strdup_printf ("book%u", ++n_opened_books);
+        ref = g_new0 (GWeakRef, 1);
+        g_weak_ref_init (ref, epub);
+        g_hash_table_insert (open_books, g_strdup (priv->host), ref);
+    }
+
+    G_UNLOCK (open_books);
+
+    populate_document_spine (priv);
+
+    if (priv->state != NULL) {
+        restore_position (priv);
+        g_variant_unref (priv->state);
+        priv->state = NULL;
+    }
+
+    return report_progress (task, 1.0, error);
+}
+
+gboolean
+books_epub_open (BooksEpub *epub,
+                 const gchar *filename,
+                 GError **error)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && filename != NULL, FALSE);
+    return open_book (epub, filename, NULL, error);
+}
+
+static void
+open_in_thread (GTask *task,
+                gpointer source_object,
+                gpointer task_data,
+                GCancellable *cancellable)
+{
+    OpenData *data;
+    GError *error = NULL;
+
+    data = (OpenData *) task_data;
+
+    if (open_book (BOOKS_EPUB (source_object), data->filename, task, &error))
+        g_task_return_boolean (task, TRUE);
+    else
+        g_task_return_error (task, error);
+}
+
+/*
+ * Opens @filename on a worker thread. @progress_callback is called on the
+ * thread-default main context of the caller with the fraction done, the
+ * book must not be used until books_epub_open_finish returned.
+ */
+void
+books_epub_open_async (BooksEpub *epub,
+                       const gchar *filename,
+                       GCancellable *cancellable,
+                       BooksEpubProgressCallback progress_callback,
+                       gpointer progress_data,
+                       GAsyncReadyCallback callback,
+                       gpointer user_data)
+{
+    GTask *task;
+    OpenData *data;
+
+    g_return_if_fail (BOOKS_IS_EPUB (epub) && filename != NULL);
+
+    data = g_new0 (OpenData, 1);
+    data->filename = g_strdup (filename);
+    data->progress_callback = progress_callback;
+    data->progress_data = progress_data;
+
+    task = g_task_new (epub, cancellable, callback, user_data);
+    g_task_set_task_data (task, data, (GDestroyNotify) open_data_free);
+    g_task_set_return_on_cancel (task, FALSE);
+    g_task_run_in_thread (task, open_in_thread);
+    g_object_unref (task);
+}
+
+gboolean
+books_epub_open_finish (BooksEpub *epub,
+                        GAsyncResult *result,
+                        GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, epub), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+/*
+ * Reads only what the collection needs to know about a book: the package
+ * document and the cover image. The book cannot be viewed afterwards.
+ */
+gboolean
+books_epub_open_metadata (BooksEpub *epub,
+                          const gchar *filename,
+                          GError **error)
+{
+    BooksEpubPrivate *priv;
+
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && filename != NULL, FALSE);
+
+    priv = epub->priv;
+
+    if (!open_package (priv, filename, NULL, error))
+        return FALSE;
+
+    if (priv->cover_path != NULL) {
+        GError *cover_error = NULL;
+
+        priv->cover_data = books_archive_read_entry (priv->archive, priv->cover_path, &cover_error);
+
+        /* A missing cover is not a reason to reject the book */
+        if (cover_error != NULL) {
+            g_printerr (_("Could not read cover of `%s': %s\n"), filename, cover_error->message);
+            g_error_free (cover_error);
+        }
+    }
+
+    g_object_unref (priv->archive);
+    priv->archive = NULL;
 
     return TRUE;
 }
 
+/*
+ * Returns a new reference to the open book that serves @host or NULL.
+ */
+BooksEpub *
+books_epub_lookup (const gchar *host)
+{
+    BooksEpub *epub = NULL;
+
+    G_LOCK (open_books);
+
+    if (open_books != NULL) {
+        GWeakRef *ref;
+
+        ref = g_hash_table_lookup (open_books, host);
+
+        if (ref != NULL)
+            epub = g_weak_ref_get (ref);
+    }
+
+    G_UNLOCK (open_books);
+    return epub;
+}
+
+static gboolean
+is_markup_filename (const gchar *filename)
+{
+    gchar *lowered;
+    gboolean result;
+
+    lowered = g_ascii_strdown (filename, -1);
+    result = g_str_has_suffix (lowered, ".xhtml") ||
+             g_str_has_suffix (lowered, ".html") ||
+             g_str_has_suffix (lowered, ".htm");
+    g_free (lowered);
+    return result;
+}
+
+static gboolean
+has_tag_name (const gchar *p,
+              const gchar *end,
+              const gchar *name)
+{
+    gsize length;
+
+    length = strlen (name);
+
+    if ((gsize) (end - p) <= length || g_ascii_strncasecmp (p, name, length))
+        return FALSE;
+
+    return p[length] == '>' || p[length] == '/' || g_ascii_isspace (p[length]);
+}
+
+static const gchar *
+find_string (const gchar *p,
+             const gchar *end,
+             const gchar *needle,
+             gboolean ignore_case)
+{
+    gsize length;
+
+    length = strlen (needle);
+
+    for (; (gsize) (end - p) >= length; p++) {
+        if (ignore_case ? !g_ascii_strncasecmp (p, needle, length) : !strncmp (p, needle, length))
+            return p;
+    }
+
+    return NULL;
+}
+
+static gboolean
+is_style_sheet_link (const gchar *tag,
+                     gsize length)
+{
+    gchar *lowered;
+    gboolean result;
+
+    lowered = g_ascii_strdown (tag, length);
+    result = strstr (lowered, "stylesheet") != NULL;
+    g_free (lowered);
+    return result;
+}
+
+/*
+ * Drops <link rel="stylesheet">, <style> blocks and xml-stylesheet
+ * instructions from a content document, so that WebKit lays it out with
+ * the Books style sheet only. Comments are copied verbatim so that markup
+ * in them is not mistaken for elements.
+ */
+static GBytes *
+strip_style_sheets (GBytes *content)
+{
+    const gchar *data;
+    const gchar *end;
+    const gchar *p;
+    const gchar *copied;
+    GString *result;
+    gsize size;
+
+    data = g_bytes_get_data (content, &size);
+    end = data + size;
+    result = g_string_sized_new (size);
+    copied = data;
+    p = data;
+
+    while ((p = memchr (p, '<', end - p)) != NULL) {
+        const gchar *skip_end = NULL;
+        const gchar *tag_end;
+
+        if (end - p >= 4 && !strncmp (p, "<!--", 4)) {
+            tag_end = find_string (p + 4, end, "-->", FALSE);
+            p = tag_end != NULL ? tag_end + 3 : end;
+            continue;
+        }
+
+        tag_end = memchr (p, '>', end - p);
+
+        if (tag_end == NULL)
+            break;
+
+        if (has_tag_name (p + 1, end, "style")) {
+            const gchar *close;
+
+            close = find_string (tag_end, end, "</style", TRUE);
+
+            if (tag_end[-1] == '/')
+                skip_end = tag_end + 1;
+            else if (close != NULL && (close = memchr (close, '>', end - close)) != NULL)
+                skip_end = close + 1;
+        }
+        else if (has_tag_name (p + 1, end, "link")) {
+            if (is_style_sheet_link (p, tag_end - p))
+                skip_end = tag_end + 1;
+        }
+        else if (has_tag_name (p + 1, end, "?xml-stylesheet")) {
+            skip_end = tag_end + 1;
+        }
+
+        if (skip_end != NULL) {
+            g_string_append_len (result, copied, p - copied);
+            copied = p = skip_end;
+        }
+        else
+            p = tag_end + 1;
+    }
+
+    g_string_append_len (result, copied, end - copied);
+    return g_string_free_to_bytes (result);
+}
+
+/*
+ * Inflates the archive entry that the escaped URI @path refers to, unless it
+ * is still cached from an earlier request. Safe to call from any thread.
+ */
+GBytes *
+books_epub_read_resource (BooksEpub *epub,
+                          const gchar *path,
+                          GError **error)
+{
+    BooksCache *cache;
+    gchar *filename;
+    gchar *key;
+    GBytes *content;
+    gboolean strip;
+
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub) && path != NULL, NULL);
+
+    while (*path == '/')
+        path++;
+
+    filename = g_uri_unescape_string (path, NULL);
+
+    if (filename == NULL) {
+        g_set_error (error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
+                     "`%s' is not a valid resource path", path);
+        return NULL;
+    }
+
+    strip = epub->priv->strip_style_sheets && is_markup_filename (filename);
+    cache = books_cache_get_default ();
+    key = g_strconcat (epub->priv->fingerprint, strip ? "/unstyled/" : "/", filename, NULL);
+    content = books_cache_lookup (cache, key);
+
+    if (content == NULL) {
+        content = books_archive_read_entry (epub->priv->archive, filename, error);
+
+        if (content != NULL && strip) {
+            GBytes *stripped;
+
+            stripped = strip_style_sheets (content);
+            g_bytes_unref (content);
+            content = stripped;
+        }
+
+        if (content != NULL)
+            books_cache_insert (cache, key, content);
+    }
+
+    g_free (key);
+    g_free (filename);
+    return content;
+}
+
+static gboolean
+is_skipped_element (const xmlChar *name)
+{
+    return xmlStrEqual (name, BAD_CAST "head") ||
+           xmlStrEqual (name, BAD_CAST "script") ||
+           xmlStrEqual (name, BAD_CAST "style");
+}
+
+/*
+ * Returns the plain text of the spine document at @position, with the text
+ * of separate nodes joined by single spaces.
+ */
+gchar *
+books_epub_get_document_text (BooksEpub *epub,
+                              guint position,
+                              GError **error)
+{
+    BooksEpubPrivate *priv;
+    xmlTextReaderPtr reader;
+    GBytes *content;
+    GString *text;
+    gchar *prefix;
+    const gchar *uri;
+    guint skip_depth = 0;
+
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
+
+    priv = epub->priv;
+
+    if (position >= priv->documents->len) {
+        g_set_error (error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_NO_META_DATA,
+                     "No document at spine position %u", position);
+        return NULL;
+    }
+
+    uri = g_ptr_array_index (priv->documents, position);
+    prefix = g_strdup_printf (BOOKS_EPUB_URI_SCHEME "://%s", priv->host);
+    content = books_epub_read_resource (epub, uri + strlen (prefix), error);
+    g_free (prefix);
+
+    if (content == NULL)
+        return NULL;
+
+    reader = xmlReaderForMemory (g_bytes_get_data (content, NULL),
+                                 (int) g_bytes_get_size (content),
+                                 NULL, NULL,
+                                 XML_PARSE_RECOVER | XML_PARSE_NONET |
+                                 XML_PARSE_NOERROR | XML_PARSE_NOWARNING);
+
+    if (reader == NULL) {
+        g_set_error (error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
+                     "Could not parse spine document %u", position);
+        g_bytes_unref (content);
+        return NULL;
+    }
+
+    text = g_string_new (NULL);
+
+    while (xmlTextReaderRead (reader) == 1) {
+        switch (xmlTextReaderNodeType (reader)) {
+            case XML_READER_TYPE_ELEMENT:
+                if (is_skipped_element (xmlTextReaderConstLocalName (reader)) &&
+                    !xmlTextReaderIsEmptyElement (reader))
+                    skip_depth++;
+                break;
+
+            case XML_READER_TYPE_END_ELEMENT:
+                if (skip_depth > 0 && is_skipped_element (xmlTextReaderConstLocalName (reader)))
+                    skip_depth--;
+                break;
+
+            case XML_READER_TYPE_TEXT:
+            case XML_READER_TYPE_CDATA:
+                if (skip_depth == 0) {
+                    gchar *stripped;
+
+                    stripped = g_strstrip (g_strdup ((const gchar *) xmlTextReaderConstValue (reader)));
+
+                    if (stripped[0] != '\0') {
+                        if (text->len > 0)
+                            g_string_append_c (text, ' ');
+
+                        g_string_append (text, stripped);
+                    }
+
+                    g_free (stripped);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    xmlFreeTextReader (reader);
+    g_bytes_unref (content);
+    return g_string_free (text, FALSE);
+}
+
 const gchar *
 books_epub_get_uri (BooksEpub *epub)
 {
@@ -107,7 +864,75 @@ books_epub_get_uri (BooksEpub *epub)
 
     g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
     priv = epub->priv;
-    return priv->current != NULL ? priv->current->data : NULL;
+
+    if (priv->position >= priv->documents->len)
+        return NULL;
+
+    return g_ptr_array_index (priv->documents, priv->position);
+}
+
+const gchar *
+books_epub_get_document_uri (BooksEpub *epub,
+                             guint position)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
+
+    if (position >= epub->priv->documents->len)
+        return NULL;
+
+    return g_ptr_array_index (epub->priv->documents, position);
+}
+
+guint
+books_epub_get_position (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), 0);
+    return epub->priv->position;
+}
+
+guint
+books_epub_get_n_documents (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), 0);
+    return epub->priv->documents->len;
+}
+
+void
+books_epub_seek (BooksEpub *epub,
+                 guint position)
+{
+    g_return_if_fail (BOOKS_IS_EPUB (epub));
+
+    if (position < epub->priv->documents->len) {
+        epub->priv->position = position;
+        epub->priv->offset = 0.0;
+    }
+}
+
+/*
+ * The offset is the fraction of the current document that has been
+ * scrolled past. It is reset whenever the position changes.
+ */
+gdouble
+books_epub_get_offset (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), 0.0);
+    return epub->priv->offset;
+}
+
+void
+books_epub_set_offset (BooksEpub *epub,
+                       gdouble offset)
+{
+    g_return_if_fail (BOOKS_IS_EPUB (epub));
+    epub->priv->offset = CLAMP (offset, 0.0, 1.0);
+}
+
+const gchar *
+books_epub_get_filename (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
+    return epub->priv->filename;
 }
 
 const gchar *
@@ -117,22 +942,40 @@ books_epub_get_cover (BooksEpub *epub)
     return epub->priv->cover_path;
 }
 
+GBytes *
+books_epub_get_cover_data (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
+    return epub->priv->cover_data;
+}
+
+const gchar *
+books_epub_get_fingerprint (BooksEpub *epub)
+{
+    g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
+    return epub->priv->fingerprint;
+}
+
 void
 books_epub_set_uri (BooksEpub *epub,
                     const gchar *uri)
 {
     BooksEpubPrivate *priv;
     gchar *normalized_uri;
-    GList *result;
+    gpointer position;
 
     g_return_if_fail (BOOKS_IS_EPUB (epub));
 
     priv = epub->priv;
-    normalized_uri = remove_uri_anchor (uri);
-    result = g_list_find_custom (priv->documents, normalized_uri, (GCompareFunc) g_strcmp0);
+    normalized_uri = normalize_uri (priv, uri);
 
-    if (result != NULL)
-        priv->current = result;
+    /* Positions are stored off by one to tell the first one from a miss */
+    position = g_hash_table_lookup (priv->document_positions, normalized_uri);
+
+    if (position != NULL && GPOINTER_TO_UINT (position) - 1 != priv->position) {
+        priv->position = GPOINTER_TO_UINT (position) - 1;
+        priv->offset = 0.0;
+    }
 
     g_free (normalized_uri);
 }
@@ -145,8 +988,10 @@ books_epub_next (BooksEpub *epub)
     g_return_if_fail (BOOKS_IS_EPUB (epub));
     priv = epub->priv;
 
-    if (priv->current != g_list_last (priv->documents))
-        priv->current = g_list_next (priv->current);
+    if (priv->position + 1 < priv->documents->len) {
+        priv->position++;
+        priv->offset = 0.0;
+    }
 }
 
 void
@@ -157,354 +1002,341 @@ books_epub_previous (BooksEpub *epub)
     g_return_if_fail (BOOKS_IS_EPUB (epub));
     priv = epub->priv;
 
-    if (priv->current != g_list_first (priv->documents))
-        priv->current = g_list_previous (priv->current);
+    if (priv->position > 0) {
+        priv->position--;
+        priv->offset = 0.0;
+    }
 }
 
 gboolean
 books_epub_is_first (BooksEpub *epub)
 {
     g_return_val_if_fail (BOOKS_IS_EPUB (epub), FALSE);
-    return epub->priv->current == g_list_first (epub->priv->documents);
+    return epub->priv->position == 0;
 }
 
 gboolean
 books_epub_is_last (BooksEpub *epub)
 {
     g_return_val_if_fail (BOOKS_IS_EPUB (epub), FALSE);
-    return epub->priv->current == g_list_last (epub->priv->documents);
+    return epub->priv->position + 1 >= epub->priv->documents->len;
 }
 
 const gchar *
 books_epub_get_meta (BooksEpub *epub,
                      gchar *key)
 {
-    BooksEpubPrivate *priv;
-    xmlXPathObject *object;
-    gchar *expression;
-    const gchar *value = NULL;
-
     g_return_val_if_fail (BOOKS_IS_EPUB (epub), NULL);
-
-    priv = epub->priv;
-    expression = g_strdup_printf ("//pkg:package/pkg:metadata/dc:%s", key);
-    object = xmlXPathEvalExpression ((const xmlChar *) expression, priv->opf_xpath_context);
-
-    if (!xmlXPathNodeSetIsEmpty (object->nodesetval)) {
-        value = (const gchar *) xmlNodeListGetString (priv->opf_tree,
-                                                      object->nodesetval->nodeTab[0]->xmlChildrenNode, 1);
-    }
-
-    xmlXPathFreeObject (object);
-    return value;
+    return g_hash_table_lookup (epub->priv->metadata, key);
 }
 
+/*
+ * Brings a URI reported by WebKit into the form used for the spine, i.e.
+ * without anchor and with the path escaped like get_content_uri does it.
+ */
 static gchar *
-remove_uri_anchor (const gchar *uri)
+normalize_uri (BooksEpubPrivate *priv,
+               const gchar *uri)
 {
-    gchar *anchor;
-
-    anchor = g_strrstr (uri, "#");
-
-    if (anchor == NULL)
-        return g_strdup (uri);
-    else
-        return g_strndup (uri, anchor - uri);
-}
+    const gchar *anchor;
+    gchar *stripped;
+    gchar *prefix;
+    gchar *filename = NULL;
+    gchar *normalized;
 
-static gint
-copy_archive_data (struct archive *ar, struct archive *aw)
-{
-    gint r;
-    const void *buff;
-    size_t size;
-    gint64  offset;
+    anchor = strchr (uri, '#');
+    stripped = anchor == NULL ? g_strdup (uri) : g_strndup (uri, anchor - uri);
 
-    for (;;) {
-        r = archive_read_data_block(ar, &buff, &size, &offset);
+    /* Only URIs of this book can be part of the spine */
+    prefix = g_strdup_printf (BOOKS_EPUB_URI_SCHEME "://%s/", priv->host);
 
-        if (r == ARCHIVE_EOF)
-            return ARCHIVE_OK;
+    if (g_str_has_prefix (stripped, prefix))
+        filename = g_uri_unescape_string (stripped + strlen (prefix), NULL);
 
-        if (r != ARCHIVE_OK)
-            return r;
+    g_free (prefix);
 
-        r = archive_write_data_block(aw, buff, size, offset);
+    if (filename == NULL)
+        return stripped;
 
-        if (r != ARCHIVE_OK) {
-            return r;
-        }
-    }
+    normalized = get_content_uri (priv, filename);
+    g_free (filename);
+    g_free (stripped);
+    return normalized;
 }
 
-static GError *
-extract_archive (BooksEpubPrivate *priv,
-                 const gchar *filename,
-                 const gchar *path)
+/*
+ * Resolves a manifest href against the package document location and turns
+ * it into an archive entry name.
+ */
+static gchar *
+get_content_filename (BooksEpubPrivate *priv,
+                      const gchar *href)
 {
-    struct archive *arch;
-    struct archive *ext;
-    struct archive_entry *entry;
-    gint flags, result;
-    gchar *new_path = NULL;
-    GError *error = NULL;
-
-    arch = archive_read_new ();
-    archive_read_support_filter_all (arch);
-    archive_read_support_format_zip (arch);
-
-    flags = ARCHIVE_EXTRACT_TIME |
-            ARCHIVE_EXTRACT_PERM |
-            ARCHIVE_EXTRACT_ACL  |
-            ARCHIVE_EXTRACT_FFLAGS;
-
-    ext = archive_write_disk_new ();
-    archive_write_disk_set_options (ext, flags);
-    archive_write_disk_set_standard_lookup (ext);
-
-    result = archive_read_open_filename (arch, filename, 10240);
-
-    if (result != ARCHIVE_OK) {
-        g_set_error (&error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
-                     "`%s' is not a valid EPUB archive", filename);
-        return FALSE;
+    gchar *unescaped;
+    gchar *joined;
+    gchar **parts;
+    GPtrArray *segments;
+    gchar *filename;
+    guint i;
+
+    unescaped = g_uri_unescape_string (href, NULL);
+
+    if (unescaped == NULL)
+        unescaped = g_strdup (href);
+
+    if (priv->opf_prefix == NULL || priv->opf_prefix[0] == '\0')
+        joined = unescaped;
+    else {
+        joined = g_strconcat (priv->opf_prefix, "/", unescaped, NULL);
+        g_free (unescaped);
     }
 
-    for (;;) {
-        result = archive_read_next_header (arch, &entry);
+    parts = g_strsplit (joined, "/", -1);
+    segments = g_ptr_array_new ();
 
-        if (result == ARCHIVE_EOF)
-            break;
-
-        if (result != ARCHIVE_OK) {
-            g_set_error (&error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
-                         "`%s' is corrupted: %s", filename, archive_error_string (arch));
-            goto extract_archive_cleanup;
-        }
-
-        new_path = g_build_path (G_DIR_SEPARATOR_S, path,
-                                 archive_entry_pathname (entry), NULL);
-        archive_entry_set_pathname (entry, new_path);
-
-        result = archive_write_header (ext, entry);
-
-        if (result != ARCHIVE_OK) {
-            g_set_error (&error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
-                         "Could not write header: %s", archive_error_string (ext));
-            goto extract_archive_cleanup;
-        }
-        else if (archive_entry_size (entry) > 0) {
-            result = copy_archive_data (arch, ext);
+    for (i = 0; parts[i] != NULL; i++) {
+        if (parts[i][0] == '\0' || !g_strcmp0 (parts[i], "."))
+            continue;
 
-            if (result != ARCHIVE_OK) {
-                g_set_error (&error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
-                             "Could not write header: %s", archive_error_string (ext));
-                goto extract_archive_cleanup;
-            }
-        }
-
-        result = archive_write_finish_entry (ext);
-
-        if (result != ARCHIVE_OK) {
-            g_set_error (&error, BOOKS_EPUB_ERROR, BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
-                         "Could not finish entry: %s", archive_error_string (ext));
-            goto extract_archive_cleanup;
+        if (!g_strcmp0 (parts[i], "..")) {
+            if (segments->len > 0)
+                g_ptr_array_remove_index (segments, segments->len - 1);
         }
-
-        g_free (new_path);
+        else
+            g_ptr_array_add (segments, parts[i]);
     }
 
-extract_archive_cleanup:
-    archive_read_close (arch);
-    archive_read_free (arch);
-    archive_write_close (ext);
-    archive_write_free (ext);
-    return error;
+    g_ptr_array_add (segments, NULL);
+    filename = g_strjoinv ("/", (gchar **) segments->pdata);
+
+    g_ptr_array_free (segments, TRUE);
+    g_strfreev (parts);
+    g_free (joined);
+    return filename;
 }
 
 static gchar *
-get_content (BooksEpubPrivate *priv,
-             const gchar *filename)
+get_content_uri (BooksEpubPrivate *priv,
+                 const gchar *filename)
 {
-    FILE *fp;
-    gsize size, read;
-    gchar *content = NULL;
-    gchar *new_path;
-
-    new_path = g_build_path (G_DIR_SEPARATOR_S, priv->path, filename, NULL);
-    fp = fopen (new_path, "rb");
+    gchar *escaped;
+    gchar *uri;
 
-    if (fp != NULL) {
-        fseek (fp, 0, SEEK_END);
-        size = ftell (fp);
-        fseek (fp, 0, SEEK_SET);
-        content = g_malloc0 (size + 1);
-        read = fread (content, 1, size, fp);
-        g_assert (read == size);
-        fclose (fp);
-    }
-
-    g_free (new_path);
-    return content;
+    escaped = g_uri_escape_string (filename, G_URI_RESERVED_CHARS_ALLOWED_IN_PATH, FALSE);
+    uri = g_strdup_printf (BOOKS_EPUB_URI_SCHEME "://%s/%s", priv->host, escaped);
+    g_free (escaped);
+    return uri;
 }
 
 static gchar *
-get_content_filename (BooksEpubPrivate *priv,
-                      const gchar *filename)
+get_attribute (xmlTextReaderPtr reader,
+               const gchar *name)
 {
-    return g_build_path (G_DIR_SEPARATOR_S, priv->path, priv->opf_prefix, filename, NULL);
+    xmlChar *value;
+    gchar *result;
+
+    value = xmlTextReaderGetAttribute (reader, (const xmlChar *) name);
+
+    if (value == NULL)
+        return NULL;
+
+    result = g_strdup ((const gchar *) value);
+    xmlFree (value);
+    return result;
 }
 
 static gchar *
 get_opf_path (BooksEpubPrivate *priv)
 {
-    gchar *container_data;
-    xmlDoc *tree;
-    xmlXPathContext *context;
-    xmlXPathObject *object;
+    GBytes *container_data;
+    xmlTextReaderPtr reader;
     gchar *path = NULL;
 
-    container_data = get_content (priv, "META-INF/container.xml");
-    tree = xmlParseDoc ((const xmlChar *) container_data);
+    container_data = books_archive_read_entry (priv->archive, "META-INF/container.xml", NULL);
 
-    if (tree == NULL)
+    if (container_data == NULL)
         return NULL;
 
-    context = xmlXPathNewContext (tree);
-
-    xmlXPathRegisterNs (context,
-                        (const xmlChar *) "c",
-                        (const xmlChar *) "urn:oasis:names:tc:opendocument:xmlns:container");
+    reader = xmlReaderForMemory (g_bytes_get_data (container_data, NULL),
+                                 (gint) g_bytes_get_size (container_data),
+                                 NULL, NULL, XML_PARSE_NONET);
 
-    object = xmlXPathEvalExpression ((const xmlChar *) "//c:container/c:rootfiles/c:rootfile",
-                                     context);
+    if (reader != NULL) {
+        while (path == NULL && xmlTextReaderRead (reader) == 1) {
+            if (xmlTextReaderNodeType (reader) == XML_READER_TYPE_ELEMENT &&
+                !g_strcmp0 ((const gchar *) xmlTextReaderConstLocalName (reader), "rootfile"))
+                path = get_attribute (reader, "full-path");
+        }
 
-    if (object == NULL) {
-        g_error ("Could not evaluate xpath expression");
-        goto get_opf_path_cleanup;
+        xmlFreeTextReader (reader);
     }
 
-    if (object->nodesetval != NULL)
-        path = g_strdup ((const gchar *) xmlGetProp (object->nodesetval->nodeTab[0],
-                                                     (const xmlChar *) "full-path"));
-
-get_opf_path_cleanup:
-    xmlXPathFreeObject (object);
-    xmlXPathFreeContext (context);
-    xmlFreeDoc (tree);
-    xmlCleanupParser ();
-
+    g_bytes_unref (container_data);
     return path;
 }
 
-static gchar *
-get_document_item (xmlXPathContext *context, gchar *item_id)
+static void
+parse_manifest_item (BooksEpubPrivate *priv,
+                     xmlTextReaderPtr reader)
 {
-    xmlXPathObject *object;
-    gchar *expression;
-    gchar *item_html = NULL;
+    ManifestItem *item;
+    gchar *id;
+    gchar *href;
 
-    expression = g_strdup_printf ("//pkg:package/pkg:manifest/pkg:item[@id='%s']", item_id);
-    object = xmlXPathEvalExpression ((const xmlChar *) expression, context);
+    id = get_attribute (reader, "id");
+    href = get_attribute (reader, "href");
 
-    if (object->nodesetval != NULL)
-        item_html = g_strdup ((const gchar *) xmlGetProp (object->nodesetval->nodeTab[0],
-                                                          (const xmlChar *) "href"));
+    if (id == NULL || href == NULL) {
+        g_free (id);
+        g_free (href);
+        return;
+    }
 
-    g_free (expression);
-    return item_html;
+    item = g_new0 (ManifestItem, 1);
+    item->filename = get_content_filename (priv, href);
+    item->media_type = get_attribute (reader, "media-type");
+    item->properties = get_attribute (reader, "properties");
+    g_hash_table_insert (priv->manifest, id, item);
+    g_free (href);
 }
 
-static void
-populate_document_spine (BooksEpubPrivate *priv)
+/*
+ * Walks the package document once and collects manifest, spine and
+ * metadata, so that nothing has to search the tree afterwards.
+ */
+static gboolean
+parse_package (BooksEpubPrivate *priv,
+               GBytes *data)
 {
-    xmlXPathObject *object;
+    xmlTextReaderPtr reader;
+    gint result;
 
-    if (priv->documents != NULL) {
-        g_list_free_full (priv->documents, g_free);
-        priv->documents = NULL;
-    }
+    reader = xmlReaderForMemory (g_bytes_get_data (data, NULL),
+                                 (gint) g_bytes_get_size (data),
+                                 NULL, NULL, XML_PARSE_NONET);
+
+    if (reader == NULL)
+        return FALSE;
 
-    object = xmlXPathEvalExpression ((const xmlChar *) "//pkg:package/pkg:spine/pkg:itemref",
-                                     priv->opf_xpath_context);
+    g_hash_table_remove_all (priv->manifest);
+    g_hash_table_remove_all (priv->metadata);
+    g_ptr_array_set_size (priv->spine, 0);
 
-    if (object->nodesetval != NULL) {
-        guint i;
+    while ((result = xmlTextReaderRead (reader)) == 1) {
+        const gchar *namespace;
+        const gchar *name;
 
-        for (i = 0; i < object->nodesetval->nodeNr; i++) {
-            xmlNode *node;
-            gchar *item_id;
-            gchar *item;
+        if (xmlTextReaderNodeType (reader) != XML_READER_TYPE_ELEMENT)
+            continue;
 
-            node = object->nodesetval->nodeTab[i];
-            item_id = (gchar *) xmlGetProp (node, (const xmlChar *) "idref");
-            item = get_document_item (priv->opf_xpath_context, item_id);
+        namespace = (const gchar *) xmlTextReaderConstNamespaceUri (reader);
+        name = (const gchar *) xmlTextReaderConstLocalName (reader);
 
-            if (item != NULL) {
-                gchar *filename;
-                gchar *uri;
-                GError *error = NULL;
+        if (!g_strcmp0 (namespace, OPF_NAMESPACE)) {
+            if (!g_strcmp0 (name, "item")) {
+                parse_manifest_item (priv, reader);
+            }
+            else if (!g_strcmp0 (name, "itemref")) {
+                gchar *idref;
+
+                idref = get_attribute (reader, "idref");
 
-                filename = get_content_filename (priv, item);
-                uri = g_filename_to_uri (filename, NULL, &error);
-                priv->documents = g_list_append (priv->documents, uri);
-                g_free (filename);
+                if (idref != NULL)
+                    g_ptr_array_add (priv->spine, idref);
+            }
+            else if (!g_strcmp0 (name, "meta") && priv->cover_id == NULL) {
+                gchar *meta_name;
+
+                meta_name = get_attribute (reader, "name");
+
+                if (!g_strcmp0 (meta_name, "cover"))
+                    priv->cover_id = get_attribute (reader, "content");
+
+                g_free (meta_name);
+            }
+        }
+        else if (!g_strcmp0 (namespace, DC_NAMESPACE) &&
+                 !g_hash_table_contains (priv->metadata, name)) {
+            xmlChar *value;
+
+            /* Only the first occurrence of each element is of interest */
+            value = xmlTextReaderReadString (reader);
+
+            if (value != NULL) {
+                g_hash_table_insert (priv->metadata, g_strdup (name),
+                                     g_strstrip (g_strdup ((const gchar *) value)));
+                xmlFree (value);
             }
         }
     }
 
-    priv->current = g_list_first (priv->documents);
-    xmlXPathFreeObject (object);
+    xmlFreeTextReader (reader);
+    return result == 0;
 }
 
-static gchar *
-get_cover_path (BooksEpubPrivate *priv)
+static void
+populate_document_spine (BooksEpubPrivate *priv)
 {
-    gchar *cover_id = NULL;
-    gchar *path = NULL;
-    const gchar *meta_cover_expr = "//pkg:package/pkg:metadata/pkg:meta[@name='cover']";
-    const gchar *cover_item_expr = "//pkg:package/pkg:manifest/pkg:item[@id='%s']";
+    guint i;
+
+    g_hash_table_remove_all (priv->document_positions);
+    g_ptr_array_set_size (priv->documents, 0);
+
+    for (i = 0; i < priv->spine->len; i++) {
+        ManifestItem *item;
+        gchar *uri;
 
-    xmlXPathObject *object;
+        item = g_hash_table_lookup (priv->manifest, g_ptr_array_index (priv->spine, i));
 
-    /* First, get the cover id from the meta data */
-    object = xmlXPathEvalExpression ((const xmlChar *) meta_cover_expr, priv->opf_xpath_context);
+        if (item == NULL)
+            continue;
 
-    if (!xmlXPathNodeSetIsEmpty (object->nodesetval)) {
-        xmlNode *node;
+        uri = get_content_uri (priv, item->filename);
+        g_ptr_array_add (priv->documents, uri);
 
-        node = object->nodesetval->nodeTab[0];
-        cover_id = (gchar *) xmlGetProp (node, (const xmlChar *) "content");
+        /* Documents listed twice keep their first position */
+        if (!g_hash_table_contains (priv->document_positions, uri))
+            g_hash_table_insert (priv->document_positions, uri,
+                                 GUINT_TO_POINTER (priv->documents->len));
     }
 
-    xmlXPathFreeObject (object);
+    priv->position = 0;
+}
+
+static gboolean
+is_cover_image (gpointer key,
+                ManifestItem *item,
+                gpointer user_data)
+{
+    gchar **properties;
+    gboolean result = FALSE;
+    guint i;
+
+    if (item->properties == NULL)
+        return FALSE;
 
-    if (cover_id != NULL) {
-        gchar *expr;
+    properties = g_strsplit (item->properties, " ", -1);
 
-        expr = g_strdup_printf (cover_item_expr, cover_id);
-        object = xmlXPathEvalExpression ((const xmlChar *) expr, priv->opf_xpath_context);
+    for (i = 0; properties[i] != NULL && !result; i++)
+        result = !g_strcmp0 (properties[i], "cover-image");
 
-        if (!xmlXPathNodeSetIsEmpty (object->nodesetval)) {
-            xmlNode *node;
-            gchar *href;
-            gchar *unescaped;
+    g_strfreev (properties);
+    return result;
+}
 
-            node = object->nodesetval->nodeTab[0];
-            href = (gchar *) xmlGetProp (node, (const xmlChar *) "href");
-            unescaped = g_uri_unescape_segment (href, NULL, NULL);
-            path = get_content_filename (priv, unescaped);
-            g_free (href);
-            g_free (unescaped);
-        }
+static gchar *
+get_cover_path (BooksEpubPrivate *priv)
+{
+    ManifestItem *item = NULL;
 
-        xmlXPathFreeObject (object);
-        g_free (expr);
-    }
+    /* EPUB 2 references the cover from the metadata, EPUB 3 marks the item */
+    if (priv->cover_id != NULL)
+        item = g_hash_table_lookup (priv->manifest, priv->cover_id);
 
-    g_free (cover_id);
+    if (item == NULL)
+        item = g_hash_table_find (priv->manifest, (GHRFunc) is_cover_image, NULL);
 
-    return path;
+    return item != NULL ? g_strdup (item->filename) : NULL;
 }
 
 static void
@@ -520,30 +1352,39 @@ books_epub_finalize (GObject *object)
 
     priv = BOOKS_EPUB_GET_PRIVATE (object);
 
-    if (priv->documents != NULL) {
-        g_list_free_full (priv->documents, g_free);
-        priv->documents = NULL;
+    g_hash_table_destroy (priv->document_positions);
+    g_ptr_array_free (priv->documents, TRUE);
+
+    if (priv->host != NULL) {
+        G_LOCK (open_books);
+        g_hash_table_remove (open_books, priv->host);
+        G_UNLOCK (open_books);
+        g_free (priv->host);
     }
 
-    if (priv->path != NULL)
-        g_free (priv->path);
+    if (priv->archive != NULL)
+        g_object_unref (priv->archive);
+
+    g_free (priv->fingerprint);
+    g_free (priv->opf_path);
 
     if (priv->cover_path != NULL)
         g_free (priv->cover_path);
 
+    if (priv->cover_data != NULL)
+        g_bytes_unref (priv->cover_data);
+
     if (priv->opf_prefix != NULL)
         g_free (priv->opf_prefix);
 
-    if (priv->opf_xpath_context != NULL) {
-        xmlXPathFreeContext (priv->opf_xpath_context);
-        priv->opf_xpath_context = NULL;
-    }
+    g_hash_table_destroy (priv->manifest);
+    g_hash_table_destroy (priv->metadata);
+    g_ptr_array_free (priv->spine, TRUE);
+    g_free (priv->cover_id);
+    g_free (priv->filename);
 
-    if (priv->opf_tree != NULL) {
-        xmlFreeDoc (priv->opf_tree);
-        xmlCleanupParser ();
-        priv->opf_tree = NULL;
-    }
+    if (priv->state != NULL)
+        g_variant_unref (priv->state);
 
     G_OBJECT_CLASS (books_epub_parent_class)->finalize (object);
 }
@@ -554,7 +1395,15 @@ books_epub_set_property (GObject *object,
                          const GValue *value,
                          GParamSpec *pspec)
 {
+    BooksEpubPrivate *priv;
+
+    priv = BOOKS_EPUB_GET_PRIVATE (object);
+
     switch (property_id) {
+        case PROP_STRIP_STYLE_SHEETS:
+            priv->strip_style_sheets = g_value_get_boolean (value);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -567,7 +1416,15 @@ books_epub_get_property(GObject *object,
                         GValue *value,
                         GParamSpec *pspec)
 {
+    BooksEpubPrivate *priv;
+
+    priv = BOOKS_EPUB_GET_PRIVATE (object);
+
     switch (property_id) {
+        case PROP_STRIP_STYLE_SHEETS:
+            g_value_set_boolean (value, priv->strip_style_sheets);
+            break;
+
         default:
             G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
             break;
@@ -582,6 +1439,14 @@ static void books_epub_class_init(BooksEpubClass *klass)
     gobject_class->dispose = books_epub_dispose;
     gobject_class->finalize = books_epub_finalize;
 
+    g_object_class_install_property (gobject_class,
+                                     PROP_STRIP_STYLE_SHEETS,
+                                     g_param_spec_boolean ("strip-style-sheets",
+                                                           "Remove publisher style sheets",
+                                                           "Remove publisher style sheets",
+                                                           FALSE,
+                                                           G_PARAM_READWRITE));
+
     g_type_class_add_private(klass, sizeof(BooksEpubPrivate));
 }
 
@@ -590,11 +1455,24 @@ static void books_epub_init(BooksEpub *self)
     BooksEpubPrivate *priv;
 
     self->priv = priv = BOOKS_EPUB_GET_PRIVATE (self);
-    priv->documents = NULL;
-    priv->path = NULL;
+    priv->documents = g_ptr_array_new_with_free_func (g_free);
+    priv->document_positions = g_hash_table_new (g_str_hash, g_str_equal);
+    priv->position = 0;
+    priv->archive = NULL;
+    priv->fingerprint = NULL;
+    priv->host = NULL;
+    priv->opf_path = NULL;
     priv->cover_path = NULL;
+    priv->cover_data = NULL;
     priv->opf_prefix = NULL;
-    priv->opf_tree = NULL;
-    priv->opf_xpath_context = NULL;
+    priv->cover_id = NULL;
+    priv->filename = NULL;
+    priv->offset = 0.0;
+    priv->state = NULL;
+    priv->strip_style_sheets = FALSE;
+    priv->manifest = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                            g_free, (GDestroyNotify) manifest_item_free);
+    priv->metadata = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+    priv->spine = g_ptr_array_new_with_free_func (g_free);
 }
 
@@ -1,7 +1,7 @@
 #ifndef BOOKS_EPUB_H
 #define BOOKS_EPUB_H
 
-#include <glib-object.h>
+#include <gio/gio.h>
 
 G_BEGIN_DECLS
 
@@ -14,11 +14,15 @@ G_BEGIN_DECLS
 
 #define BOOKS_EPUB_ERROR books_epub_error_quark()
 
+#define BOOKS_EPUB_URI_SCHEME "epub"
+
 typedef enum {
     BOOKS_EPUB_ERROR_INVALID_ARCHIVE_FORMAT,
     BOOKS_EPUB_ERROR_NO_META_DATA
 } BooksEpubError;
 
+typedef void (*BooksEpubProgressCallback) (gdouble fraction, gpointer user_data);
+
 typedef struct _BooksEpub           BooksEpub;
 typedef struct _BooksEpubClass      BooksEpubClass;
 typedef struct _BooksEpubPrivate    BooksEpubPrivate;
@@ -33,22 +37,57 @@ struct _BooksEpubClass {
     GObjectClass parent_class;
 };
 
-BooksEpub     * books_epub_new          (void);
-gboolean        books_epub_open         (BooksEpub      *epub,
-                                         const gchar   *filename,
-                                         GError       **error);
-const gchar   * books_epub_get_meta     (BooksEpub      *epub,
-                                         gchar          *key);
-const gchar   * books_epub_get_uri      (BooksEpub      *epub);
-void            books_epub_set_uri      (BooksEpub      *epub,
-                                         const gchar    *uri);
-const gchar   * books_epub_get_cover    (BooksEpub      *epub);
-void            books_epub_next         (BooksEpub      *epub);
-void            books_epub_previous     (BooksEpub      *epub);
-gboolean        books_epub_is_first     (BooksEpub      *epub);
-gboolean        books_epub_is_last      (BooksEpub      *epub);
-GType           books_epub_get_type     (void);
-GQuark          books_epub_error_quark  (void);
+BooksEpub     * books_epub_new               (void);
+gboolean        books_epub_open              (BooksEpub                *epub,
+                                              const gchar              *filename,
+                                              GError                  **error);
+void            books_epub_open_async        (BooksEpub                *epub,
+                                              const gchar              *filename,
+                                              GCancellable             *cancellable,
+                                              BooksEpubProgressCallback progress_callback,
+                                              gpointer                  progress_data,
+                                              GAsyncReadyCallback       callback,
+                                              gpointer                  user_data);
+gboolean        books_epub_open_finish       (BooksEpub                *epub,
+                                              GAsyncResult             *result,
+                                              GError                  **error);
+gboolean        books_epub_open_metadata     (BooksEpub                *epub,
+                                              const gchar              *filename,
+                                              GError                  **error);
+BooksEpub     * books_epub_lookup            (const gchar              *host);
+GBytes        * books_epub_read_resource     (BooksEpub                *epub,
+                                              const gchar              *path,
+                                              GError                  **error);
+const gchar   * books_epub_get_meta          (BooksEpub                *epub,
+                                              gchar                    *key);
+gchar         * books_epub_get_document_text (BooksEpub                *epub,
+                                              guint                     position,
+                                              GError                  **error);
+const gchar   * books_epub_get_uri           (BooksEpub                *epub);
+void            books_epub_set_uri           (BooksEpub                *epub,
+                                              const gchar              *uri);
+const gchar   * books_epub_get_document_uri  (BooksEpub                *epub,
+                                              guint                     position);
+guint           books_epub_get_position      (BooksEpub                *epub);
+guint           books_epub_get_n_documents   (BooksEpub                *epub);
+void            books_epub_seek              (BooksEpub                *epub,
+                                              guint                     position);
+const gchar   * books_epub_get_cover         (BooksEpub                *epub);
+GBytes        * books_epub_get_cover_data    (BooksEpub                *epub);
+const gchar   * books_epub_get_filename      (BooksEpub                *epub);
+gdouble         books_epub_get_offset        (BooksEpub                *epub);
+void            books_epub_set_offset        (BooksEpub                *epub,
+                                              gdouble                   offset);
+GVariant      * books_epub_get_state         (BooksEpub                *epub);
+void            books_epub_set_state         (BooksEpub                *epub,
+                                              GVariant                 *state);
+const gchar   * books_epub_get_fingerprint   (BooksEpub                *epub);
+void            books_epub_next              (BooksEpub                *epub);
+void            books_epub_previous          (BooksEpub                *epub);
+gboolean        books_epub_is_first          (BooksEpub                *epub);
+gboolean        books_epub_is_last           (BooksEpub                *epub);
+GType           books_epub_get_type          (void);
+GQuark          books_epub_error_quark       (void);
 
 G_END_DECLS
 
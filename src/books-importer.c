@@ -0,0 +1,622 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib/gi18n.h>
+
+#include "books-importer.h"
+#include "books-epub.h"
+
+
+G_DEFINE_TYPE(BooksImporter, books_importer, G_TYPE_OBJECT)
+
+#define BOOKS_IMPORTER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_IMPORTER, BooksImporterPrivate))
+
+/* Books inserted per transaction and appended to the model at once */
+#define BATCH_SIZE          200
+
+/* Interval in milliseconds in which parsed books are collected */
+#define BATCH_INTERVAL      100
+
+/* Directories enumerated at the same time */
+#define MAX_WALKERS         4
+
+/* Directory entries requested at once */
+#define FILES_PER_REQUEST   64
+
+/* Found files looked up in the collection at once */
+#define CHECK_SIZE          100
+
+/*
+ * Parses the metadata and covers of new books on a pool of threads. The
+ * main thread picks up the results in batches, so that the model and the
+ * database see a few large updates instead of thousands of small ones.
+ * Files are streamed into the pool as they are found and checked against
+ * the collection, so an import can start before a folder scan has ended.
+ */
+struct _BooksImporterPrivate {
+    BooksCollection *collection;
+    GHashTable      *importing;
+};
+
+typedef struct {
+    GThreadPool                    *pool;
+    GAsyncQueue                    *results;
+    GHashTable                     *seen;
+    GQueue                         *directories;
+    GPtrArray                      *found;
+    BooksImporterProgressCallback   progress_callback;
+    gpointer                        progress_data;
+    guint                           n_total;
+    guint                           n_processed;
+    guint                           n_pending;
+    guint                           n_checks;
+    guint                           n_walkers;
+    gboolean                        completed;
+} ImportData;
+
+/* Pushed for each file, item is NULL if the file could not be parsed */
+typedef struct {
+    gchar               *path;
+    BooksCollectionItem *item;
+} ParseResult;
+
+static void complete_import (GTask *task);
+
+
+BooksImporter *
+books_importer_new (BooksCollection *collection)
+{
+    BooksImporter *importer;
+
+    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection), NULL);
+
+    importer = BOOKS_IMPORTER (g_object_new (BOOKS_TYPE_IMPORTER, NULL));
+    importer->priv->collection = g_object_ref (collection);
+
+    return importer;
+}
+
+static void
+import_data_free (ImportData *data)
+{
+    ParseResult *result;
+
+    /* All jobs have been processed at this point, so this does not block */
+    g_thread_pool_free (data->pool, TRUE, TRUE);
+
+    while ((result = g_async_queue_try_pop (data->results)) != NULL) {
+        if (result->item != NULL)
+            books_collection_item_free (result->item);
+
+        g_free (result->path);
+        g_free (result);
+    }
+
+    g_async_queue_unref (data->results);
+    g_hash_table_destroy (data->seen);
+    g_queue_free_full (data->directories, g_object_unref);
+    g_ptr_array_unref (data->found);
+    g_free (data);
+}
+
+static void
+parse_book (gchar *filename,
+            GTask *task)
+{
+    ImportData *data;
+    ParseResult *result;
+
+    data = g_task_get_task_data (task);
+    result = g_new0 (ParseResult, 1);
+    result->path = filename;
+
+    /* Remaining files are skipped quickly, but still counted */
+    if (!g_cancellable_is_cancelled (g_task_get_cancellable (task))) {
+        BooksEpub *epub;
+        GError *error = NULL;
+
+        epub = books_epub_new ();
+
+        if (books_epub_open_metadata (epub, filename, &error)) {
+            result->item = books_collection_item_new (epub, filename);
+        }
+        else {
+            g_printerr (_("Could not import `%s': %s\n"), filename, error->message);
+            g_error_free (error);
+        }
+
+        g_object_unref (epub);
+    }
+
+    g_async_queue_push (data->results, result);
+}
+
+static void
+on_new_files_found (GObject *source,
+                    GAsyncResult *result,
+                    gpointer user_data)
+{
+    BooksImporter *importer;
+    GTask *task;
+    ImportData *data;
+    GPtrArray *paths;
+    GError *error = NULL;
+    guint i;
+
+    task = G_TASK (user_data);
+    importer = BOOKS_IMPORTER (g_task_get_source_object (task));
+    data = g_task_get_task_data (task);
+    paths = books_collection_filter_new_files_finish (BOOKS_COLLECTION (source), result, &error);
+    data->n_checks--;
+
+    if (paths == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not import books: %s\n"), error->message);
+
+        g_error_free (error);
+        complete_import (task);
+        g_object_unref (task);
+        return;
+    }
+
+    for (i = 0; i < paths->len; i++) {
+        const gchar *path;
+
+        path = g_ptr_array_index (paths, i);
+
+        /*
+         * Another import may have found the same file, it is not in the
+         * database before that import has queued the insert.
+         */
+        if (g_hash_table_contains (importer->priv->importing, path))
+            continue;
+
+        g_hash_table_add (importer->priv->importing, g_strdup (path));
+        data->n_total++;
+        g_thread_pool_push (data->pool, g_strdup (path), NULL);
+    }
+
+    g_ptr_array_unref (paths);
+    complete_import (task);
+    g_object_unref (task);
+}
+
+/*
+ * Hands the collected file names over to the collection, which sorts out
+ * books that have been imported before.
+ */
+static void
+check_found_files (GTask *task)
+{
+    BooksImporter *importer;
+    ImportData *data;
+
+    importer = BOOKS_IMPORTER (g_task_get_source_object (task));
+    data = g_task_get_task_data (task);
+
+    if (data->found->len == 0)
+        return;
+
+    data->n_checks++;
+    books_collection_filter_new_files_async (importer->priv->collection, data->found,
+                                             g_task_get_cancellable (task),
+                                             on_new_files_found, g_object_ref (task));
+
+    g_ptr_array_unref (data->found);
+    data->found = g_ptr_array_new_with_free_func (g_free);
+}
+
+static void
+add_found_file (GTask *task,
+                const gchar *filename)
+{
+    ImportData *data;
+
+    data = g_task_get_task_data (task);
+
+    /* The same file may be selected twice or reached through several folders */
+    if (g_hash_table_contains (data->seen, filename))
+        return;
+
+    g_hash_table_add (data->seen, g_strdup (filename));
+    g_ptr_array_add (data->found, g_strdup (filename));
+
+    if (data->found->len >= CHECK_SIZE)
+        check_found_files (task);
+}
+
+static void walk_directories (GTask *task);
+
+static void
+finish_walker (GTask *task)
+{
+    ImportData *data;
+
+    data = g_task_get_task_data (task);
+    data->n_walkers--;
+
+    check_found_files (task);
+    walk_directories (task);
+    complete_import (task);
+    g_object_unref (task);
+}
+
+static void
+on_next_files (GObject *source,
+               GAsyncResult *result,
+               gpointer user_data)
+{
+    GTask *task;
+    ImportData *data;
+    GFileEnumerator *enumerator;
+    GFile *directory;
+    GList *infos;
+    GList *it;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    enumerator = G_FILE_ENUMERATOR (source);
+    infos = g_file_enumerator_next_files_finish (enumerator, result, &error);
+
+    if (infos == NULL) {
+        if (error != NULL) {
+            if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+                g_printerr (_("Could not read folder: %s\n"), error->message);
+
+            g_error_free (error);
+        }
+
+        g_object_unref (enumerator);
+        finish_walker (task);
+        return;
+    }
+
+    data = g_task_get_task_data (task);
+    directory = g_file_enumerator_get_container (enumerator);
+
+    for (it = infos; it != NULL; it = g_list_next (it)) {
+        GFileInfo *info;
+        GFile *child;
+        const gchar *name;
+
+        info = G_FILE_INFO (it->data);
+        name = g_file_info_get_name (info);
+
+        /* Links are not followed, which keeps loops out of the walk */
+        switch (g_file_info_get_file_type (info)) {
+            case G_FILE_TYPE_DIRECTORY:
+                g_queue_push_tail (data->directories, g_file_get_child (directory, name));
+                break;
+
+            case G_FILE_TYPE_REGULAR:
+                if (g_str_has_suffix (name, ".epub") || g_str_has_suffix (name, ".EPUB")) {
+                    gchar *path;
+
+                    child = g_file_get_child (directory, name);
+                    path = g_file_get_path (child);
+
+                    if (path != NULL)
+                        add_found_file (task, path);
+
+                    g_free (path);
+                    g_object_unref (child);
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+
+    g_list_free_full (infos, g_object_unref);
+
+    /* Subdirectories found so far are walked in parallel */
+    walk_directories (task);
+
+    g_file_enumerator_next_files_async (enumerator, FILES_PER_REQUEST, G_PRIORITY_LOW,
+                                        g_task_get_cancellable (task), on_next_files, task);
+}
+
+static void
+on_children_enumerated (GObject *source,
+                        GAsyncResult *result,
+                        gpointer user_data)
+{
+    GTask *task;
+    GFileEnumerator *enumerator;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    enumerator = g_file_enumerate_children_finish (G_FILE (source), result, &error);
+
+    if (enumerator == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not read folder: %s\n"), error->message);
+
+        g_error_free (error);
+        finish_walker (task);
+        return;
+    }
+
+    g_file_enumerator_next_files_async (enumerator, FILES_PER_REQUEST, G_PRIORITY_LOW,
+                                        g_task_get_cancellable (task), on_next_files, task);
+}
+
+/*
+ * Starts enumerating queued directories until MAX_WALKERS of them are in
+ * progress. Every walker holds a reference on the task.
+ */
+static void
+walk_directories (GTask *task)
+{
+    ImportData *data;
+    GCancellable *cancellable;
+
+    data = g_task_get_task_data (task);
+    cancellable = g_task_get_cancellable (task);
+
+    if (g_cancellable_is_cancelled (cancellable)) {
+        g_queue_free_full (data->directories, g_object_unref);
+        data->directories = g_queue_new ();
+        return;
+    }
+
+    while (data->n_walkers < MAX_WALKERS && !g_queue_is_empty (data->directories)) {
+        GFile *directory;
+
+        directory = G_FILE (g_queue_pop_head (data->directories));
+        data->n_walkers++;
+
+        g_file_enumerate_children_async (directory,
+                                         G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                         G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                         G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                         G_PRIORITY_LOW, cancellable,
+                                         on_children_enumerated, g_object_ref (task));
+
+        g_object_unref (directory);
+    }
+}
+
+static gboolean
+is_finished (ImportData *data)
+{
+    return data->n_walkers == 0 &&
+           data->n_checks == 0 &&
+           g_queue_is_empty (data->directories) &&
+           data->n_processed == data->n_total;
+}
+
+static void
+complete_import (GTask *task)
+{
+    ImportData *data;
+
+    data = g_task_get_task_data (task);
+
+    if (data->completed || data->n_pending > 0 || !is_finished (data))
+        return;
+
+    data->completed = TRUE;
+
+    if (!g_task_return_error_if_cancelled (task))
+        g_task_return_boolean (task, TRUE);
+}
+
+static void
+on_batch_added (GObject *source,
+                GAsyncResult *result,
+                gpointer user_data)
+{
+    GTask *task;
+    ImportData *data;
+    GError *error = NULL;
+
+    task = G_TASK (user_data);
+    data = g_task_get_task_data (task);
+
+    if (!books_collection_add_items_finish (BOOKS_COLLECTION (source), result, &error)) {
+        g_printerr (_("Could not add books: %s\n"), error->message);
+        g_error_free (error);
+    }
+
+    data->n_pending--;
+    complete_import (task);
+    g_object_unref (task);
+}
+
+static gboolean
+flush_results (GTask *task)
+{
+    BooksImporter *importer;
+    ImportData *data;
+    GPtrArray *items;
+    GPtrArray *done;
+    ParseResult *result;
+    gboolean cancelled;
+    guint i;
+
+    importer = BOOKS_IMPORTER (g_task_get_source_object (task));
+    data = g_task_get_task_data (task);
+    cancelled = g_cancellable_is_cancelled (g_task_get_cancellable (task));
+    items = g_ptr_array_new_with_free_func ((GDestroyNotify) books_collection_item_free);
+    done = g_ptr_array_new_with_free_func (g_free);
+
+    while (items->len < BATCH_SIZE && (result = g_async_queue_try_pop (data->results)) != NULL) {
+        data->n_processed++;
+
+        if (result->item != NULL) {
+            if (cancelled)
+                books_collection_item_free (result->item);
+            else
+                g_ptr_array_add (items, result->item);
+        }
+
+        g_ptr_array_add (done, result->path);
+        g_free (result);
+    }
+
+    if (items->len > 0) {
+        data->n_pending++;
+        books_collection_add_items_async (importer->priv->collection, items,
+                                          on_batch_added, g_object_ref (task));
+    }
+
+    /* Lookups queued from now on see the inserted books */
+    for (i = 0; i < done->len; i++)
+        g_hash_table_remove (importer->priv->importing, g_ptr_array_index (done, i));
+
+    g_ptr_array_unref (done);
+
+    g_ptr_array_unref (items);
+
+    if (data->progress_callback != NULL)
+        data->progress_callback (data->n_processed, data->n_total, data->progress_data);
+
+    if (!is_finished (data))
+        return G_SOURCE_CONTINUE;
+
+    complete_import (task);
+    return G_SOURCE_REMOVE;
+}
+
+static GTask *
+start_import (BooksImporter *importer,
+              GCancellable *cancellable,
+              BooksImporterProgressCallback progress_callback,
+              gpointer progress_data,
+              GAsyncReadyCallback callback,
+              gpointer user_data)
+{
+    GTask *task;
+    ImportData *data;
+
+    task = g_task_new (importer, cancellable, callback, user_data);
+
+    data = g_new0 (ImportData, 1);
+    data->results = g_async_queue_new ();
+    data->seen = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    data->directories = g_queue_new ();
+    data->found = g_ptr_array_new_with_free_func (g_free);
+    data->progress_callback = progress_callback;
+    data->progress_data = progress_data;
+    data->pool = g_thread_pool_new ((GFunc) parse_book, task,
+                                    (gint) g_get_num_processors (), FALSE, NULL);
+    g_task_set_task_data (task, data, (GDestroyNotify) import_data_free);
+
+    g_timeout_add_full (G_PRIORITY_DEFAULT_IDLE, BATCH_INTERVAL,
+                        (GSourceFunc) flush_results, g_object_ref (task), g_object_unref);
+
+    return task;
+}
+
+/*
+ * Adds the EPUB files in @filenames to the collection, skipping those that
+ * are part of it already. Books appear in the collection while the import
+ * is running, cancelling it keeps those that have already been added.
+ */
+void
+books_importer_import_async (BooksImporter *importer,
+                             GSList *filenames,
+                             GCancellable *cancellable,
+                             BooksImporterProgressCallback progress_callback,
+                             gpointer progress_data,
+                             GAsyncReadyCallback callback,
+                             gpointer user_data)
+{
+    GTask *task;
+    GSList *it;
+
+    g_return_if_fail (BOOKS_IS_IMPORTER (importer));
+
+    task = start_import (importer, cancellable, progress_callback, progress_data, callback, user_data);
+
+    for (it = filenames; it != NULL; it = g_slist_next (it))
+        add_found_file (task, (const gchar *) it->data);
+
+    check_found_files (task);
+    g_object_unref (task);
+}
+
+/*
+ * Like books_importer_import_async for all EPUB files found below
+ * @folder. Finish with books_importer_import_finish.
+ */
+void
+books_importer_import_folder_async (BooksImporter *importer,
+                                    GFile *folder,
+                                    GCancellable *cancellable,
+                                    BooksImporterProgressCallback progress_callback,
+                                    gpointer progress_data,
+                                    GAsyncReadyCallback callback,
+                                    gpointer user_data)
+{
+    GTask *task;
+    ImportData *data;
+
+    g_return_if_fail (BOOKS_IS_IMPORTER (importer) && G_IS_FILE (folder));
+
+    task = start_import (importer, cancellable, progress_callback, progress_data, callback, user_data);
+    data = g_task_get_task_data (task);
+
+    g_queue_push_tail (data->directories, g_object_ref (folder));
+    walk_directories (task);
+    g_object_unref (task);
+}
+
+gboolean
+books_importer_import_finish (BooksImporter *importer,
+                              GAsyncResult *result,
+                              GError **error)
+{
+    g_return_val_if_fail (g_task_is_valid (result, importer), FALSE);
+    return g_task_propagate_boolean (G_TASK (result), error);
+}
+
+static void
+books_importer_dispose (GObject *object)
+{
+    BooksImporterPrivate *priv;
+
+    priv = BOOKS_IMPORTER_GET_PRIVATE (object);
+
+    if (priv->collection != NULL) {
+        g_object_unref (priv->collection);
+        priv->collection = NULL;
+    }
+
+    G_OBJECT_CLASS (books_importer_parent_class)->dispose (object);
+}
+
+static void
+books_importer_finalize (GObject *object)
+{
+    BooksImporterPrivate *priv;
+
+    priv = BOOKS_IMPORTER_GET_PRIVATE (object);
+    g_hash_table_destroy (priv->importing);
+
+    G_OBJECT_CLASS (books_importer_parent_class)->finalize (object);
+}
+
+static void
+books_importer_class_init (BooksImporterClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = books_importer_dispose;
+    object_class->finalize = books_importer_finalize;
+
+    g_type_class_add_private (klass, sizeof(BooksImporterPrivate));
+}
+
+static void
+books_importer_init (BooksImporter *importer)
+{
+    BooksImporterPrivate *priv;
+
+    importer->priv = priv = BOOKS_IMPORTER_GET_PRIVATE (importer);
+    priv->collection = NULL;
+    priv->importing = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+}
@@ -0,0 +1,54 @@
+#ifndef BOOKS_IMPORTER_H
+#define BOOKS_IMPORTER_H
+
+#include <gio/gio.h>
+#include "books-collection.h"
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_IMPORTER             (books_importer_get_type())
+#define BOOKS_IMPORTER(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_IMPORTER, BooksImporter))
+#define BOOKS_IS_IMPORTER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_IMPORTER))
+#define BOOKS_IMPORTER_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_IMPORTER, BooksImporterClass))
+#define BOOKS_IS_IMPORTER_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_IMPORTER))
+#define BOOKS_IMPORTER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_IMPORTER, BooksImporterClass))
+
+typedef void (*BooksImporterProgressCallback) (guint n_processed, guint n_total, gpointer user_data);
+
+typedef struct _BooksImporter           BooksImporter;
+typedef struct _BooksImporterClass      BooksImporterClass;
+typedef struct _BooksImporterPrivate    BooksImporterPrivate;
+
+struct _BooksImporter {
+    GObject parent_instance;
+
+    BooksImporterPrivate *priv;
+};
+
+struct _BooksImporterClass {
+    GObjectClass parent_class;
+};
+
+BooksImporter * books_importer_new                 (BooksCollection              *collection);
+void            books_importer_import_async        (BooksImporter                *importer,
+                                                    GSList                       *filenames,
+                                                    GCancellable                 *cancellable,
+                                                    BooksImporterProgressCallback progress_callback,
+                                                    gpointer                      progress_data,
+                                                    GAsyncReadyCallback           callback,
+                                                    gpointer                      user_data);
+void            books_importer_import_folder_async (BooksImporter                *importer,
+                                                    GFile                        *folder,
+                                                    GCancellable                 *cancellable,
+                                                    BooksImporterProgressCallback progress_callback,
+                                                    gpointer                      progress_data,
+                                                    GAsyncReadyCallback           callback,
+                                                    gpointer                      user_data);
+gboolean        books_importer_import_finish       (BooksImporter                *importer,
+                                                    GAsyncResult                 *result,
+                                                    GError                      **error);
+GType           books_importer_get_type            (void);
+
+G_END_DECLS
+
+#endif
@@ -0,0 +1,451 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <sqlite3.h>
+#include <glib/gi18n.h>
+
+#include "books-indexer.h"
+#include "books-epub.h"
+
+
+G_DEFINE_TYPE(BooksIndexer, books_indexer, G_TYPE_OBJECT)
+
+#define BOOKS_INDEXER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_INDEXER, BooksIndexerPrivate))
+
+/* Spine documents written per transaction */
+#define CHUNK_SIZE      4
+
+/* Bits of a contents rowid that hold the spine position, see setup_db */
+#define POSITION_BITS   20
+
+/* Time without user input before indexing continues */
+#define IDLE_DELAY      (G_USEC_PER_SEC)
+
+/* Waits before writing again while another connection holds the database */
+#define MIN_RETRY_DELAY (G_USEC_PER_SEC)
+#define MAX_RETRY_DELAY (60 * G_USEC_PER_SEC)
+
+/*
+ * Indexes books marked as queued in meta.db on a thread with its own
+ * connection. Progress is committed every few documents together with the
+ * spine position to resume from, so nothing is lost if Books is closed.
+ */
+struct _BooksIndexerPrivate {
+    gchar      *db_filename;
+    GThread    *thread;
+    GMutex      lock;
+    GCond       cond;
+    gboolean    running;
+    gboolean    pending;
+    gint64      last_activity;
+};
+
+static gpointer index_books (BooksIndexerPrivate *priv);
+
+
+BooksIndexer *
+books_indexer_new (const gchar *db_filename)
+{
+    BooksIndexer *indexer;
+    BooksIndexerPrivate *priv;
+
+    g_return_val_if_fail (db_filename != NULL, NULL);
+
+    indexer = BOOKS_INDEXER (g_object_new (BOOKS_TYPE_INDEXER, NULL));
+    priv = indexer->priv;
+    priv->db_filename = g_strdup (db_filename);
+    priv->running = TRUE;
+    priv->thread = g_thread_new ("indexer", (GThreadFunc) index_books, priv);
+
+    return indexer;
+}
+
+/*
+ * Tells the indexer that new books have been queued.
+ */
+void
+books_indexer_wake_up (BooksIndexer *indexer)
+{
+    BooksIndexerPrivate *priv;
+
+    g_return_if_fail (BOOKS_IS_INDEXER (indexer));
+
+    priv = indexer->priv;
+    g_mutex_lock (&priv->lock);
+    priv->pending = TRUE;
+    g_cond_signal (&priv->cond);
+    g_mutex_unlock (&priv->lock);
+}
+
+/*
+ * Postpones indexing until the user has not interacted with the UI for a
+ * while, so that the disk and CPU are free when they are needed.
+ */
+void
+books_indexer_notify_activity (BooksIndexer *indexer)
+{
+    BooksIndexerPrivate *priv;
+
+    g_return_if_fail (BOOKS_IS_INDEXER (indexer));
+
+    priv = indexer->priv;
+    g_mutex_lock (&priv->lock);
+    priv->last_activity = g_get_monotonic_time ();
+    g_mutex_unlock (&priv->lock);
+}
+
+static gboolean
+wait_until_idle (BooksIndexerPrivate *priv)
+{
+    gboolean running;
+
+    g_mutex_lock (&priv->lock);
+
+    while (priv->running) {
+        gint64 idle_time;
+
+        idle_time = priv->last_activity + IDLE_DELAY;
+
+        if (g_get_monotonic_time () >= idle_time)
+            break;
+
+        g_cond_wait_until (&priv->cond, &priv->lock, idle_time);
+    }
+
+    running = priv->running;
+    g_mutex_unlock (&priv->lock);
+    return running;
+}
+
+static gboolean
+wait_for_books (BooksIndexerPrivate *priv)
+{
+    gboolean running;
+
+    g_mutex_lock (&priv->lock);
+
+    while (priv->running && !priv->pending)
+        g_cond_wait (&priv->cond, &priv->lock);
+
+    running = priv->running;
+    g_mutex_unlock (&priv->lock);
+    return running;
+}
+
+static gboolean
+wait_before_retry (BooksIndexerPrivate *priv,
+                   gint64 delay)
+{
+    gboolean running;
+    gint64 end_time;
+
+    end_time = g_get_monotonic_time () + delay;
+    g_mutex_lock (&priv->lock);
+
+    while (priv->running) {
+        if (!g_cond_wait_until (&priv->cond, &priv->lock, end_time))
+            break;
+    }
+
+    running = priv->running;
+    g_mutex_unlock (&priv->lock);
+    return running;
+}
+
+static gchar *
+get_next_book (sqlite3 *db,
+               gint64 *id,
+               guint *position)
+{
+    sqlite3_stmt *select_stmt = NULL;
+    gchar *path = NULL;
+
+    sqlite3_prepare_v2 (db, "SELECT id, path, index_position FROM books WHERE index_status=? LIMIT 1",
+                        -1, &select_stmt, NULL);
+    sqlite3_bind_int (select_stmt, 1, BOOKS_INDEX_STATUS_QUEUED);
+
+    if (sqlite3_step (select_stmt) == SQLITE_ROW) {
+        *id = sqlite3_column_int64 (select_stmt, 0);
+        path = g_strdup ((const gchar *) sqlite3_column_text (select_stmt, 1));
+        *position = (guint) sqlite3_column_int (select_stmt, 2);
+    }
+
+    sqlite3_finalize (select_stmt);
+    return path;
+}
+
+static void
+set_status (sqlite3 *db,
+            const gchar *path,
+            BooksIndexStatus status)
+{
+    sqlite3_stmt *update_stmt = NULL;
+
+    sqlite3_prepare_v2 (db, "UPDATE books SET index_status=? WHERE path=?", -1, &update_stmt, NULL);
+    sqlite3_bind_int (update_stmt, 1, status);
+    sqlite3_bind_text (update_stmt, 2, path, strlen (path), NULL);
+    sqlite3_step (update_stmt);
+    sqlite3_finalize (update_stmt);
+}
+
+static gint
+step_statement (sqlite3 *db,
+                sqlite3_stmt *stmt)
+{
+    gint result;
+
+    result = sqlite3_step (stmt);
+
+    if (result != SQLITE_DONE) {
+        g_printerr (_("Could not update index: %s\n"), sqlite3_errmsg (db));
+        return result;
+    }
+
+    sqlite3_reset (stmt);
+    return SQLITE_OK;
+}
+
+/*
+ * Writes up to CHUNK_SIZE documents starting at @position and the new
+ * checkpoint in one transaction. Returns SQLITE_BUSY or SQLITE_LOCKED if
+ * another connection holds the database and SQLITE_NOTFOUND if the book
+ * has been removed from the collection in the meantime.
+ */
+static gint
+index_chunk (sqlite3 *db,
+             BooksEpub *epub,
+             gint64 id,
+             const gchar *path,
+             guint *position)
+{
+    sqlite3_stmt *delete_stmt = NULL;
+    sqlite3_stmt *insert_stmt = NULL;
+    sqlite3_stmt *update_stmt = NULL;
+    guint n_documents;
+    guint end;
+    guint i;
+    gint result;
+
+    result = sqlite3_exec (db, "BEGIN IMMEDIATE", NULL, NULL, NULL);
+
+    if (result != SQLITE_OK)
+        return result;
+
+    sqlite3_prepare_v2 (db, "DELETE FROM contents WHERE rowid BETWEEN ? AND ?", -1, &delete_stmt, NULL);
+    sqlite3_prepare_v2 (db, "INSERT INTO contents (rowid, text) VALUES (?, ?)", -1, &insert_stmt, NULL);
+    sqlite3_prepare_v2 (db, "UPDATE books SET index_position=? WHERE path=? AND index_status=?", -1, &update_stmt, NULL);
+
+    /* Text from an earlier, interrupted run would be indexed twice */
+    if (*position == 0) {
+        sqlite3_bind_int64 (delete_stmt, 1, id << POSITION_BITS);
+        sqlite3_bind_int64 (delete_stmt, 2, (id << POSITION_BITS) + (1 << POSITION_BITS) - 1);
+
+        if ((result = step_statement (db, delete_stmt)) != SQLITE_OK)
+            goto out;
+    }
+
+    n_documents = MIN (books_epub_get_n_documents (epub), 1 << POSITION_BITS);
+    end = MIN (*position + CHUNK_SIZE, n_documents);
+
+    for (i = *position; i < end; i++) {
+        gchar *text;
+        GError *error = NULL;
+
+        text = books_epub_get_document_text (epub, i, &error);
+
+        /* A single broken chapter should not keep the rest out of the index */
+        if (text == NULL) {
+            g_printerr (_("Could not index `%s': %s\n"), path, error->message);
+            g_error_free (error);
+            continue;
+        }
+
+        sqlite3_bind_int64 (insert_stmt, 1, (id << POSITION_BITS) + i);
+        sqlite3_bind_text (insert_stmt, 2, text, strlen (text), g_free);
+
+        if ((result = step_statement (db, insert_stmt)) != SQLITE_OK)
+            goto out;
+    }
+
+    sqlite3_bind_int (update_stmt, 1, (int) end);
+    sqlite3_bind_text (update_stmt, 2, path, strlen (path), NULL);
+    sqlite3_bind_int (update_stmt, 3, BOOKS_INDEX_STATUS_QUEUED);
+
+    if ((result = step_statement (db, update_stmt)) != SQLITE_OK)
+        goto out;
+
+    if (sqlite3_changes (db) == 0)
+        result = SQLITE_NOTFOUND;
+
+out:
+    sqlite3_finalize (delete_stmt);
+    sqlite3_finalize (insert_stmt);
+    sqlite3_finalize (update_stmt);
+
+    if (result == SQLITE_OK)
+        result = sqlite3_exec (db, "COMMIT", NULL, NULL, NULL);
+
+    if (result != SQLITE_OK) {
+        sqlite3_exec (db, "ROLLBACK", NULL, NULL, NULL);
+        return result;
+    }
+
+    *position = end;
+    return SQLITE_OK;
+}
+
+static void
+index_book (BooksIndexerPrivate *priv,
+            sqlite3 *db,
+            gint64 id,
+            const gchar *path,
+            guint position)
+{
+    BooksEpub *epub;
+    GError *error = NULL;
+    gint64 retry_delay = MIN_RETRY_DELAY;
+    guint n_documents;
+
+    epub = books_epub_new ();
+
+    if (!books_epub_open (epub, path, &error)) {
+        g_printerr (_("Could not index `%s': %s\n"), path, error->message);
+        g_error_free (error);
+        set_status (db, path, BOOKS_INDEX_STATUS_FAILED);
+        g_object_unref (epub);
+        return;
+    }
+
+    n_documents = MIN (books_epub_get_n_documents (epub), 1 << POSITION_BITS);
+
+    while (position < n_documents) {
+        gint result;
+
+        if (!wait_until_idle (priv))
+            break;
+
+        result = index_chunk (db, epub, id, path, &position);
+
+        /* An import may hold the database for a while, the book stays queued */
+        if (result == SQLITE_BUSY || result == SQLITE_LOCKED) {
+            if (!wait_before_retry (priv, retry_delay))
+                break;
+
+            retry_delay = MIN (retry_delay * 2, MAX_RETRY_DELAY);
+            continue;
+        }
+
+        if (result != SQLITE_OK) {
+            set_status (db, path, BOOKS_INDEX_STATUS_FAILED);
+            break;
+        }
+
+        retry_delay = MIN_RETRY_DELAY;
+    }
+
+    if (position >= n_documents)
+        set_status (db, path, BOOKS_INDEX_STATUS_INDEXED);
+
+    g_object_unref (epub);
+}
+
+static gpointer
+index_books (BooksIndexerPrivate *priv)
+{
+    sqlite3 *db;
+
+    if (sqlite3_open (priv->db_filename, &db) != SQLITE_OK) {
+        g_warning (_("Could not open database: %s\n"), sqlite3_errmsg (db));
+        sqlite3_close (db);
+        return NULL;
+    }
+
+    sqlite3_busy_timeout (db, 5000);
+
+    while (wait_until_idle (priv)) {
+        gchar *path;
+        gint64 id = 0;
+        guint position = 0;
+
+        g_mutex_lock (&priv->lock);
+        priv->pending = FALSE;
+        g_mutex_unlock (&priv->lock);
+
+        path = get_next_book (db, &id, &position);
+
+        if (path == NULL) {
+            if (!wait_for_books (priv))
+                break;
+
+            continue;
+        }
+
+        index_book (priv, db, id, path, position);
+        g_free (path);
+    }
+
+    sqlite3_close (db);
+    return NULL;
+}
+
+static void
+books_indexer_dispose (GObject *object)
+{
+    BooksIndexerPrivate *priv;
+
+    priv = BOOKS_INDEXER_GET_PRIVATE (object);
+
+    if (priv->thread != NULL) {
+        g_mutex_lock (&priv->lock);
+        priv->running = FALSE;
+        g_cond_signal (&priv->cond);
+        g_mutex_unlock (&priv->lock);
+
+        g_thread_join (priv->thread);
+        priv->thread = NULL;
+    }
+
+    G_OBJECT_CLASS (books_indexer_parent_class)->dispose (object);
+}
+
+static void
+books_indexer_finalize (GObject *object)
+{
+    BooksIndexerPrivate *priv;
+
+    priv = BOOKS_INDEXER_GET_PRIVATE (object);
+    g_free (priv->db_filename);
+    g_mutex_clear (&priv->lock);
+    g_cond_clear (&priv->cond);
+
+    G_OBJECT_CLASS (books_indexer_parent_class)->finalize (object);
+}
+
+static void
+books_indexer_class_init (BooksIndexerClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = books_indexer_dispose;
+    object_class->finalize = books_indexer_finalize;
+
+    g_type_class_add_private (klass, sizeof(BooksIndexerPrivate));
+}
+
+static void
+books_indexer_init (BooksIndexer *indexer)
+{
+    BooksIndexerPrivate *priv;
+
+    indexer->priv = priv = BOOKS_INDEXER_GET_PRIVATE (indexer);
+
+    g_mutex_init (&priv->lock);
+    g_cond_init (&priv->cond);
+    priv->db_filename = NULL;
+    priv->thread = NULL;
+    priv->running = FALSE;
+    priv->pending = FALSE;
+    priv->last_activity = 0;
+}
@@ -0,0 +1,43 @@
+#ifndef BOOKS_INDEXER_H
+#define BOOKS_INDEXER_H
+
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_INDEXER             (books_indexer_get_type())
+#define BOOKS_INDEXER(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_INDEXER, BooksIndexer))
+#define BOOKS_IS_INDEXER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_INDEXER))
+#define BOOKS_INDEXER_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_INDEXER, BooksIndexerClass))
+#define BOOKS_IS_INDEXER_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_INDEXER))
+#define BOOKS_INDEXER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_INDEXER, BooksIndexerClass))
+
+/* Values of books.index_status in meta.db */
+typedef enum {
+    BOOKS_INDEX_STATUS_QUEUED = 0,
+    BOOKS_INDEX_STATUS_INDEXED,
+    BOOKS_INDEX_STATUS_FAILED
+} BooksIndexStatus;
+
+typedef struct _BooksIndexer           BooksIndexer;
+typedef struct _BooksIndexerClass      BooksIndexerClass;
+typedef struct _BooksIndexerPrivate    BooksIndexerPrivate;
+
+struct _BooksIndexer {
+    GObject parent_instance;
+
+    BooksIndexerPrivate *priv;
+};
+
+struct _BooksIndexerClass {
+    GObjectClass parent_class;
+};
+
+BooksIndexer  * books_indexer_new             (const gchar   *db_filename);
+void            books_indexer_wake_up         (BooksIndexer  *indexer);
+void            books_indexer_notify_activity (BooksIndexer  *indexer);
+GType           books_indexer_get_type        (void);
+
+G_END_DECLS
+
+#endif
@@ -9,18 +9,30 @@
 #include "books-main-window.h"
 #include "books-window.h"
 #include "books-collection.h"
+#include "books-cache.h"
+#include "books-cover-cache.h"
+#include "books-importer.h"
+#include "books-indexer.h"
 #include "books-preferences-dialog.h"
+#include "books-removed-dialog.h"
+#include "books-search-dialog.h"
+#include "books-watcher.h"
 
 
 G_DEFINE_TYPE(BooksMainWindow, books_main_window, GTK_TYPE_WINDOW)
 
+/* Lets fast scrolling settle before covers are requested */
+#define COVER_DELAY     50
+
 #define BOOKS_MAIN_WINDOW_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_MAIN_WINDOW, BooksMainWindowPrivate))
 
 static void action_quit                 (GtkAction *, BooksMainWindow *window);
 static void action_add_book             (GtkAction *, BooksMainWindow *window);
+static void action_add_folder           (GtkAction *, BooksMainWindow *window);
 static void action_remove_selected_book (GtkAction *, BooksMainWindow *window);
 static void action_info                 (GtkAction *, BooksMainWindow *window);
 static void action_preferences          (GtkAction *, BooksMainWindow *window);
+static void action_search               (GtkAction *, BooksMainWindow *window);
 
 struct _BooksMainWindowPrivate {
     GSettings       *settings;
@@ -30,6 +42,11 @@ struct _BooksMainWindowPrivate {
     GtkContainer    *icon_scroll;
     GtkActionGroup  *action_group;
     GtkEntry        *filter_entry;
+    GtkWidget       *import_box;
+    GtkProgressBar  *import_progress;
+    GtkWidget       *missing_bar;
+    GtkLabel        *missing_label;
+    GtkListStore    *missing_books;
 
     GtkWidget       *view;
     GtkTreeView     *tree_view;
@@ -37,8 +54,18 @@ struct _BooksMainWindowPrivate {
 
     gint             width;
     gint             height;
+    guint            cover_source;
 
     BooksCollection *collection;
+    BooksIndexer    *indexer;
+    BooksImporter   *importer;
+    BooksWatcher    *watcher;
+    GCancellable    *import_cancellable;
+    GCancellable    *missing_cancellable;
+};
+
+enum {
+    MISSING_RESPONSE_DETAILS = 1
 };
 
 static GtkActionEntry action_entries[] = {
@@ -51,10 +78,18 @@ static GtkActionEntry action_entries[] = {
       N_("Add a book to the collection"),
       G_CALLBACK (action_add_book) },
 
+    { "BookAddFolder", GTK_STOCK_DIRECTORY, N_("Add Folder..."), "<control><shift>O",
+      N_("Add all books in a folder and its subfolders to the collection"),
+      G_CALLBACK (action_add_folder) },
+
     { "BookRemove", GTK_STOCK_REMOVE, N_("Remove Book"), "Delete",
       N_("Remove selected book from the collection"),
       G_CALLBACK (action_remove_selected_book) },
 
+    { "BookSearch", GTK_STOCK_FIND, N_("Search Contents..."), "<control>F",
+      N_("Search the text of all books"),
+      G_CALLBACK (action_search) },
+
     { "BookPreferences", GTK_STOCK_PREFERENCES, N_("Preferences"), "",
       N_("Preferences"),
       G_CALLBACK (action_preferences) },
@@ -111,21 +146,112 @@ action_view_changed (GtkRadioAction *action,
     }
 }
 
+/* Only one import runs at a time, it shares the progress bar */
 static void
-import_book (gchar *path,
-             BooksMainWindowPrivate *priv)
+set_import_actions_sensitive (BooksMainWindowPrivate *priv,
+                              gboolean sensitive)
 {
-    BooksEpub *epub;
+    gtk_action_set_sensitive (gtk_action_group_get_action (priv->action_group, "BookAdd"), sensitive);
+    gtk_action_set_sensitive (gtk_action_group_get_action (priv->action_group, "BookAddFolder"), sensitive);
+}
+
+static void
+on_import_progress (guint n_processed,
+                    guint n_total,
+                    BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
+    gchar *text;
+
+    priv = window->priv;
+
+    /* The widgets are gone once the window has been disposed */
+    if (priv->import_cancellable == NULL)
+        return;
+
+    text = g_strdup_printf (_("Importing book %u of %u"), n_processed, n_total);
+    gtk_progress_bar_set_text (priv->import_progress, text);
+    gtk_progress_bar_set_fraction (priv->import_progress,
+                                   n_total > 0 ? ((gdouble) n_processed) / n_total : 0.0);
+    g_free (text);
+}
+
+static void
+on_import_finished (GObject *source,
+                    GAsyncResult *result,
+                    BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
     GError *error = NULL;
 
-    epub = books_epub_new ();
+    priv = window->priv;
+
+    if (!books_importer_import_finish (BOOKS_IMPORTER (source), result, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not import books: %s\n"), error->message);
+
+        g_error_free (error);
+    }
+
+    if (priv->import_cancellable != NULL) {
+        g_clear_object (&priv->import_cancellable);
+
+        gtk_widget_hide (priv->import_box);
+        set_import_actions_sensitive (priv, TRUE);
+
+        /* Books added before a cancel are indexed as well */
+        books_indexer_wake_up (priv->indexer);
+    }
+
+    g_object_unref (window);
+}
+
+static void
+on_import_cancel_clicked (GtkButton *button,
+                          BooksMainWindowPrivate *priv)
+{
+    if (priv->import_cancellable != NULL)
+        g_cancellable_cancel (priv->import_cancellable);
+}
+
+static void
+begin_import (BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
+
+    priv = window->priv;
+    priv->import_cancellable = g_cancellable_new ();
+    set_import_actions_sensitive (priv, FALSE);
+
+    on_import_progress (0, 0, window);
+    gtk_widget_show (priv->import_box);
+}
+
+/* The window is kept alive until the import has finished */
+static void
+import_books (BooksMainWindow *window,
+              GSList *filenames)
+{
+    BooksMainWindowPrivate *priv;
+
+    priv = window->priv;
+    begin_import (window);
+    books_importer_import_async (priv->importer, filenames, priv->import_cancellable,
+                                 (BooksImporterProgressCallback) on_import_progress, window,
+                                 (GAsyncReadyCallback) on_import_finished, g_object_ref (window));
+}
 
-    if (books_epub_open (epub, path, &error))
-        books_collection_add_book (priv->collection, epub, path);
-    else
-        g_printerr ("%s\n", error->message);
+static void
+import_folder (BooksMainWindow *window,
+               GFile *folder)
+{
+    BooksMainWindowPrivate *priv;
 
-    g_object_unref (epub);
+    priv = window->priv;
+    begin_import (window);
+    books_importer_import_folder_async (priv->importer, folder, priv->import_cancellable,
+                                        (BooksImporterProgressCallback) on_import_progress, window,
+                                        (GAsyncReadyCallback) on_import_finished, g_object_ref (window));
 }
 
 static void
@@ -148,18 +274,39 @@ action_add_book (GtkAction *action,
     gtk_file_chooser_set_filter (GTK_FILE_CHOOSER (chooser), filter);
 
     if (gtk_dialog_run (GTK_DIALOG (chooser)) == GTK_RESPONSE_ACCEPT) {
-        BooksMainWindowPrivate *priv;
         GSList *filenames;
 
-        priv = window->priv;
         filenames = gtk_file_chooser_get_filenames (GTK_FILE_CHOOSER (chooser));
-        g_slist_foreach (filenames, (GFunc) import_book, priv);
+        import_books (window, filenames);
         g_slist_free_full (filenames, g_free);
     }
 
     gtk_widget_destroy (chooser);
 }
 
+static void
+action_add_folder (GtkAction *action,
+                   BooksMainWindow *window)
+{
+    GtkWidget *chooser;
+
+    chooser = gtk_file_chooser_dialog_new (_("Add Folder"), GTK_WINDOW (window),
+                                           GTK_FILE_CHOOSER_ACTION_SELECT_FOLDER,
+                                           GTK_STOCK_CANCEL, GTK_RESPONSE_CANCEL,
+                                           GTK_STOCK_ADD, GTK_RESPONSE_ACCEPT,
+                                           NULL);
+
+    if (gtk_dialog_run (GTK_DIALOG (chooser)) == GTK_RESPONSE_ACCEPT) {
+        GFile *folder;
+
+        folder = gtk_file_chooser_get_file (GTK_FILE_CHOOSER (chooser));
+        import_folder (window, folder);
+        g_object_unref (folder);
+    }
+
+    gtk_widget_destroy (chooser);
+}
+
 static void
 remove_book_from_icon_view (GtkIconView *icon_view,
                             GtkTreePath *path,
@@ -236,22 +383,25 @@ action_preferences (GtkAction *action,
 }
 
 static void
-open_selected_book (BooksMainWindowPrivate *priv,
-                    GtkTreePath *path)
+action_search (GtkAction *action,
+               BooksMainWindow *window)
 {
-    BooksEpub *epub;
-    GError *error = NULL;
+    GtkDialog *dialog;
 
-    epub = books_collection_get_book (priv->collection, path, &error);
+    dialog = books_search_dialog_new (GTK_WINDOW (window), window->priv->collection);
+    gtk_widget_show (GTK_WIDGET (dialog));
+}
 
-    if (epub != NULL) {
-        GtkWidget *book_window;
+static void
+open_selected_book (BooksMainWindowPrivate *priv,
+                    GtkTreePath *path)
+{
+    GtkWidget *book_window;
 
-        book_window = books_window_new ();
-        books_window_set_epub (BOOKS_WINDOW (book_window), epub);
-        gtk_widget_set_size_request (book_window, 594, 841);
-        gtk_widget_show_all (book_window);
-    }
+    book_window = books_window_new ();
+    books_window_open_book (BOOKS_WINDOW (book_window), priv->collection, path);
+    gtk_widget_set_size_request (book_window, 594, 841);
+    gtk_widget_show_all (book_window);
 }
 
 static void
@@ -291,6 +441,171 @@ on_window_resize (GtkContainer *container,
     }
 }
 
+static gboolean
+on_event (GtkWidget *widget,
+          GdkEvent *event,
+          BooksMainWindowPrivate *priv)
+{
+    books_indexer_notify_activity (priv->indexer);
+    return FALSE;
+}
+
+static void
+on_missing_bar_response (GtkInfoBar *bar,
+                         gint response_id,
+                         BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
+
+    priv = window->priv;
+
+    if (response_id == MISSING_RESPONSE_DETAILS) {
+        GtkDialog *dialog;
+
+        dialog = books_removed_dialog_new (GTK_TREE_MODEL (priv->missing_books));
+        gtk_window_set_transient_for (GTK_WINDOW (dialog), GTK_WINDOW (window));
+        gtk_widget_show (GTK_WIDGET (dialog));
+    }
+
+    gtk_widget_hide (priv->missing_bar);
+}
+
+static void
+on_missing_books_removed (GObject *source,
+                          GAsyncResult *result,
+                          BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
+    GPtrArray *missing_books;
+    GError *error = NULL;
+    gchar *text;
+    guint i;
+
+    priv = window->priv;
+    missing_books = books_collection_remove_missing_books_finish (BOOKS_COLLECTION (source), result, &error);
+    g_clear_object (&priv->missing_cancellable);
+
+    if (missing_books == NULL) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not update database: %s\n"), error->message);
+
+        g_error_free (error);
+        g_object_unref (window);
+        return;
+    }
+
+    if (missing_books->len > 0) {
+        gtk_list_store_clear (priv->missing_books);
+
+        for (i = 0; i < missing_books->len; i++) {
+            GtkTreeIter iter;
+
+            gtk_list_store_append (priv->missing_books, &iter);
+            gtk_list_store_set (priv->missing_books, &iter, 0, g_ptr_array_index (missing_books, i), -1);
+        }
+
+        text = g_strdup_printf (ngettext ("%u book could not be found and has been removed from your collection.",
+                                          "%u books could not be found and have been removed from your collection.",
+                                          missing_books->len),
+                                missing_books->len);
+        gtk_label_set_text (priv->missing_label, text);
+        gtk_widget_show (priv->missing_bar);
+        g_free (text);
+    }
+
+    g_ptr_array_unref (missing_books);
+    g_object_unref (window);
+}
+
+/* Runs once the window is on screen, nothing waits for the disk before */
+static gboolean
+remove_missing_books (BooksMainWindow *window)
+{
+    BooksMainWindowPrivate *priv;
+
+    priv = window->priv;
+    priv->missing_cancellable = g_cancellable_new ();
+
+    books_collection_remove_missing_books_async (priv->collection, priv->missing_cancellable,
+                                                 (GAsyncReadyCallback) on_missing_books_removed,
+                                                 g_object_ref (window));
+    return FALSE;
+}
+
+/* Covers of one screen above and below the visible rows are loaded as well */
+static gboolean
+load_visible_covers (BooksMainWindowPrivate *priv)
+{
+    GtkTreePath *start;
+    GtkTreePath *end;
+
+    priv->cover_source = 0;
+
+    if (gtk_icon_view_get_visible_range (priv->icon_view, &start, &end)) {
+        gint first;
+        gint last;
+        gint margin;
+
+        first = gtk_tree_path_get_indices (start)[0];
+        last = gtk_tree_path_get_indices (end)[0];
+        margin = last - first + 1;
+        gtk_tree_path_free (start);
+        gtk_tree_path_free (end);
+
+        start = gtk_tree_path_new_from_indices (MAX (first - margin, 0), -1);
+        end = gtk_tree_path_new_from_indices (last + margin, -1);
+        books_collection_load_covers (priv->collection, start, end);
+        gtk_tree_path_free (start);
+        gtk_tree_path_free (end);
+    }
+
+    return FALSE;
+}
+
+static void
+queue_load_covers (BooksMainWindowPrivate *priv)
+{
+    if (priv->cover_source == 0)
+        priv->cover_source = g_timeout_add (COVER_DELAY, (GSourceFunc) load_visible_covers, priv);
+}
+
+static void
+on_icon_view_scrolled (GtkAdjustment *adjustment,
+                       BooksMainWindowPrivate *priv)
+{
+    queue_load_covers (priv);
+}
+
+/* Views are detached while the collection rebuilds the rows they show */
+static void
+on_model_begin_reset (GtkTreeModel *model,
+                      BooksMainWindowPrivate *priv)
+{
+    gtk_tree_view_set_model (priv->tree_view, NULL);
+    gtk_icon_view_set_model (priv->icon_view, NULL);
+}
+
+static void
+on_model_end_reset (GtkTreeModel *model,
+                    BooksMainWindowPrivate *priv)
+{
+    gtk_tree_view_set_model (priv->tree_view, model);
+    gtk_icon_view_set_model (priv->icon_view, model);
+    queue_load_covers (priv);
+}
+
+static void
+update_watched_folders (GSettings *settings,
+                        const gchar *key,
+                        BooksMainWindowPrivate *priv)
+{
+    gchar **folders;
+
+    folders = g_settings_get_strv (settings, "watched-folders");
+    books_watcher_set_folders (priv->watcher, (const gchar * const *) folders);
+    g_strfreev (folders);
+}
+
 static void
 books_main_window_dispose (GObject *object)
 {
@@ -298,6 +613,47 @@ books_main_window_dispose (GObject *object)
 
     priv = BOOKS_MAIN_WINDOW_GET_PRIVATE (object);
 
+    if (priv->import_cancellable != NULL) {
+        g_cancellable_cancel (priv->import_cancellable);
+        g_clear_object (&priv->import_cancellable);
+    }
+
+    if (priv->collection != NULL)
+        g_signal_handlers_disconnect_by_data (books_collection_get_model (priv->collection), priv);
+
+    if (priv->cover_source != 0) {
+        g_source_remove (priv->cover_source);
+        priv->cover_source = 0;
+    }
+
+    if (priv->missing_cancellable != NULL) {
+        g_cancellable_cancel (priv->missing_cancellable);
+        g_clear_object (&priv->missing_cancellable);
+    }
+
+    if (priv->missing_books != NULL) {
+        g_object_unref (priv->missing_books);
+        priv->missing_books = NULL;
+    }
+
+    /* The watcher is gone before the settings */
+    g_signal_handlers_disconnect_by_data (priv->settings, priv);
+
+    if (priv->watcher != NULL) {
+        g_object_unref (priv->watcher);
+        priv->watcher = NULL;
+    }
+
+    if (priv->importer != NULL) {
+        g_object_unref (priv->importer);
+        priv->importer = NULL;
+    }
+
+    if (priv->indexer != NULL) {
+        g_object_unref (priv->indexer);
+        priv->indexer = NULL;
+    }
+
     g_settings_set (priv->settings, "main-window-size",
                     "(ii)", priv->width, priv->height);
 
@@ -328,6 +684,8 @@ books_main_window_init (BooksMainWindow *window)
     GtkAccelGroup       *accel_group;
     GtkWidget           *toolbar;
     GtkWidget           *menubar;
+    GtkWidget           *cancel_button;
+    GtkWidget           *missing_content;
     GtkToolItem         *separator_item;
     GtkToolItem         *filter_item;
     GtkTreeModel        *model;
@@ -336,6 +694,7 @@ books_main_window_init (BooksMainWindow *window)
     GtkCellRenderer     *renderer;
     GtkTreeSelection    *selection;
     GtkContainer        *scroll_box;
+    GtkAdjustment       *icon_adjustment;
     GBytes              *bytes;
     gsize                size;
     const gchar         *ui_data;
@@ -348,9 +707,32 @@ books_main_window_init (BooksMainWindow *window)
     g_settings_get (priv->settings, "main-window-size", "(ii)", &priv->width, &priv->height);
     gtk_window_set_default_size (GTK_WINDOW (window), priv->width, priv->height);
 
+    g_settings_bind (priv->settings, "cache-size",
+                     books_cache_get_default (), "budget",
+                     G_SETTINGS_BIND_GET);
+
+    g_settings_bind (priv->settings, "cover-cache-size",
+                     books_cover_cache_get_default (), "budget",
+                     G_SETTINGS_BIND_GET);
+
+    books_cache_remove_legacy_files (books_cache_get_default ());
+
     /* Create book collection */
     priv->collection = books_collection_new ();
 
+    /* Index queued books in the background */
+    priv->indexer = books_indexer_new (books_collection_get_database_filename (priv->collection));
+
+    priv->importer = books_importer_new (priv->collection);
+    priv->import_cancellable = NULL;
+
+    /* Keep the collection in sync with the library folders */
+    priv->watcher = books_watcher_new (priv->collection, priv->importer, priv->indexer);
+    update_watched_folders (priv->settings, "watched-folders", priv);
+
+    g_signal_connect (priv->settings, "changed::watched-folders",
+                      G_CALLBACK (update_watched_folders), priv);
+
     /* Create actions */
     priv->action_group = gtk_action_group_new ("MainActions");
     gtk_action_group_set_translation_domain (priv->action_group, GETTEXT_PACKAGE);
@@ -449,12 +831,39 @@ books_main_window_init (BooksMainWindow *window)
 
     priv->list_scroll = GTK_CONTAINER (gtk_scrolled_window_new (NULL, NULL));
     priv->icon_scroll = GTK_CONTAINER (gtk_scrolled_window_new (NULL, NULL));
+    icon_adjustment = gtk_scrolled_window_get_vadjustment (GTK_SCROLLED_WINDOW (priv->icon_scroll));
+    priv->cover_source = 0;
+
+    /* Create import progress, only shown while books are imported */
+    priv->import_box = gtk_box_new (GTK_ORIENTATION_HORIZONTAL, 6);
+    gtk_container_set_border_width (GTK_CONTAINER (priv->import_box), 6);
+    priv->import_progress = GTK_PROGRESS_BAR (gtk_progress_bar_new ());
+    gtk_progress_bar_set_show_text (priv->import_progress, TRUE);
+    gtk_widget_set_valign (GTK_WIDGET (priv->import_progress), GTK_ALIGN_CENTER);
+    cancel_button = gtk_button_new_from_stock (GTK_STOCK_CANCEL);
+    gtk_box_pack_start (GTK_BOX (priv->import_box), GTK_WIDGET (priv->import_progress), TRUE, TRUE, 0);
+    gtk_box_pack_start (GTK_BOX (priv->import_box), cancel_button, FALSE, FALSE, 0);
+
+    /* Create notification about books that have been removed */
+    priv->missing_books = gtk_list_store_new (1, G_TYPE_STRING);
+    priv->missing_cancellable = NULL;
+    priv->missing_bar = gtk_info_bar_new_with_buttons (_("_Details"), MISSING_RESPONSE_DETAILS,
+                                                       GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE,
+                                                       NULL);
+    gtk_info_bar_set_message_type (GTK_INFO_BAR (priv->missing_bar), GTK_MESSAGE_INFO);
+    priv->missing_label = GTK_LABEL (gtk_label_new (NULL));
+    gtk_label_set_line_wrap (priv->missing_label, TRUE);
+    gtk_widget_set_halign (GTK_WIDGET (priv->missing_label), GTK_ALIGN_START);
+    missing_content = gtk_info_bar_get_content_area (GTK_INFO_BAR (priv->missing_bar));
+    gtk_container_add (GTK_CONTAINER (missing_content), GTK_WIDGET (priv->missing_label));
 
     /* Layout widgets */
     gtk_container_add (GTK_CONTAINER (window), priv->main_box);
     gtk_container_add (GTK_CONTAINER (priv->main_box), menubar);
     gtk_container_add (GTK_CONTAINER (priv->main_box), toolbar);
+    gtk_container_add (GTK_CONTAINER (priv->main_box), priv->missing_bar);
     gtk_container_add (GTK_CONTAINER (priv->main_box), GTK_WIDGET (scroll_box));
+    gtk_container_add (GTK_CONTAINER (priv->main_box), priv->import_box);
 
     gtk_container_add (GTK_CONTAINER (filter_item), GTK_WIDGET (priv->filter_entry));
 
@@ -472,6 +881,9 @@ books_main_window_init (BooksMainWindow *window)
     gtk_widget_show (GTK_WIDGET (priv->icon_scroll));
     gtk_widget_show (GTK_WIDGET (priv->icon_view));
     gtk_widget_show (GTK_WIDGET (priv->tree_view));
+    gtk_widget_show (GTK_WIDGET (priv->import_progress));
+    gtk_widget_show (cancel_button);
+    gtk_widget_show (GTK_WIDGET (priv->missing_label));
 
     /* Connect signals */
     g_signal_connect (priv->tree_view, "row-activated",
@@ -482,4 +894,40 @@ books_main_window_init (BooksMainWindow *window)
 
     g_signal_connect (window, "check-resize",
                       G_CALLBACK (on_window_resize), priv);
+
+    g_signal_connect (window, "event",
+                      G_CALLBACK (on_event), priv);
+
+    g_signal_connect (cancel_button, "clicked",
+                      G_CALLBACK (on_import_cancel_clicked), priv);
+
+    /* Covers are only loaded for rows around the visible ones */
+    g_signal_connect (icon_adjustment, "value-changed",
+                      G_CALLBACK (on_icon_view_scrolled), priv);
+
+    g_signal_connect (icon_adjustment, "changed",
+                      G_CALLBACK (on_icon_view_scrolled), priv);
+
+    /* The signals pass different arguments, only the window matters */
+    g_signal_connect_swapped (model, "row-inserted",
+                              G_CALLBACK (queue_load_covers), priv);
+
+    g_signal_connect_swapped (model, "row-deleted",
+                              G_CALLBACK (queue_load_covers), priv);
+
+    g_signal_connect (model, "begin-reset",
+                      G_CALLBACK (on_model_begin_reset), priv);
+
+    g_signal_connect (model, "end-reset",
+                      G_CALLBACK (on_model_end_reset), priv);
+
+    g_signal_connect_swapped (model, "rows-reordered",
+                              G_CALLBACK (queue_load_covers), priv);
+
+    g_signal_connect (priv->missing_bar, "response",
+                      G_CALLBACK (on_missing_bar_response), window);
+
+    /* Check for missing books only after the window has been drawn */
+    g_idle_add_full (G_PRIORITY_LOW, (GSourceFunc) remove_missing_books,
+                     g_object_ref (window), g_object_unref);
 }
@@ -0,0 +1,216 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <glib/gi18n.h>
+
+#include "books-search-dialog.h"
+#include "books-window.h"
+
+
+G_DEFINE_TYPE(BooksSearchDialog, books_search_dialog, GTK_TYPE_DIALOG)
+
+#define BOOKS_SEARCH_DIALOG_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_SEARCH_DIALOG, BooksSearchDialogPrivate))
+
+struct _BooksSearchDialogPrivate {
+    BooksCollection *collection;
+    GtkEntry        *entry;
+    GtkTreeView     *view;
+    GCancellable    *cancellable;
+};
+
+GtkDialog *
+books_search_dialog_new (GtkWindow *parent,
+                         BooksCollection *collection)
+{
+    BooksSearchDialog *dialog;
+
+    dialog = BOOKS_SEARCH_DIALOG (g_object_new (BOOKS_TYPE_SEARCH_DIALOG, NULL));
+    dialog->priv->collection = g_object_ref (collection);
+    gtk_window_set_transient_for (GTK_WINDOW (dialog), parent);
+
+    return GTK_DIALOG (dialog);
+}
+
+static void
+on_search_finished (GObject *source,
+                    GAsyncResult *result,
+                    BooksSearchDialogPrivate *priv)
+{
+    GtkTreeModel *results;
+    GError *error = NULL;
+
+    results = books_collection_search_finish (BOOKS_COLLECTION (source), result, &error);
+
+    if (results == NULL) {
+        /* Superseded by another search or the dialog is gone */
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not search books: %s\n"), error->message);
+
+        g_error_free (error);
+        return;
+    }
+
+    gtk_tree_view_set_model (priv->view, results);
+    g_object_unref (results);
+}
+
+static void
+on_entry_activate (GtkEntry *entry,
+                   BooksSearchDialogPrivate *priv)
+{
+    if (priv->cancellable != NULL) {
+        g_cancellable_cancel (priv->cancellable);
+        g_object_unref (priv->cancellable);
+    }
+
+    priv->cancellable = g_cancellable_new ();
+    books_collection_search_async (priv->collection, gtk_entry_get_text (entry), priv->cancellable,
+                                   (GAsyncReadyCallback) on_search_finished, priv);
+}
+
+static void
+on_row_activated (GtkTreeView *view,
+                  GtkTreePath *path,
+                  GtkTreeViewColumn *column,
+                  BooksSearchDialogPrivate *priv)
+{
+    GtkTreeModel *model;
+    GtkTreeIter iter;
+    GtkWidget *book_window;
+    gchar *filename;
+    guint position;
+
+    model = gtk_tree_view_get_model (view);
+
+    if (!gtk_tree_model_get_iter (model, &iter, path))
+        return;
+
+    gtk_tree_model_get (model, &iter,
+                        BOOKS_SEARCH_RESULT_PATH_COLUMN, &filename,
+                        BOOKS_SEARCH_RESULT_POSITION_COLUMN, &position,
+                        -1);
+
+    book_window = books_window_new ();
+    books_window_open_file (BOOKS_WINDOW (book_window), priv->collection, filename, position);
+    gtk_widget_set_size_request (book_window, 594, 841);
+    gtk_widget_show_all (book_window);
+
+    g_free (filename);
+}
+
+static void
+response_handler (GtkDialog *dialog,
+                  gint res_id)
+{
+    gtk_widget_destroy (GTK_WIDGET (dialog));
+}
+
+static void
+books_search_dialog_dispose (GObject *object)
+{
+    BooksSearchDialogPrivate *priv;
+
+    priv = BOOKS_SEARCH_DIALOG_GET_PRIVATE (object);
+
+    if (priv->cancellable != NULL) {
+        g_cancellable_cancel (priv->cancellable);
+        g_object_unref (priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
+    if (priv->collection != NULL) {
+        g_object_unref (priv->collection);
+        priv->collection = NULL;
+    }
+
+    G_OBJECT_CLASS (books_search_dialog_parent_class)->dispose (object);
+}
+
+static void
+books_search_dialog_class_init (BooksSearchDialogClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = books_search_dialog_dispose;
+
+    g_type_class_add_private (klass, sizeof(BooksSearchDialogPrivate));
+}
+
+static void
+books_search_dialog_init (BooksSearchDialog *dialog)
+{
+    BooksSearchDialogPrivate *priv;
+    GtkWidget *content_area;
+    GtkWidget *scrolled_window;
+    GtkCellRenderer *renderer;
+    GtkTreeViewColumn *column;
+
+    dialog->priv = priv = BOOKS_SEARCH_DIALOG_GET_PRIVATE (dialog);
+
+    priv->collection = NULL;
+    priv->cancellable = NULL;
+
+#if GTK_CHECK_VERSION(3,6,0)
+    priv->entry = GTK_ENTRY (gtk_search_entry_new ());
+#else
+    priv->entry = GTK_ENTRY (gtk_entry_new ());
+#endif
+
+    priv->view = GTK_TREE_VIEW (gtk_tree_view_new ());
+
+    gtk_dialog_add_buttons (GTK_DIALOG (dialog),
+                            GTK_STOCK_CLOSE, GTK_RESPONSE_CLOSE,
+                            NULL);
+
+    gtk_window_set_title (GTK_WINDOW (dialog), _("Search Contents"));
+    gtk_window_set_destroy_with_parent (GTK_WINDOW (dialog), TRUE);
+    gtk_window_set_default_size (GTK_WINDOW (dialog), 600, 400);
+
+    content_area = gtk_dialog_get_content_area (GTK_DIALOG (dialog));
+
+    gtk_container_set_border_width (GTK_CONTAINER (dialog), 5);
+    gtk_container_set_border_width (GTK_CONTAINER (content_area), 5);
+    gtk_box_set_spacing (GTK_BOX (content_area), 6);
+
+    renderer = gtk_cell_renderer_text_new ();
+    column = gtk_tree_view_column_new_with_attributes (_("Book"), renderer,
+                                                       "markup", BOOKS_SEARCH_RESULT_MARKUP_COLUMN,
+                                                       NULL);
+    gtk_tree_view_append_column (priv->view, column);
+
+    renderer = gtk_cell_renderer_text_new ();
+
+    g_object_set (renderer,
+                  "ellipsize-set", TRUE,
+                  "ellipsize", PANGO_ELLIPSIZE_END,
+                  NULL);
+
+    column = gtk_tree_view_column_new_with_attributes (_("Match"), renderer,
+                                                       "markup", BOOKS_SEARCH_RESULT_SNIPPET_COLUMN,
+                                                       NULL);
+    gtk_tree_view_column_set_expand (column, TRUE);
+    gtk_tree_view_append_column (priv->view, column);
+
+    scrolled_window = gtk_scrolled_window_new (NULL, NULL);
+    gtk_container_add (GTK_CONTAINER (scrolled_window), GTK_WIDGET (priv->view));
+
+    g_signal_connect (dialog, "response",
+                      G_CALLBACK (response_handler), NULL);
+
+    g_signal_connect (priv->entry, "activate",
+                      G_CALLBACK (on_entry_activate), priv);
+
+    g_signal_connect (priv->view, "row-activated",
+                      G_CALLBACK (on_row_activated), priv);
+
+    gtk_box_pack_start (GTK_BOX (content_area),
+                        GTK_WIDGET (priv->entry), FALSE, FALSE, 0);
+
+    gtk_box_pack_start (GTK_BOX (content_area),
+                        scrolled_window, TRUE, TRUE, 0);
+
+    gtk_widget_show (GTK_WIDGET (priv->entry));
+    gtk_widget_show (GTK_WIDGET (priv->view));
+    gtk_widget_show (scrolled_window);
+}
@@ -0,0 +1,38 @@
+#ifndef BOOKS_SEARCH_DIALOG_H
+#define BOOKS_SEARCH_DIALOG_H
+
+#include <gtk/gtk.h>
+
+#include "books-collection.h"
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_SEARCH_DIALOG             (books_search_dialog_get_type())
+#define BOOKS_SEARCH_DIALOG(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_SEARCH_DIALOG, BooksSearchDialog))
+#define BOOKS_IS_SEARCH_DIALOG(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_SEARCH_DIALOG))
+#define BOOKS_SEARCH_DIALOG_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_SEARCH_DIALOG, BooksSearchDialogClass))
+#define BOOKS_IS_SEARCH_DIALOG_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_SEARCH_DIALOG))
+#define BOOKS_SEARCH_DIALOG_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_SEARCH_DIALOG, BooksSearchDialogClass))
+
+
+typedef struct _BooksSearchDialog           BooksSearchDialog;
+typedef struct _BooksSearchDialogClass      BooksSearchDialogClass;
+typedef struct _BooksSearchDialogPrivate    BooksSearchDialogPrivate;
+
+struct _BooksSearchDialog {
+    GtkDialog parent;
+
+    BooksSearchDialogPrivate *priv;
+};
+
+struct _BooksSearchDialogClass {
+    GtkDialogClass parent_class;
+};
+
+GtkDialog   *books_search_dialog_new       (GtkWindow *parent,
+                                            BooksCollection *collection);
+GType        books_search_dialog_get_type  (void);
+
+G_END_DECLS
+
+#endif
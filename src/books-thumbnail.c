@@ -0,0 +1,174 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <gio/gio.h>
+
+#ifdef HAVE_LIBJPEG
+#include <stdio.h>
+#include <setjmp.h>
+#include <jpeglib.h>
+#endif
+
+#include "books-thumbnail.h"
+
+
+#ifdef HAVE_LIBJPEG
+typedef struct {
+    struct jpeg_error_mgr   manager;
+    jmp_buf                 jump;
+    gchar                   message[JMSG_LENGTH_MAX];
+} JpegError;
+
+static void
+on_jpeg_error (j_common_ptr info)
+{
+    JpegError *error;
+
+    error = (JpegError *) info->err;
+    info->err->format_message (info, error->message);
+    longjmp (error->jump, 1);
+}
+
+static void
+on_jpeg_message (j_common_ptr info)
+{
+    /* Warnings about slightly broken covers are of no interest */
+}
+
+/*
+ * Decodes a baseline or progressive JPEG reduced in the DCT domain to the
+ * smallest size that is still at least @width pixels wide. Returns NULL
+ * without setting @error for color spaces that are left to gdk-pixbuf.
+ */
+static GdkPixbuf *
+decode_jpeg (const guchar *data,
+             gsize size,
+             gint width,
+             GError **error)
+{
+    struct jpeg_decompress_struct info;
+    JpegError jpeg_error;
+    GdkPixbuf * volatile pixbuf = NULL;
+    guchar *pixels;
+    gint rowstride;
+
+    info.err = jpeg_std_error (&jpeg_error.manager);
+    jpeg_error.manager.error_exit = on_jpeg_error;
+    jpeg_error.manager.output_message = on_jpeg_message;
+
+    if (setjmp (jpeg_error.jump)) {
+        g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_CORRUPT_IMAGE,
+                     "%s", jpeg_error.message);
+        jpeg_destroy_decompress (&info);
+
+        if (pixbuf != NULL)
+            g_object_unref (pixbuf);
+
+        return NULL;
+    }
+
+    jpeg_create_decompress (&info);
+    jpeg_mem_src (&info, (unsigned char *) data, size);
+    jpeg_read_header (&info, TRUE);
+
+    if (info.jpeg_color_space != JCS_YCbCr && info.jpeg_color_space != JCS_RGB) {
+        jpeg_destroy_decompress (&info);
+        return NULL;
+    }
+
+    info.scale_num = 1;
+    info.scale_denom = 1;
+
+    while (info.scale_denom < 8 && info.image_width / (info.scale_denom * 2) >= (guint) width)
+        info.scale_denom *= 2;
+
+    /* Precision is lost in the downscale anyway */
+    info.dct_method = JDCT_IFAST;
+    info.do_fancy_upsampling = FALSE;
+    info.do_block_smoothing = FALSE;
+    info.out_color_space = JCS_RGB;
+
+    jpeg_start_decompress (&info);
+    pixbuf = gdk_pixbuf_new (GDK_COLORSPACE_RGB, FALSE, 8, info.output_width, info.output_height);
+
+    if (pixbuf == NULL) {
+        g_set_error (error, GDK_PIXBUF_ERROR, GDK_PIXBUF_ERROR_INSUFFICIENT_MEMORY,
+                     "Not enough memory for a %ux%u image", info.output_width, info.output_height);
+        jpeg_destroy_decompress (&info);
+        return NULL;
+    }
+
+    pixels = gdk_pixbuf_get_pixels (pixbuf);
+    rowstride = gdk_pixbuf_get_rowstride (pixbuf);
+
+    while (info.output_scanline < info.output_height) {
+        JSAMPROW row;
+
+        row = pixels + info.output_scanline * rowstride;
+        jpeg_read_scanlines (&info, &row, 1);
+    }
+
+    jpeg_finish_decompress (&info);
+    jpeg_destroy_decompress (&info);
+    return pixbuf;
+}
+#endif
+
+/* Bilinear reduction in gdk-pixbuf averages over the covered area */
+static GdkPixbuf *
+scale_to_width (GdkPixbuf *pixbuf,
+                gint width)
+{
+    gint height;
+
+    if (gdk_pixbuf_get_width (pixbuf) == width)
+        return g_object_ref (pixbuf);
+
+    height = MAX (1, gdk_pixbuf_get_height (pixbuf) * width / gdk_pixbuf_get_width (pixbuf));
+    return gdk_pixbuf_scale_simple (pixbuf, width, height, GDK_INTERP_BILINEAR);
+}
+
+/*
+ * Decodes the cover image @data to a thumbnail that is @width pixels wide.
+ * JPEGs, which most covers are, never get decoded at full resolution.
+ */
+GdkPixbuf *
+books_thumbnail_decode (GBytes *data,
+                        gint width,
+                        GError **error)
+{
+    GInputStream *stream;
+    GdkPixbuf *pixbuf;
+#ifdef HAVE_LIBJPEG
+    const guchar *bytes;
+    gsize size;
+
+    bytes = g_bytes_get_data (data, &size);
+
+    if (size > 2 && bytes[0] == 0xff && bytes[1] == 0xd8) {
+        GdkPixbuf *decoded;
+        GError *jpeg_error = NULL;
+
+        decoded = decode_jpeg (bytes, size, width, &jpeg_error);
+
+        if (jpeg_error != NULL) {
+            g_propagate_error (error, jpeg_error);
+            return NULL;
+        }
+
+        if (decoded != NULL) {
+            pixbuf = scale_to_width (decoded, width);
+            g_object_unref (decoded);
+            return pixbuf;
+        }
+    }
+#endif
+
+    /* The loader still reduces what it can while decoding */
+    stream = g_memory_input_stream_new_from_bytes (data);
+    pixbuf = gdk_pixbuf_new_from_stream_at_scale (stream, width, -1, TRUE, NULL, error);
+    g_object_unref (stream);
+
+    return pixbuf;
+}
@@ -0,0 +1,14 @@
+#ifndef BOOKS_THUMBNAIL_H
+#define BOOKS_THUMBNAIL_H
+
+#include <gdk-pixbuf/gdk-pixbuf.h>
+
+G_BEGIN_DECLS
+
+GdkPixbuf * books_thumbnail_decode (GBytes     *data,
+                                    gint        width,
+                                    GError    **error);
+
+G_END_DECLS
+
+#endif
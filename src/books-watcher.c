@@ -0,0 +1,575 @@
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include <string.h>
+#include <glib/gi18n.h>
+
+#include "books-watcher.h"
+
+
+G_DEFINE_TYPE(BooksWatcher, books_watcher, G_TYPE_OBJECT)
+
+#define BOOKS_WATCHER_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_WATCHER, BooksWatcherPrivate))
+
+/* Quiet time in milliseconds before collected changes are applied */
+#define COALESCE_DELAY  1000
+
+/* Changes are applied at the latest after this many microseconds */
+#define MAX_DELAY       (10 * G_USEC_PER_SEC)
+
+/*
+ * Keeps the collection in sync with the watched folders. Changes reported
+ * by the file monitors are collected and applied together once things
+ * have calmed down, so that copying a whole library results in a few large
+ * updates. Only folders are enumerated on startup to set up the monitors,
+ * the books themselves are not checked again.
+ */
+struct _BooksWatcherPrivate {
+    BooksCollection *collection;
+    BooksImporter   *importer;
+    BooksIndexer    *indexer;
+    GCancellable    *cancellable;
+    GCancellable    *import_cancellable;
+    gchar          **folders;
+    GHashTable      *monitors;
+    GHashTable      *added;
+    GHashTable      *removed;
+    GPtrArray       *renames;
+    guint            flush_source;
+    gint64           first_change;
+};
+
+static void watch_directory (BooksWatcherPrivate *priv, GFile *directory);
+
+
+BooksWatcher *
+books_watcher_new (BooksCollection *collection,
+                   BooksImporter *importer,
+                   BooksIndexer *indexer)
+{
+    BooksWatcher *watcher;
+    BooksWatcherPrivate *priv;
+
+    g_return_val_if_fail (BOOKS_IS_COLLECTION (collection) &&
+                          BOOKS_IS_IMPORTER (importer) &&
+                          BOOKS_IS_INDEXER (indexer), NULL);
+
+    watcher = BOOKS_WATCHER (g_object_new (BOOKS_TYPE_WATCHER, NULL));
+    priv = watcher->priv;
+    priv->collection = g_object_ref (collection);
+    priv->importer = g_object_ref (importer);
+    priv->indexer = g_object_ref (indexer);
+
+    return watcher;
+}
+
+static gboolean
+is_book (const gchar *path)
+{
+    return g_str_has_suffix (path, ".epub") || g_str_has_suffix (path, ".EPUB");
+}
+
+static void
+on_import_finished (GObject *source,
+                    GAsyncResult *result,
+                    BooksIndexer *indexer)
+{
+    GError *error = NULL;
+
+    if (!books_importer_import_finish (BOOKS_IMPORTER (source), result, &error)) {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED))
+            g_printerr (_("Could not import books: %s\n"), error->message);
+
+        g_error_free (error);
+    }
+
+    books_indexer_wake_up (indexer);
+    g_object_unref (indexer);
+}
+
+static void
+add_to_list (gchar *path,
+             gpointer value,
+             GSList **list)
+{
+    *list = g_slist_prepend (*list, path);
+}
+
+static void
+add_to_array (gchar *path,
+              gpointer value,
+              GPtrArray *array)
+{
+    g_ptr_array_add (array, g_strdup (path));
+}
+
+/*
+ * Applies the collected changes. Renames go first, so that books moved and
+ * then deleted are found under their new path.
+ */
+static gboolean
+flush_changes (BooksWatcherPrivate *priv)
+{
+    priv->flush_source = 0;
+
+    if (priv->renames->len > 0) {
+        books_collection_rename_files (priv->collection, priv->renames);
+        g_ptr_array_unref (priv->renames);
+        priv->renames = g_ptr_array_new_with_free_func (g_free);
+    }
+
+    if (g_hash_table_size (priv->removed) > 0) {
+        GPtrArray *paths;
+
+        paths = g_ptr_array_new_with_free_func (g_free);
+        g_hash_table_foreach (priv->removed, (GHFunc) add_to_array, paths);
+        books_collection_remove_files (priv->collection, paths);
+        g_ptr_array_unref (paths);
+        g_hash_table_remove_all (priv->removed);
+    }
+
+    if (g_hash_table_size (priv->added) > 0) {
+        GSList *paths = NULL;
+
+        g_hash_table_foreach (priv->added, (GHFunc) add_to_list, &paths);
+        books_importer_import_async (priv->importer, paths, priv->import_cancellable, NULL, NULL,
+                                     (GAsyncReadyCallback) on_import_finished,
+                                     g_object_ref (priv->indexer));
+        g_slist_free (paths);
+        g_hash_table_remove_all (priv->added);
+    }
+
+    return G_SOURCE_REMOVE;
+}
+
+/*
+ * Postpones applying changes while more of them arrive, but not forever.
+ */
+static void
+schedule_flush (BooksWatcherPrivate *priv)
+{
+    gint64 now;
+
+    now = g_get_monotonic_time ();
+
+    if (priv->flush_source != 0) {
+        if (now - priv->first_change >= MAX_DELAY)
+            return;
+
+        g_source_remove (priv->flush_source);
+    }
+    else {
+        priv->first_change = now;
+    }
+
+    priv->flush_source = g_timeout_add (COALESCE_DELAY, (GSourceFunc) flush_changes, priv);
+}
+
+static void
+add_path (BooksWatcherPrivate *priv,
+          const gchar *path)
+{
+    g_hash_table_remove (priv->removed, path);
+    g_hash_table_add (priv->added, g_strdup (path));
+}
+
+static void
+remove_path (BooksWatcherPrivate *priv,
+             const gchar *path)
+{
+    /* Files that come and go before the next flush are never imported */
+    if (!g_hash_table_remove (priv->added, path))
+        g_hash_table_add (priv->removed, g_strdup (path));
+}
+
+static void
+rename_path (BooksWatcherPrivate *priv,
+             const gchar *old_path,
+             const gchar *new_path)
+{
+    if (g_hash_table_remove (priv->added, old_path)) {
+        add_path (priv, new_path);
+        return;
+    }
+
+    g_ptr_array_add (priv->renames, g_strdup (old_path));
+    g_ptr_array_add (priv->renames, g_strdup (new_path));
+}
+
+static void
+unwatch_directory (BooksWatcherPrivate *priv,
+                   const gchar *path)
+{
+    GHashTableIter iter;
+    gchar *prefix;
+    gpointer key;
+
+    prefix = g_strconcat (path, G_DIR_SEPARATOR_S, NULL);
+    g_hash_table_iter_init (&iter, priv->monitors);
+
+    while (g_hash_table_iter_next (&iter, &key, NULL)) {
+        if (!strcmp (key, path) || g_str_has_prefix (key, prefix))
+            g_hash_table_iter_remove (&iter);
+    }
+
+    g_free (prefix);
+}
+
+static void
+on_monitor_changed (GFileMonitor *monitor,
+                    GFile *file,
+                    GFile *other_file,
+                    GFileMonitorEvent event_type,
+                    BooksWatcherPrivate *priv)
+{
+    gchar *path;
+
+    path = g_file_get_path (file);
+
+    if (path == NULL)
+        return;
+
+    switch (event_type) {
+        case G_FILE_MONITOR_EVENT_CREATED:
+            if (g_file_query_file_type (file, G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS, NULL) == G_FILE_TYPE_DIRECTORY) {
+                /* Books copied before the monitor is in place are found by the walk */
+                watch_directory (priv, file);
+                books_importer_import_folder_async (priv->importer, file, priv->import_cancellable, NULL, NULL,
+                                                    (GAsyncReadyCallback) on_import_finished,
+                                                    g_object_ref (priv->indexer));
+            }
+            else if (is_book (path)) {
+                add_path (priv, path);
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_DELETED:
+            if (g_hash_table_contains (priv->monitors, path)) {
+                unwatch_directory (priv, path);
+                remove_path (priv, path);
+            }
+            else if (is_book (path)) {
+                remove_path (priv, path);
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_MOVED:
+            if (other_file != NULL) {
+                gchar *other_path;
+
+                other_path = g_file_get_path (other_file);
+
+                if (g_hash_table_contains (priv->monitors, path)) {
+                    unwatch_directory (priv, path);
+                    watch_directory (priv, other_file);
+                    rename_path (priv, path, other_path);
+                }
+                else if (is_book (path) && is_book (other_path)) {
+                    rename_path (priv, path, other_path);
+                }
+                else if (is_book (path)) {
+                    remove_path (priv, path);
+                }
+                else if (is_book (other_path)) {
+                    add_path (priv, other_path);
+                }
+
+                g_free (other_path);
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_CHANGED:
+            /* A book that is still being written is not ready to be parsed */
+            if (!g_hash_table_contains (priv->added, path)) {
+                g_free (path);
+                return;
+            }
+            break;
+
+        case G_FILE_MONITOR_EVENT_CHANGES_DONE_HINT:
+            /*
+             * Books that took longer than MAX_DELAY to copy or that were
+             * found by the walk of a new folder may have been parsed while
+             * half-written and failed. They are tried again once written,
+             * the importer skips those that are in the collection already.
+             */
+            if (!is_book (path)) {
+                g_free (path);
+                return;
+            }
+
+            add_path (priv, path);
+            break;
+
+        default:
+            g_free (path);
+            return;
+    }
+
+    schedule_flush (priv);
+    g_free (path);
+}
+
+static void
+on_next_directories (GObject *source,
+                     GAsyncResult *result,
+                     BooksWatcherPrivate *priv)
+{
+    GFileEnumerator *enumerator;
+    GFile *directory;
+    GList *infos;
+    GList *it;
+    GError *error = NULL;
+
+    enumerator = G_FILE_ENUMERATOR (source);
+    infos = g_file_enumerator_next_files_finish (enumerator, result, &error);
+
+    if (infos == NULL) {
+        /* The watcher may be gone when this has been cancelled */
+        if (error != NULL)
+            g_error_free (error);
+
+        g_object_unref (enumerator);
+        return;
+    }
+
+    directory = g_file_enumerator_get_container (enumerator);
+
+    for (it = infos; it != NULL; it = g_list_next (it)) {
+        GFileInfo *info;
+
+        info = G_FILE_INFO (it->data);
+
+        if (g_file_info_get_file_type (info) == G_FILE_TYPE_DIRECTORY) {
+            GFile *child;
+
+            child = g_file_get_child (directory, g_file_info_get_name (info));
+            watch_directory (priv, child);
+            g_object_unref (child);
+        }
+    }
+
+    g_list_free_full (infos, g_object_unref);
+    g_file_enumerator_next_files_async (enumerator, 64, G_PRIORITY_LOW, priv->cancellable,
+                                        (GAsyncReadyCallback) on_next_directories, priv);
+}
+
+static void
+on_directory_enumerated (GObject *source,
+                         GAsyncResult *result,
+                         BooksWatcherPrivate *priv)
+{
+    GFileEnumerator *enumerator;
+    GError *error = NULL;
+
+    enumerator = g_file_enumerate_children_finish (G_FILE (source), result, &error);
+
+    if (enumerator == NULL) {
+        g_error_free (error);
+        return;
+    }
+
+    g_file_enumerator_next_files_async (enumerator, 64, G_PRIORITY_LOW, priv->cancellable,
+                                        (GAsyncReadyCallback) on_next_directories, priv);
+}
+
+/*
+ * Monitors @directory and, once they have been found, all folders below.
+ */
+static void
+watch_directory (BooksWatcherPrivate *priv,
+                 GFile *directory)
+{
+    GFileMonitor *monitor;
+    GError *error = NULL;
+    gchar *path;
+
+    path = g_file_get_path (directory);
+
+    if (path == NULL || g_hash_table_contains (priv->monitors, path)) {
+        g_free (path);
+        return;
+    }
+
+    monitor = g_file_monitor_directory (directory, G_FILE_MONITOR_SEND_MOVED, NULL, &error);
+
+    if (monitor == NULL) {
+        g_printerr (_("Could not watch `%s': %s\n"), path, error->message);
+        g_error_free (error);
+        g_free (path);
+        return;
+    }
+
+    g_signal_connect (monitor, "changed",
+                      G_CALLBACK (on_monitor_changed), priv);
+
+    g_hash_table_insert (priv->monitors, path, monitor);
+
+    g_file_enumerate_children_async (directory,
+                                     G_FILE_ATTRIBUTE_STANDARD_NAME ","
+                                     G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                                     G_FILE_QUERY_INFO_NOFOLLOW_SYMLINKS,
+                                     G_PRIORITY_LOW, priv->cancellable,
+                                     (GAsyncReadyCallback) on_directory_enumerated, priv);
+}
+
+static gboolean
+contains_folder (gchar **folders,
+                 const gchar *folder)
+{
+    guint i;
+
+    for (i = 0; folders != NULL && folders[i] != NULL; i++) {
+        if (!strcmp (folders[i], folder))
+            return TRUE;
+    }
+
+    return FALSE;
+}
+
+/*
+ * Replaces the watched folders. Folders that were not watched before are
+ * imported, except for the first call on startup. Only the enumeration of
+ * folders is started over, imports that are running go on.
+ */
+void
+books_watcher_set_folders (BooksWatcher *watcher,
+                           const gchar * const *folders)
+{
+    BooksWatcherPrivate *priv;
+    gboolean initial;
+    guint i;
+
+    g_return_if_fail (BOOKS_IS_WATCHER (watcher));
+
+    priv = watcher->priv;
+    initial = priv->folders == NULL;
+
+    g_cancellable_cancel (priv->cancellable);
+    g_object_unref (priv->cancellable);
+    priv->cancellable = g_cancellable_new ();
+    g_hash_table_remove_all (priv->monitors);
+
+    for (i = 0; folders != NULL && folders[i] != NULL; i++) {
+        GFile *folder;
+
+        folder = g_file_new_for_path (folders[i]);
+        watch_directory (priv, folder);
+
+        if (!initial && !contains_folder (priv->folders, folders[i])) {
+            books_importer_import_folder_async (priv->importer, folder, priv->import_cancellable, NULL, NULL,
+                                                (GAsyncReadyCallback) on_import_finished,
+                                                g_object_ref (priv->indexer));
+        }
+
+        g_object_unref (folder);
+    }
+
+    g_strfreev (priv->folders);
+    priv->folders = g_strdupv ((gchar **) folders);
+
+    /* An empty list must still count as initialized */
+    if (priv->folders == NULL)
+        priv->folders = g_new0 (gchar *, 1);
+}
+
+static void
+free_monitor (GFileMonitor *monitor)
+{
+    g_file_monitor_cancel (monitor);
+    g_object_unref (monitor);
+}
+
+static void
+books_watcher_dispose (GObject *object)
+{
+    BooksWatcherPrivate *priv;
+
+    priv = BOOKS_WATCHER_GET_PRIVATE (object);
+
+    if (priv->flush_source != 0) {
+        g_source_remove (priv->flush_source);
+        priv->flush_source = 0;
+    }
+
+    if (priv->cancellable != NULL) {
+        g_cancellable_cancel (priv->cancellable);
+        g_object_unref (priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
+    if (priv->import_cancellable != NULL) {
+        g_cancellable_cancel (priv->import_cancellable);
+        g_object_unref (priv->import_cancellable);
+        priv->import_cancellable = NULL;
+    }
+
+    if (priv->monitors != NULL) {
+        g_hash_table_destroy (priv->monitors);
+        priv->monitors = NULL;
+    }
+
+    if (priv->collection != NULL) {
+        g_object_unref (priv->collection);
+        priv->collection = NULL;
+    }
+
+    if (priv->importer != NULL) {
+        g_object_unref (priv->importer);
+        priv->importer = NULL;
+    }
+
+    if (priv->indexer != NULL) {
+        g_object_unref (priv->indexer);
+        priv->indexer = NULL;
+    }
+
+    G_OBJECT_CLASS (books_watcher_parent_class)->dispose (object);
+}
+
+static void
+books_watcher_finalize (GObject *object)
+{
+    BooksWatcherPrivate *priv;
+
+    priv = BOOKS_WATCHER_GET_PRIVATE (object);
+    g_strfreev (priv->folders);
+    g_hash_table_destroy (priv->added);
+    g_hash_table_destroy (priv->removed);
+    g_ptr_array_unref (priv->renames);
+
+    G_OBJECT_CLASS (books_watcher_parent_class)->finalize (object);
+}
+
+static void
+books_watcher_class_init (BooksWatcherClass *klass)
+{
+    GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+    object_class->dispose = books_watcher_dispose;
+    object_class->finalize = books_watcher_finalize;
+
+    g_type_class_add_private (klass, sizeof(BooksWatcherPrivate));
+}
+
+static void
+books_watcher_init (BooksWatcher *watcher)
+{
+    BooksWatcherPrivate *priv;
+
+    watcher->priv = priv = BOOKS_WATCHER_GET_PRIVATE (watcher);
+
+    priv->collection = NULL;
+    priv->importer = NULL;
+    priv->indexer = NULL;
+    priv->folders = NULL;
+    priv->flush_source = 0;
+    priv->first_change = 0;
+    priv->cancellable = g_cancellable_new ();
+    priv->import_cancellable = g_cancellable_new ();
+    priv->monitors = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, (GDestroyNotify) free_monitor);
+    priv->added = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->removed = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, NULL);
+    priv->renames = g_ptr_array_new_with_free_func (g_free);
+}
@@ -0,0 +1,41 @@
+#ifndef BOOKS_WATCHER_H
+#define BOOKS_WATCHER_H
+
+#include <gio/gio.h>
+#include "books-collection.h"
+#include "books-importer.h"
+#include "books-indexer.h"
+
+G_BEGIN_DECLS
+
+#define BOOKS_TYPE_WATCHER             (books_watcher_get_type())
+#define BOOKS_WATCHER(obj)             (G_TYPE_CHECK_INSTANCE_CAST((obj), BOOKS_TYPE_WATCHER, BooksWatcher))
+#define BOOKS_IS_WATCHER(obj)          (G_TYPE_CHECK_INSTANCE_TYPE((obj), BOOKS_TYPE_WATCHER))
+#define BOOKS_WATCHER_CLASS(klass)     (G_TYPE_CHECK_CLASS_CAST((klass), BOOKS_TYPE_WATCHER, BooksWatcherClass))
+#define BOOKS_IS_WATCHER_CLASS(klass)  (G_TYPE_CHECK_CLASS_TYPE((klass), BOOKS_TYPE_WATCHER))
+#define BOOKS_WATCHER_GET_CLASS(obj)   (G_TYPE_INSTANCE_GET_CLASS((obj), BOOKS_TYPE_WATCHER, BooksWatcherClass))
+
+typedef struct _BooksWatcher           BooksWatcher;
+typedef struct _BooksWatcherClass      BooksWatcherClass;
+typedef struct _BooksWatcherPrivate    BooksWatcherPrivate;
+
+struct _BooksWatcher {
+    GObject parent_instance;
+
+    BooksWatcherPrivate *priv;
+};
+
+struct _BooksWatcherClass {
+    GObjectClass parent_class;
+};
+
+BooksWatcher  * books_watcher_new             (BooksCollection     *collection,
+                                               BooksImporter       *importer,
+                                               BooksIndexer        *indexer);
+void            books_watcher_set_folders     (BooksWatcher        *watcher,
+                                               const gchar * const *folders);
+GType           books_watcher_get_type        (void);
+
+G_END_DECLS
+
+#endif
@@ -7,6 +7,7 @@
 #include "books-window.h"
 #include "books-preferences-dialog.h"
 #include "books-epub.h"
+#include "books-epub-request.h"
 
 
 G_DEFINE_TYPE(BooksWindow, books_window, GTK_TYPE_WINDOW)
@@ -14,19 +15,29 @@ G_DEFINE_TYPE(BooksWindow, books_window, GTK_TYPE_WINDOW)
 #define BOOKS_WINDOW_GET_PRIVATE(obj) (G_TYPE_INSTANCE_GET_PRIVATE((obj), BOOKS_TYPE_WINDOW, BooksWindowPrivate))
 
 
+/* The shown document plus its prefetched predecessor and successor */
+#define N_VIEWS     3
+
 struct _BooksWindowPrivate {
     GSettings *settings;
     GtkWidget *main_box;
     GtkWidget *toolbar;
-    GtkWidget *scrolled_window;
+    GtkWidget *notebook;
+    GtkWidget *views[N_VIEWS];
     GtkWidget *html_view;
     GtkWidget *go_forward_item;
     GtkWidget *go_back_item;
+    GtkWidget *progress_bar;
     BooksEpub *epub;
+    BooksCollection *collection;
     gchar     *css_uri;
+    guint      initial_position;
+    gdouble    restore_offset;
+    guint      restore_source;
+    GCancellable *cancellable;
 };
 
-static void load_web_view_content       (BooksWindowPrivate *priv);
+static void show_document               (BooksWindowPrivate *priv);
 static void update_navigation_buttons   (BooksWindowPrivate *priv);
 
 
@@ -43,26 +54,228 @@ books_window_set_epub (BooksWindow *window,
     g_return_if_fail (BOOKS_IS_WINDOW (window));
 
     window->priv->epub = epub;
-    load_web_view_content (window->priv);
+    window->priv->restore_offset = books_epub_get_offset (epub);
+
+    /* Publisher styles are removed before the documents reach WebKit */
+    g_object_set (epub, "strip-style-sheets", window->priv->css_uri != NULL, NULL);
+
+    show_document (window->priv);
+}
+
+static void
+on_open_progress (gdouble fraction,
+                  BooksWindowPrivate *priv)
+{
+    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (priv->progress_bar), fraction);
+}
+
+static void
+show_opened_book (BooksWindow *window,
+                  BooksEpub *epub,
+                  GError *error)
+{
+    if (epub != NULL) {
+        gtk_widget_hide (window->priv->progress_bar);
+        books_window_set_epub (window, epub);
+    }
+    else {
+        if (!g_error_matches (error, G_IO_ERROR, G_IO_ERROR_CANCELLED)) {
+            g_printerr ("Could not open book: %s\n", error->message);
+            gtk_widget_destroy (GTK_WIDGET (window));
+        }
+
+        g_error_free (error);
+    }
+}
+
+static void
+on_book_opened (GObject *source,
+                GAsyncResult *result,
+                BooksWindow *window)
+{
+    BooksEpub *epub;
+    GError *error = NULL;
+
+    epub = books_collection_get_book_finish (BOOKS_COLLECTION (source), result, &error);
+    show_opened_book (window, epub, error);
+    g_object_unref (window);
+}
+
+static void
+on_file_opened (GObject *source,
+                GAsyncResult *result,
+                BooksWindow *window)
+{
+    BooksEpub *epub;
+    GError *error = NULL;
+
+    epub = books_collection_get_book_finish (BOOKS_COLLECTION (source), result, &error);
+
+    if (epub != NULL)
+        books_epub_seek (epub, window->priv->initial_position);
+
+    show_opened_book (window, epub, error);
+    g_object_unref (window);
+}
+
+static void
+start_progress (BooksWindowPrivate *priv)
+{
+    gtk_progress_bar_set_fraction (GTK_PROGRESS_BAR (priv->progress_bar), 0.0);
+    gtk_widget_show (priv->progress_bar);
+}
+
+/*
+ * Shows the window right away and opens the book at @path in the background.
+ * Closing the window cancels the operation.
+ */
+void
+books_window_open_book (BooksWindow *window,
+                        BooksCollection *collection,
+                        GtkTreePath *path)
+{
+    BooksWindowPrivate *priv;
+
+    g_return_if_fail (BOOKS_IS_WINDOW (window));
+
+    priv = window->priv;
+    priv->collection = g_object_ref (collection);
+    start_progress (priv);
+
+    books_collection_get_book_async (collection, path, priv->cancellable,
+                                     (BooksEpubProgressCallback) on_open_progress, priv,
+                                     (GAsyncReadyCallback) on_book_opened,
+                                     g_object_ref (window));
+}
+
+/*
+ * Like books_window_open_book but for a book file that is shown at spine
+ * document @position, e.g. a search result.
+ */
+void
+books_window_open_file (BooksWindow *window,
+                        BooksCollection *collection,
+                        const gchar *filename,
+                        guint position)
+{
+    BooksWindowPrivate *priv;
+
+    g_return_if_fail (BOOKS_IS_WINDOW (window));
+
+    priv = window->priv;
+    priv->collection = g_object_ref (collection);
+    priv->initial_position = position;
+    start_progress (priv);
+
+    books_collection_get_book_for_file_async (collection, filename, priv->cancellable,
+                                              (BooksEpubProgressCallback) on_open_progress, priv,
+                                              (GAsyncReadyCallback) on_file_opened,
+                                              g_object_ref (window));
+}
+
+static GtkAdjustment *
+get_view_adjustment (GtkWidget *view)
+{
+    return gtk_scrollable_get_vadjustment (GTK_SCROLLABLE (view));
+}
+
+static gboolean
+restore_offset (BooksWindowPrivate *priv)
+{
+    GtkAdjustment *adjustment;
+
+    adjustment = get_view_adjustment (priv->html_view);
+    gtk_adjustment_set_value (adjustment, priv->restore_offset * gtk_adjustment_get_upper (adjustment));
+    priv->restore_offset = 0.0;
+    priv->restore_source = 0;
+    return FALSE;
+}
+
+static const gchar *
+get_view_uri (GtkWidget *view)
+{
+    return g_object_get_data (G_OBJECT (view), "books-uri");
+}
+
+static void
+load_view (GtkWidget *view,
+           const gchar *uri)
+{
+    if (uri == NULL || !g_strcmp0 (get_view_uri (view), uri))
+        return;
+
+    g_object_set_data_full (G_OBJECT (view), "books-uri", g_strdup (uri), g_free);
+    webkit_web_view_load_uri (WEBKIT_WEB_VIEW (view), uri);
+}
+
+/*
+ * Loads the documents around the current one into the two hidden views,
+ * reusing a view if it already holds one of them.
+ */
+static void
+prefetch_neighbours (BooksWindowPrivate *priv)
+{
+    GtkWidget *spare[N_VIEWS - 1];
+    const gchar *next_uri;
+    const gchar *previous_uri = NULL;
+    guint position;
+    guint i, n = 0;
+
+    for (i = 0; i < N_VIEWS; i++) {
+        if (priv->views[i] != priv->html_view)
+            spare[n++] = priv->views[i];
+    }
+
+    position = books_epub_get_position (priv->epub);
+    next_uri = books_epub_get_document_uri (priv->epub, position + 1);
+
+    if (position > 0)
+        previous_uri = books_epub_get_document_uri (priv->epub, position - 1);
+
+    /* spare[0] takes the next, spare[1] the previous document */
+    if (!g_strcmp0 (get_view_uri (spare[1]), next_uri) ||
+        !g_strcmp0 (get_view_uri (spare[0]), previous_uri)) {
+        GtkWidget *tmp;
+
+        tmp = spare[0];
+        spare[0] = spare[1];
+        spare[1] = tmp;
+    }
+
+    load_view (spare[0], next_uri);
+    load_view (spare[1], previous_uri);
 }
 
+/*
+ * Shows the current document of the book. If it has been prefetched, the
+ * view holding it is brought to front without another load and layout.
+ */
 static void
-load_web_view_content (BooksWindowPrivate *priv)
+show_document (BooksWindowPrivate *priv)
 {
     const gchar *uri;
+    guint i;
 
     uri = books_epub_get_uri (priv->epub);
 
     if (uri != NULL) {
-        WebKitWebSettings *settings;
+        GtkWidget *view = NULL;
 
-        webkit_web_view_load_uri (WEBKIT_WEB_VIEW (priv->html_view), uri);
-        settings = webkit_web_view_get_settings (WEBKIT_WEB_VIEW (priv->html_view));
+        for (i = 0; i < N_VIEWS && view == NULL; i++) {
+            if (!g_strcmp0 (get_view_uri (priv->views[i]), uri))
+                view = priv->views[i];
+        }
 
-        g_object_set (G_OBJECT (settings),
-                      "default-font-family", "serif",
-                      "user-stylesheet-uri", priv->css_uri,
-                      NULL);
+        if (view == NULL) {
+            view = priv->html_view;
+            load_view (view, uri);
+        }
+
+        priv->html_view = view;
+        gtk_notebook_set_current_page (GTK_NOTEBOOK (priv->notebook),
+                                       gtk_notebook_page_num (GTK_NOTEBOOK (priv->notebook),
+                                                              gtk_widget_get_parent (view)));
+        prefetch_neighbours (priv);
     }
 
     update_navigation_buttons (priv);
@@ -83,7 +296,7 @@ on_go_back_clicked (GtkToolButton *button,
                     BooksWindowPrivate *priv)
 {
     books_epub_previous (priv->epub);
-    load_web_view_content (priv);
+    show_document (priv);
 }
 
 static void
@@ -91,7 +304,7 @@ on_go_forward_clicked (GtkToolButton *button,
                        BooksWindowPrivate *priv)
 {
     books_epub_next (priv->epub);
-    load_web_view_content (priv);
+    show_document (priv);
 }
 
 static void
@@ -103,28 +316,25 @@ on_load_status_changed (WebKitWebView *view,
 
     load_status = webkit_web_view_get_load_status (view);
 
-    if (load_status == WEBKIT_LOAD_FINISHED) {
-        WebKitDOMDocument *document;
-        WebKitDOMStyleSheetList *sheet_list;
+    /* Only links followed in the shown view move the reading position */
+    if (load_status == WEBKIT_LOAD_FINISHED &&
+        GTK_WIDGET (view) == priv->html_view && priv->epub != NULL) {
         const gchar *load_uri;
         const gchar *current_uri;
-        guint i;
 
         current_uri = books_epub_get_uri (priv->epub);
         load_uri = webkit_web_view_get_uri (view);
 
-        if (g_strcmp0 (current_uri, load_uri))
+        if (g_strcmp0 (current_uri, load_uri)) {
+            g_object_set_data_full (G_OBJECT (view), "books-uri", g_strdup (load_uri), g_free);
             books_epub_set_uri (priv->epub, load_uri);
-
-        document = webkit_web_view_get_dom_document (view);
-        sheet_list = webkit_dom_document_get_style_sheets (document);
-
-        for (i = 0; i < webkit_dom_style_sheet_list_get_length (sheet_list); i++) {
-            WebKitDOMStyleSheet *style_sheet;
-
-            style_sheet = webkit_dom_style_sheet_list_item (sheet_list, i);
-            webkit_dom_style_sheet_set_disabled (style_sheet, TRUE);
+            prefetch_neighbours (priv);
+            update_navigation_buttons (priv);
         }
+
+        /* Scroll to where reading stopped once the document has been laid out */
+        if (priv->restore_offset > 0.0 && priv->restore_source == 0)
+            priv->restore_source = g_idle_add ((GSourceFunc) restore_offset, priv);
     }
 }
 
@@ -137,6 +347,19 @@ on_window_destroy (GtkWidget *widget,
     gtk_widget_get_allocation (widget, &allocation);
     g_settings_set (priv->settings, "viewer-window-size",
                     "(ii)", allocation.width, allocation.height);
+
+    if (priv->epub != NULL && priv->collection != NULL) {
+        GtkAdjustment *adjustment;
+        gdouble upper;
+
+        adjustment = get_view_adjustment (priv->html_view);
+        upper = gtk_adjustment_get_upper (adjustment);
+
+        if (upper > 0.0)
+            books_epub_set_offset (priv->epub, gtk_adjustment_get_value (adjustment) / upper);
+
+        books_collection_save_state (priv->collection, priv->epub);
+    }
 }
 
 static void
@@ -146,11 +369,27 @@ books_window_dispose (GObject *object)
 
     priv = BOOKS_WINDOW_GET_PRIVATE (object);
 
+    if (priv->cancellable != NULL) {
+        g_cancellable_cancel (priv->cancellable);
+        g_object_unref (priv->cancellable);
+        priv->cancellable = NULL;
+    }
+
+    if (priv->restore_source != 0) {
+        g_source_remove (priv->restore_source);
+        priv->restore_source = 0;
+    }
+
     if (priv->epub != NULL) {
         g_object_unref (priv->epub);
         priv->epub = NULL;
     }
 
+    if (priv->collection != NULL) {
+        g_object_unref (priv->collection);
+        priv->collection = NULL;
+    }
+
     G_OBJECT_CLASS (books_window_parent_class)->dispose (object);
 }
 
@@ -177,6 +416,9 @@ books_window_class_init (BooksWindowClass *klass)
     object_class->dispose = books_window_dispose;
     object_class->finalize = books_window_finalize;
 
+    /* Book contents are served from the archive via epub:// URIs */
+    soup_session_add_feature_by_type (webkit_get_default_session (), BOOKS_TYPE_EPUB_REQUEST);
+
     g_type_class_add_private (klass, sizeof(BooksWindowPrivate));
 }
 
@@ -185,6 +427,7 @@ books_window_init (BooksWindow *window)
 {
     BooksWindowPrivate *priv;
     guint width, height;
+    guint i;
 
     window->priv = priv = BOOKS_WINDOW_GET_PRIVATE (window);
 
@@ -197,6 +440,11 @@ books_window_init (BooksWindow *window)
     gtk_window_set_default_size (GTK_WINDOW (window), width, height);
 
     priv->epub = NULL;
+    priv->collection = NULL;
+    priv->initial_position = 0;
+    priv->restore_offset = 0.0;
+    priv->restore_source = 0;
+    priv->cancellable = g_cancellable_new ();
     priv->main_box = gtk_box_new (GTK_ORIENTATION_VERTICAL, 0);
     gtk_container_add (GTK_CONTAINER (window), priv->main_box);
 
@@ -214,24 +462,17 @@ books_window_init (BooksWindow *window)
     gtk_toolbar_insert (GTK_TOOLBAR (priv->toolbar), GTK_TOOL_ITEM (priv->go_forward_item), -1);
     gtk_widget_set_sensitive (priv->go_forward_item, FALSE);
 
+    /* Shown while a book is opened in the background */
+    priv->progress_bar = gtk_progress_bar_new ();
+    gtk_widget_set_no_show_all (priv->progress_bar, TRUE);
+    gtk_container_add (GTK_CONTAINER (priv->main_box), priv->progress_bar);
+
     g_signal_connect (priv->go_back_item, "clicked",
                       G_CALLBACK (on_go_back_clicked), priv);
 
     g_signal_connect (priv->go_forward_item, "clicked",
                       G_CALLBACK (on_go_forward_clicked), priv);
 
-    /* Add EPUB view */
-    priv->scrolled_window = gtk_scrolled_window_new (NULL, NULL);
-    gtk_container_add (GTK_CONTAINER (priv->main_box), priv->scrolled_window);
-
-    priv->html_view = webkit_web_view_new ();
-    gtk_widget_set_vexpand (priv->html_view, TRUE);
-    gtk_container_add (GTK_CONTAINER (priv->scrolled_window), priv->html_view);
-
-    g_signal_connect (priv->html_view, "notify::load-status",
-                      G_CALLBACK (on_load_status_changed),
-                      priv);
-
     /* Create CSS uri if requested */
     if (g_settings_get_enum (priv->settings, "style-sheet") == BOOKS_STYLE_SHEET_BOOKS) {
         gchar *css_filename;
@@ -243,5 +484,36 @@ books_window_init (BooksWindow *window)
     }
     else
         priv->css_uri = NULL;
+
+    /* Add EPUB views, only the one showing the current document is visible */
+    priv->notebook = gtk_notebook_new ();
+    gtk_notebook_set_show_tabs (GTK_NOTEBOOK (priv->notebook), FALSE);
+    gtk_notebook_set_show_border (GTK_NOTEBOOK (priv->notebook), FALSE);
+    gtk_widget_set_vexpand (priv->notebook, TRUE);
+    gtk_container_add (GTK_CONTAINER (priv->main_box), priv->notebook);
+
+    for (i = 0; i < N_VIEWS; i++) {
+        GtkWidget *scrolled_window;
+        WebKitWebSettings *settings;
+
+        scrolled_window = gtk_scrolled_window_new (NULL, NULL);
+        priv->views[i] = webkit_web_view_new ();
+        gtk_widget_set_vexpand (priv->views[i], TRUE);
+        gtk_container_add (GTK_CONTAINER (scrolled_window), priv->views[i]);
+        gtk_notebook_append_page (GTK_NOTEBOOK (priv->notebook), scrolled_window, NULL);
+
+        settings = webkit_web_view_get_settings (WEBKIT_WEB_VIEW (priv->views[i]));
+
+        g_object_set (G_OBJECT (settings),
+                      "default-font-family", "serif",
+                      "user-stylesheet-uri", priv->css_uri,
+                      NULL);
+
+        g_signal_connect (priv->views[i], "notify::load-status",
+                          G_CALLBACK (on_load_status_changed),
+                          priv);
+    }
+
+    priv->html_view = priv->views[0];
 }
 
@@ -4,6 +4,7 @@
 #include <gtk/gtk.h>
 
 #include "books-epub.h"
+#include "books-collection.h"
 
 G_BEGIN_DECLS
 
@@ -32,6 +33,13 @@ struct _BooksWindowClass {
 GtkWidget * books_window_new          (void);
 void        books_window_set_epub     (BooksWindow *window,
                                        BooksEpub *epub);
+void        books_window_open_book    (BooksWindow *window,
+                                       BooksCollection *collection,
+                                       GtkTreePath *path);
+void        books_window_open_file    (BooksWindow *window,
+                                       BooksCollection *collection,
+                                       const gchar *filename,
+                                       guint position);
 GType       books_window_get_type     (void);
 
 G_END_DECLS